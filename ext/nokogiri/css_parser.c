@@ -0,0 +1,1403 @@
+#include <css_parser.h>
+
+/*
+ * A C port of the selector compiler in lib/nokogiri/css: the rexical
+ * tokenizer, the racc grammar, Node#preprocess! and XPathVisitor.  It has
+ * to produce exactly the XPath that the Ruby code produces, so it follows
+ * that code construct for construct, quirks included.  Whenever it is
+ * unsure (a syntax error, or a selector whose XPath depends on how Ruby
+ * would stringify an object) it gives up and the caller falls back to the
+ * Ruby implementation.
+ */
+
+/* Deeper nesting than this is left to the Ruby implementation. */
+#define CSS_MAX_TOKENS 2048
+
+enum css_token_type {
+    TOKEN_EOS,
+    TOKEN_HAS,
+    TOKEN_FUNCTION,
+    TOKEN_IDENT,
+    TOKEN_HASH,
+    TOKEN_INCLUDES,
+    TOKEN_DASHMATCH,
+    TOKEN_PREFIXMATCH,
+    TOKEN_SUFFIXMATCH,
+    TOKEN_SUBSTRINGMATCH,
+    TOKEN_NOT_EQUAL,
+    TOKEN_EQUAL,
+    TOKEN_RPAREN,
+    TOKEN_LSQUARE,
+    TOKEN_RSQUARE,
+    TOKEN_PLUS,
+    TOKEN_GREATER,
+    TOKEN_COMMA,
+    TOKEN_TILDE,
+    TOKEN_NOT,
+    TOKEN_NUMBER,
+    TOKEN_DOUBLESLASH,
+    TOKEN_SLASH,
+    TOKEN_S,
+    TOKEN_STRING,
+    TOKEN_CHAR
+};
+
+enum css_node_type {
+    CSS_CONDITIONAL_SELECTOR,
+    CSS_ELEMENT_NAME,
+    CSS_COMBINATOR,
+    CSS_FUNCTION,
+    CSS_PSEUDO_CLASS,
+    CSS_ATTRIBUTE_CONDITION,
+    CSS_CLASS_CONDITION,
+    CSS_ID,
+    CSS_NOT,
+    CSS_AN_PLUS_B,
+    CSS_DIRECT_ADJACENT_SELECTOR,
+    CSS_CHILD_SELECTOR,
+    CSS_PRECEDING_SELECTOR,
+    CSS_DESCENDANT_SELECTOR
+};
+
+/* The eql_incl_dash symbols */
+enum css_match {
+    CSS_EQUAL,
+    CSS_PREFIX_MATCH,
+    CSS_SUFFIX_MATCH,
+    CSS_SUBSTRING_MATCH,
+    CSS_NOT_EQUAL,
+    CSS_INCLUDES,
+    CSS_DASH_MATCH
+};
+
+typedef struct {
+    const char *ptr;
+    long len;
+} css_string;
+
+typedef struct {
+    enum css_token_type type;
+    css_string text;
+} css_token;
+
+typedef struct css_node css_node;
+
+/* An element of Node#value: a String, a Node or an operator Symbol */
+typedef struct {
+    css_node *node;
+    css_string str;
+    int match;
+} css_value;
+
+struct css_node {
+    enum css_node_type type;
+    long len;
+    long capa;
+    css_value *values;
+};
+
+typedef struct css_chunk {
+    struct css_chunk *next;
+    size_t used;
+    size_t size;
+    double data[1];
+} css_chunk;
+
+typedef struct {
+    css_token *tokens;
+    long ntokens;
+    long pos;
+    int xmlns;
+    css_chunk *chunks;
+} css_parser;
+
+#define CSS_STRING(literal) css_string_new(literal, sizeof(literal) - 1)
+
+#define CSS_IS_WS(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || \
+		      (c) == '\v' || (c) == '\f' || (c) == '\r')
+#define CSS_IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define CSS_IS_ALPHA(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
+#define CSS_IS_HEX(c) (CSS_IS_DIGIT(c) || ((c) >= 'a' && (c) <= 'f') || \
+		       ((c) >= 'A' && (c) <= 'F'))
+#define CSS_IS_NONASCII(c) ((unsigned char)(c) >= 0x80)
+
+#define TOKEN(p) ((p)->tokens[(p)->pos].type)
+#define TOKEN_TEXT(p) ((p)->tokens[(p)->pos].text)
+#define PEEK(p) ((p)->tokens[(p)->pos + 1 < (p)->ntokens ? (p)->pos + 1 : (p)->pos].type)
+#define TOKEN_IS_CHAR(p, c) (TOKEN(p) == TOKEN_CHAR && TOKEN_TEXT(p).ptr[0] == (c))
+#define IS_ELEMENT_NAME_START(p) \
+    (TOKEN(p) == TOKEN_IDENT || TOKEN_IS_CHAR(p, '|') || TOKEN_IS_CHAR(p, '*'))
+#define IS_FUNCTION_START(p) \
+    (TOKEN(p) == TOKEN_FUNCTION || TOKEN(p) == TOKEN_NOT || TOKEN(p) == TOKEN_HAS)
+#define IS_HCAP_START(p) \
+    (TOKEN(p) == TOKEN_HASH || TOKEN(p) == TOKEN_LSQUARE || \
+     TOKEN_IS_CHAR(p, '.') || TOKEN_IS_CHAR(p, ':'))
+
+static css_string
+css_string_new(const char *ptr, long len)
+{
+    css_string str;
+
+    str.ptr = ptr;
+    str.len = len;
+    return str;
+}
+
+static int
+css_string_eq(css_string str, const char *literal)
+{
+    long len = (long)strlen(literal);
+
+    return str.len == len && !memcmp(str.ptr, literal, len);
+}
+
+static int
+css_string_prefix_p(css_string str, const char *literal)
+{
+    long len = (long)strlen(literal);
+
+    return str.len >= len && !memcmp(str.ptr, literal, len);
+}
+
+/*
+ * Memory
+ */
+
+static void *
+css_alloc(css_parser *p, size_t size)
+{
+    css_chunk *chunk = p->chunks;
+    void *ptr;
+
+    size = (size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+    if (!chunk || chunk->size - chunk->used < size) {
+	size_t capa = size > 4096 ? size : 4096;
+
+	chunk = ruby_xmalloc(sizeof(css_chunk) + capa);
+	chunk->size = capa;
+	chunk->used = 0;
+	chunk->next = p->chunks;
+	p->chunks = chunk;
+    }
+    ptr = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+static void
+css_free(css_parser *p)
+{
+    css_chunk *chunk, *next;
+
+    for (chunk = p->chunks; chunk; chunk = next) {
+	next = chunk->next;
+	ruby_xfree(chunk);
+    }
+    p->chunks = NULL;
+}
+
+static css_string
+css_string_concat(css_parser *p, css_string a, const char *sep, css_string b)
+{
+    long sep_len = (long)strlen(sep);
+    char *ptr = css_alloc(p, a.len + sep_len + b.len);
+
+    memcpy(ptr, a.ptr, a.len);
+    memcpy(ptr + a.len, sep, sep_len);
+    memcpy(ptr + a.len + sep_len, b.ptr, b.len);
+    return css_string_new(ptr, a.len + sep_len + b.len);
+}
+
+static css_node *
+node_new(css_parser *p, enum css_node_type type)
+{
+    css_node *node = css_alloc(p, sizeof(css_node));
+
+    node->type = type;
+    node->len = 0;
+    node->capa = 0;
+    node->values = NULL;
+    return node;
+}
+
+static css_value *
+node_push(css_parser *p, css_node *node)
+{
+    css_value *value;
+
+    if (node->len == node->capa) {
+	long capa = node->capa ? node->capa * 2 : 4;
+	css_value *values = css_alloc(p, capa * sizeof(css_value));
+
+	if (node->len) memcpy(values, node->values, node->len * sizeof(css_value));
+	node->values = values;
+	node->capa = capa;
+    }
+    value = &node->values[node->len++];
+    value->node = NULL;
+    value->str = css_string_new(NULL, 0);
+    value->match = -1;
+    return value;
+}
+
+static void
+push_node(css_parser *p, css_node *node, css_node *child)
+{
+    node_push(p, node)->node = child;
+}
+
+static void
+push_string(css_parser *p, css_node *node, css_string str)
+{
+    node_push(p, node)->str = str;
+}
+
+static css_node *
+node_new2(css_parser *p, enum css_node_type type, css_node *a, css_node *b)
+{
+    css_node *node = node_new(p, type);
+
+    push_node(p, node, a);
+    push_node(p, node, b);
+    return node;
+}
+
+static css_node *
+node_new_string(css_parser *p, enum css_node_type type, css_string str)
+{
+    css_node *node = node_new(p, type);
+
+    push_string(p, node, str);
+    return node;
+}
+
+static css_node *
+an_plus_b_new(css_parser *p, css_string a, css_string b)
+{
+    css_node *node = node_new(p, CSS_AN_PLUS_B);
+
+    push_string(p, node, a);
+    push_string(p, node, CSS_STRING("n"));
+    push_string(p, node, CSS_STRING("+"));
+    push_string(p, node, b);
+    return node;
+}
+
+/*
+ * Tokenizer, see tokenizer.rex.  rexical tries its rules in order and
+ * takes the first one that matches, not the longest.
+ */
+
+static const char *
+scan_w(const char *ptr, const char *end)
+{
+    while (ptr < end && CSS_IS_WS(*ptr)) ptr++;
+    return ptr;
+}
+
+/* {unicode}|\\[^\n\r\f0-9A-Fa-f] */
+static const char *
+scan_escape(const char *ptr, const char *end)
+{
+    int i;
+
+    if (ptr + 1 >= end || *ptr != '\\') return NULL;
+    ptr++;
+    if (CSS_IS_HEX(*ptr)) {
+	for (i = 0; i < 6 && ptr < end && CSS_IS_HEX(*ptr); i++) ptr++;
+	if (ptr + 1 < end && ptr[0] == '\r' && ptr[1] == '\n') return ptr + 2;
+	if (ptr < end && CSS_IS_WS(*ptr)) return ptr + 1;
+	return ptr;
+    }
+    if (*ptr == '\n' || *ptr == '\r' || *ptr == '\f') return NULL;
+    return ptr + 1;
+}
+
+static const char *
+scan_nmstart(const char *ptr, const char *end)
+{
+    if (ptr >= end) return NULL;
+    if (*ptr == '_' || CSS_IS_ALPHA(*ptr) || CSS_IS_NONASCII(*ptr)) return ptr + 1;
+    return scan_escape(ptr, end);
+}
+
+static const char *
+scan_nmchar(const char *ptr, const char *end)
+{
+    if (ptr >= end) return NULL;
+    if (*ptr == '_' || *ptr == '-' || CSS_IS_ALPHA(*ptr) || CSS_IS_DIGIT(*ptr) ||
+	CSS_IS_NONASCII(*ptr))
+	return ptr + 1;
+    return scan_escape(ptr, end);
+}
+
+static const char *
+scan_ident(const char *ptr, const char *end)
+{
+    const char *next;
+
+    if (*ptr == '-' || *ptr == '@') ptr++;
+    if (!(ptr = scan_nmstart(ptr, end))) return NULL;
+    while ((next = scan_nmchar(ptr, end))) ptr = next;
+    return ptr;
+}
+
+/* -?([0-9]+|[0-9]*\.[0-9]+) */
+static const char *
+scan_num(const char *ptr, const char *end)
+{
+    if (*ptr == '-') ptr++;
+    if (ptr < end && CSS_IS_DIGIT(*ptr)) {
+	while (ptr < end && CSS_IS_DIGIT(*ptr)) ptr++;
+	return ptr;
+    }
+    if (ptr + 1 < end && *ptr == '.' && CSS_IS_DIGIT(ptr[1])) {
+	ptr++;
+	while (ptr < end && CSS_IS_DIGIT(*ptr)) ptr++;
+	return ptr;
+    }
+    return NULL;
+}
+
+static const char *
+scan_token(const char *ptr, const char *end, enum css_token_type *type)
+{
+    const char *w, *next;
+
+#define RETURN_TOKEN(t, e) do { *type = (t); return (e); } while (0)
+
+    if (end - ptr >= 4 && !memcmp(ptr, "has(", 4))
+	RETURN_TOKEN(TOKEN_HAS, scan_w(ptr + 4, end));
+
+    if ((next = scan_ident(ptr, end))) {
+	if (next < end && *next == '(')
+	    RETURN_TOKEN(TOKEN_FUNCTION, scan_w(next + 1, end));
+	RETURN_TOKEN(TOKEN_IDENT, next);
+    }
+
+    if (*ptr == '#' && (next = scan_nmchar(ptr + 1, end))) {
+	const char *more;
+
+	while ((more = scan_nmchar(next, end))) next = more;
+	RETURN_TOKEN(TOKEN_HASH, next);
+    }
+
+    w = scan_w(ptr, end);
+    if (w < end) {
+	int eq = w + 1 < end && w[1] == '=';
+
+	switch (*w) {
+	  case '~':
+	    if (eq) RETURN_TOKEN(TOKEN_INCLUDES, scan_w(w + 2, end));
+	    RETURN_TOKEN(TOKEN_TILDE, scan_w(w + 1, end));
+	  case '|':
+	    if (eq) RETURN_TOKEN(TOKEN_DASHMATCH, scan_w(w + 2, end));
+	    break;
+	  case '^':
+	    if (eq) RETURN_TOKEN(TOKEN_PREFIXMATCH, scan_w(w + 2, end));
+	    break;
+	  case '$':
+	    if (eq) RETURN_TOKEN(TOKEN_SUFFIXMATCH, scan_w(w + 2, end));
+	    break;
+	  case '*':
+	    if (eq) RETURN_TOKEN(TOKEN_SUBSTRINGMATCH, scan_w(w + 2, end));
+	    break;
+	  case '!':
+	    if (eq) RETURN_TOKEN(TOKEN_NOT_EQUAL, scan_w(w + 2, end));
+	    break;
+	  case '=':
+	    RETURN_TOKEN(TOKEN_EQUAL, scan_w(w + 1, end));
+	  case ')':
+	    RETURN_TOKEN(TOKEN_RPAREN, w + 1);
+	  case '[':
+	    RETURN_TOKEN(TOKEN_LSQUARE, scan_w(w + 1, end));
+	  case ']':
+	    RETURN_TOKEN(TOKEN_RSQUARE, w + 1);
+	  case '+':
+	    RETURN_TOKEN(TOKEN_PLUS, scan_w(w + 1, end));
+	  case '>':
+	    RETURN_TOKEN(TOKEN_GREATER, scan_w(w + 1, end));
+	  case ',':
+	    RETURN_TOKEN(TOKEN_COMMA, scan_w(w + 1, end));
+	  case '/':
+	    if (w + 1 < end && w[1] == '/')
+		RETURN_TOKEN(TOKEN_DOUBLESLASH, scan_w(w + 2, end));
+	    RETURN_TOKEN(TOKEN_SLASH, scan_w(w + 1, end));
+	}
+    }
+
+    if (end - ptr >= 5 && !memcmp(ptr, ":not(", 5))
+	RETURN_TOKEN(TOKEN_NOT, scan_w(ptr + 5, end));
+
+    if ((next = scan_num(ptr, end)))
+	RETURN_TOKEN(TOKEN_NUMBER, next);
+
+    if (w > ptr)
+	RETURN_TOKEN(TOKEN_S, w);
+
+    if (*ptr == '"' || *ptr == '\'') {
+	next = memchr(ptr + 1, *ptr, end - ptr - 1);
+	if (next) RETURN_TOKEN(TOKEN_STRING, next + 1);
+    }
+
+    RETURN_TOKEN(TOKEN_CHAR, ptr + 1);
+
+#undef RETURN_TOKEN
+}
+
+static int
+tokenize(css_parser *p, const char *ptr, long len)
+{
+    const char *end = ptr + len;
+    long capa = 16;
+
+    p->tokens = css_alloc(p, capa * sizeof(css_token));
+    p->ntokens = 0;
+
+    for (;;) {
+	css_token *token;
+
+	if (p->ntokens == capa) {
+	    css_token *tokens;
+
+	    if (capa >= CSS_MAX_TOKENS) return 0;
+	    tokens = css_alloc(p, capa * 2 * sizeof(css_token));
+	    memcpy(tokens, p->tokens, capa * sizeof(css_token));
+	    p->tokens = tokens;
+	    capa *= 2;
+	}
+	token = &p->tokens[p->ntokens++];
+	token->text.ptr = ptr;
+
+	if (ptr == end) {
+	    token->type = TOKEN_EOS;
+	    token->text.len = 0;
+	    return 1;
+	}
+
+	ptr = scan_token(ptr, end, &token->type);
+	token->text.len = ptr - token->text.ptr;
+
+	/*
+	 * The Ruby visitor uses line anchored regexps on some of these, so
+	 * selectors that carry a newline into the XPath are left to it.
+	 */
+	switch (token->type) {
+	  case TOKEN_FUNCTION:
+	  case TOKEN_IDENT:
+	  case TOKEN_HASH:
+	  case TOKEN_STRING:
+	    if (memchr(token->text.ptr, '\n', token->text.len)) return 0;
+	    break;
+	  default:
+	    break;
+	}
+    }
+}
+
+/*
+ * Parser, see parser.y.  The grammar is LALR(1) without conflicts, so a
+ * recursive descent parser with one token of lookahead (two where the
+ * grammar needs to tell an an+b apart from an argument list) accepts the
+ * same language and builds the same tree.
+ */
+
+static int parse_selector(css_parser *p, css_node *list);
+static css_node *parse_function(css_parser *p);
+static css_node *parse_hcap_1toN(css_parser *p);
+
+static css_string
+function_name(css_string text)
+{
+    while (text.len > 0 && CSS_IS_WS(text.ptr[text.len - 1])) text.len--;
+    return text;
+}
+
+static css_node *
+parse_element_name(css_parser *p)
+{
+    css_string name;
+
+    if (TOKEN(p) == TOKEN_IDENT) {
+	name = TOKEN_TEXT(p);
+	p->pos++;
+	if (TOKEN_IS_CHAR(p, '|')) {
+	    p->pos++;
+	    if (TOKEN(p) != TOKEN_IDENT) return NULL;
+	    name = css_string_concat(p, name, ":", TOKEN_TEXT(p));
+	    p->pos++;
+	} else if (p->xmlns) {
+	    name = css_string_concat(p, CSS_STRING(""), "xmlns:", name);
+	}
+	return node_new_string(p, CSS_ELEMENT_NAME, name);
+    }
+    if (TOKEN_IS_CHAR(p, '|')) {
+	p->pos++;
+	if (TOKEN(p) != TOKEN_IDENT) return NULL;
+	name = TOKEN_TEXT(p);
+	p->pos++;
+	return node_new_string(p, CSS_ELEMENT_NAME, name);
+    }
+    if (TOKEN_IS_CHAR(p, '*')) {
+	p->pos++;
+	return node_new_string(p, CSS_ELEMENT_NAME, CSS_STRING("*"));
+    }
+    return NULL;
+}
+
+static int
+parse_expr(css_parser *p, css_node *function)
+{
+    for (;;) {
+	enum css_token_type type = TOKEN(p);
+	css_string text = TOKEN_TEXT(p);
+
+	if (type != TOKEN_NUMBER && type != TOKEN_STRING && type != TOKEN_IDENT)
+	    return 0;
+	p->pos++;
+
+	if (TOKEN(p) == TOKEN_COMMA) {
+	    p->pos++;
+	    push_string(p, function, text);
+	    continue;
+	}
+
+	if (type == TOKEN_IDENT && css_string_eq(text, "even"))
+	    push_node(p, function, an_plus_b_new(p, CSS_STRING("2"), CSS_STRING("0")));
+	else if (type == TOKEN_IDENT && css_string_eq(text, "odd"))
+	    push_node(p, function, an_plus_b_new(p, CSS_STRING("2"), CSS_STRING("1")));
+	else
+	    push_string(p, function, text);
+	return 1;
+    }
+}
+
+static int
+parse_function_args(css_parser *p, css_node *function)
+{
+    css_string a, n;
+
+    if (TOKEN(p) == TOKEN_NUMBER && PEEK(p) == TOKEN_IDENT) {
+	a = TOKEN_TEXT(p);
+	n = p->tokens[p->pos + 1].text;
+	p->pos += 2;
+	if (!css_string_eq(n, "n")) return 0;
+	if (TOKEN(p) != TOKEN_PLUS) {
+	    push_node(p, function, an_plus_b_new(p, a, CSS_STRING("0")));
+	    return 1;
+	}
+	p->pos++;
+	if (TOKEN(p) != TOKEN_NUMBER) return 0;
+	push_node(p, function, an_plus_b_new(p, a, TOKEN_TEXT(p)));
+	p->pos++;
+	return 1;
+    }
+
+    if (TOKEN(p) == TOKEN_IDENT && PEEK(p) == TOKEN_PLUS) {
+	n = TOKEN_TEXT(p);
+	p->pos += 2;
+	if (TOKEN(p) != TOKEN_NUMBER) return 0;
+	if (css_string_eq(n, "n"))
+	    a = CSS_STRING("1");
+	else if (css_string_eq(n, "-n"))
+	    a = CSS_STRING("-1");
+	else
+	    return 0;
+	push_node(p, function, an_plus_b_new(p, a, TOKEN_TEXT(p)));
+	p->pos++;
+	return 1;
+    }
+
+    return parse_expr(p, function);
+}
+
+static css_node *
+parse_function(css_parser *p)
+{
+    enum css_token_type type = TOKEN(p);
+    css_node *function = node_new_string(p, CSS_FUNCTION,
+					 function_name(TOKEN_TEXT(p)));
+
+    p->pos++;
+    switch (type) {
+      case TOKEN_FUNCTION:
+	if (TOKEN(p) != TOKEN_RPAREN && !parse_function_args(p, function))
+	    return NULL;
+	break;
+      case TOKEN_NOT:
+	if (!parse_expr(p, function)) return NULL;
+	break;
+      case TOKEN_HAS:
+	if (!parse_selector(p, function)) return NULL;
+	break;
+      default:
+	return NULL;
+    }
+
+    if (TOKEN(p) != TOKEN_RPAREN) return NULL;
+    p->pos++;
+    return function;
+}
+
+static css_node *
+parse_pseudo(css_parser *p)
+{
+    css_node *pseudo = node_new(p, CSS_PSEUDO_CLASS);
+    css_node *function;
+
+    p->pos++;
+    if (IS_FUNCTION_START(p)) {
+	if (!(function = parse_function(p))) return NULL;
+	push_node(p, pseudo, function);
+    } else if (TOKEN(p) == TOKEN_IDENT) {
+	push_string(p, pseudo, TOKEN_TEXT(p));
+	p->pos++;
+    } else {
+	return NULL;
+    }
+    return pseudo;
+}
+
+static css_node *
+parse_attrib(css_parser *p)
+{
+    css_node *attrib, *name, *function;
+    css_value *value;
+    int match;
+
+    p->pos++;
+    if (TOKEN(p) == TOKEN_NUMBER) {
+	/* Non standard, but hpricot supports it. */
+	function = node_new_string(p, CSS_FUNCTION, CSS_STRING("nth-child("));
+	push_string(p, function, TOKEN_TEXT(p));
+	p->pos++;
+	if (TOKEN(p) != TOKEN_RSQUARE) return NULL;
+	p->pos++;
+	attrib = node_new(p, CSS_PSEUDO_CLASS);
+	push_node(p, attrib, function);
+	return attrib;
+    }
+
+    if (TOKEN(p) == TOKEN_IDENT) {
+	name = node_new_string(p, CSS_ELEMENT_NAME, TOKEN_TEXT(p));
+	p->pos++;
+    } else if (IS_FUNCTION_START(p)) {
+	if (!(name = parse_function(p))) return NULL;
+    } else {
+	return NULL;
+    }
+
+    attrib = node_new(p, CSS_ATTRIBUTE_CONDITION);
+    push_node(p, attrib, name);
+
+    switch (TOKEN(p)) {
+      case TOKEN_EQUAL:          match = CSS_EQUAL; break;
+      case TOKEN_PREFIXMATCH:    match = CSS_PREFIX_MATCH; break;
+      case TOKEN_SUFFIXMATCH:    match = CSS_SUFFIX_MATCH; break;
+      case TOKEN_SUBSTRINGMATCH: match = CSS_SUBSTRING_MATCH; break;
+      case TOKEN_NOT_EQUAL:      match = CSS_NOT_EQUAL; break;
+      case TOKEN_INCLUDES:       match = CSS_INCLUDES; break;
+      case TOKEN_DASHMATCH:      match = CSS_DASH_MATCH; break;
+      default:                   match = -1; break;
+    }
+    if (match >= 0) {
+	p->pos++;
+	if (TOKEN(p) != TOKEN_IDENT && TOKEN(p) != TOKEN_STRING) return NULL;
+	value = node_push(p, attrib);
+	value->match = match;
+	push_string(p, attrib, TOKEN_TEXT(p));
+	p->pos++;
+    }
+
+    if (TOKEN(p) != TOKEN_RSQUARE) return NULL;
+    p->pos++;
+    return attrib;
+}
+
+static css_node *
+parse_hcap_1toN(css_parser *p)
+{
+    css_node *item, *rest;
+
+    switch (TOKEN(p)) {
+      case TOKEN_HASH:
+	item = node_new_string(p, CSS_ID, TOKEN_TEXT(p));
+	p->pos++;
+	break;
+      case TOKEN_LSQUARE:
+	item = parse_attrib(p);
+	break;
+      default:
+	if (TOKEN_IS_CHAR(p, '.')) {
+	    p->pos++;
+	    if (TOKEN(p) != TOKEN_IDENT) return NULL;
+	    item = node_new_string(p, CSS_CLASS_CONDITION, TOKEN_TEXT(p));
+	    p->pos++;
+	} else if (TOKEN_IS_CHAR(p, ':')) {
+	    item = parse_pseudo(p);
+	} else {
+	    return NULL;
+	}
+    }
+    if (!item) return NULL;
+
+    if (!IS_HCAP_START(p)) return item;
+    if (!(rest = parse_hcap_1toN(p))) return NULL;
+    return node_new2(p, CSS_COMBINATOR, item, rest);
+}
+
+static css_node *
+parse_negation(css_parser *p)
+{
+    css_node *arg, *negation;
+
+    p->pos++;
+    if (IS_ELEMENT_NAME_START(p)) {
+	/* "element_name hcap_1toN" keeps only the element name */
+	if (!(arg = parse_element_name(p))) return NULL;
+	if (IS_HCAP_START(p) && !parse_hcap_1toN(p)) return NULL;
+    } else if (IS_HCAP_START(p)) {
+	if (!(arg = parse_hcap_1toN(p))) return NULL;
+    } else {
+	return NULL;
+    }
+
+    if (TOKEN(p) != TOKEN_RPAREN) return NULL;
+    p->pos++;
+
+    negation = node_new(p, CSS_NOT);
+    push_node(p, negation, arg);
+    return negation;
+}
+
+static css_node *
+parse_simple_selector(css_parser *p)
+{
+    css_node *head, *hcap, *negation;
+
+    if (IS_FUNCTION_START(p)) {
+	if (!(head = parse_function(p))) return NULL;
+	if (TOKEN_IS_CHAR(p, ':')) {
+	    if (!(hcap = parse_pseudo(p))) return NULL;
+	    return node_new2(p, CSS_CONDITIONAL_SELECTOR, head, hcap);
+	}
+	if (TOKEN(p) == TOKEN_LSQUARE) {
+	    if (!(hcap = parse_attrib(p))) return NULL;
+	    return node_new2(p, CSS_CONDITIONAL_SELECTOR, head, hcap);
+	}
+	return head;
+    }
+
+    if (IS_ELEMENT_NAME_START(p)) {
+	if (!(head = parse_element_name(p))) return NULL;
+	if (!IS_HCAP_START(p) && TOKEN(p) != TOKEN_NOT) return head;
+    } else if (IS_HCAP_START(p)) {
+	head = node_new_string(p, CSS_ELEMENT_NAME, CSS_STRING("*"));
+    } else {
+	return NULL;
+    }
+
+    hcap = NULL;
+    if (IS_HCAP_START(p) && !(hcap = parse_hcap_1toN(p))) return NULL;
+    if (TOKEN(p) != TOKEN_NOT)
+	return node_new2(p, CSS_CONDITIONAL_SELECTOR, head, hcap);
+
+    if (!(negation = parse_negation(p))) return NULL;
+    if (hcap) negation = node_new2(p, CSS_COMBINATOR, hcap, negation);
+    return node_new2(p, CSS_CONDITIONAL_SELECTOR, head, negation);
+}
+
+static css_node *
+parse_simple_selector_1toN(css_parser *p)
+{
+    enum css_node_type type;
+    css_node *first, *rest;
+
+    if (!(first = parse_simple_selector(p))) return NULL;
+
+    switch (TOKEN(p)) {
+      case TOKEN_PLUS:
+	type = CSS_DIRECT_ADJACENT_SELECTOR;
+	break;
+      case TOKEN_GREATER:
+      case TOKEN_SLASH:
+	type = CSS_CHILD_SELECTOR;
+	break;
+      case TOKEN_TILDE:
+	type = CSS_PRECEDING_SELECTOR;
+	break;
+      case TOKEN_S:
+      case TOKEN_DOUBLESLASH:
+	type = CSS_DESCENDANT_SELECTOR;
+	break;
+      default:
+	return first;
+    }
+    p->pos++;
+
+    if (!(rest = parse_simple_selector_1toN(p))) return NULL;
+    return node_new2(p, type, first, rest);
+}
+
+static int
+parse_selector(css_parser *p, css_node *list)
+{
+    css_node *selector;
+
+    for (;;) {
+	if (!(selector = parse_simple_selector_1toN(p))) return 0;
+	push_node(p, list, selector);
+	if (TOKEN(p) != TOKEN_COMMA) return 1;
+	p->pos++;
+    }
+}
+
+/*
+ * Node#preprocess!
+ */
+
+/* The number of Node values, i.e. the length of Node#to_type minus one */
+static long
+node_children(css_node *node)
+{
+    long i, count = 0;
+
+    for (i = 0; i < node->len; i++)
+	if (node->values[i].node) count++;
+    return count;
+}
+
+static css_node *
+child_at(css_node *node, long i)
+{
+    return i < node->len ? node->values[i].node : NULL;
+}
+
+/*
+ * [:CONDITIONAL_SELECTOR, [:ELEMENT_NAME], [:PSEUDO_CLASS, [:FUNCTION]]]
+ * when +function+ is set, else
+ * [:CONDITIONAL_SELECTOR, [:ELEMENT_NAME], [:PSEUDO_CLASS]]
+ */
+static int
+matches_pseudo_class(css_node *node, int function)
+{
+    css_node *name, *pseudo, *child;
+
+    if (node->type != CSS_CONDITIONAL_SELECTOR || node_children(node) != 2)
+	return 0;
+    name = child_at(node, 0);
+    pseudo = child_at(node, 1);
+    if (!name || !pseudo) return 0;
+    if (name->type != CSS_ELEMENT_NAME || node_children(name) != 0) return 0;
+    if (pseudo->type != CSS_PSEUDO_CLASS) return 0;
+    if (!function) return node_children(pseudo) == 0;
+
+    if (node_children(pseudo) != 1 || !(child = child_at(pseudo, 0))) return 0;
+    return child->type == CSS_FUNCTION && node_children(child) == 0;
+}
+
+static void
+find_pseudo_classes(css_parser *p, css_node *node, int function,
+		    css_node ***matches, long *len, long *capa)
+{
+    long i;
+
+    if (matches_pseudo_class(node, function)) {
+	if (*len == *capa) {
+	    css_node **grown;
+
+	    *capa = *capa ? *capa * 2 : 8;
+	    grown = css_alloc(p, *capa * sizeof(css_node *));
+	    if (*len) memcpy(grown, *matches, *len * sizeof(css_node *));
+	    *matches = grown;
+	}
+	(*matches)[(*len)++] = node;
+    }
+    for (i = 0; i < node->len; i++)
+	if (node->values[i].node)
+	    find_pseudo_classes(p, node->values[i].node, function,
+				matches, len, capa);
+}
+
+/* COMBINATOR[function, FUNCTION['self(', tag_name]] replacing match.value[1] */
+static void
+rewrite_as_child(css_parser *p, css_node *match, css_node *function)
+{
+    css_node *name = match->values[0].node;
+    css_node *self = node_new_string(p, CSS_FUNCTION, CSS_STRING("self("));
+
+    push_string(p, self, name->values[0].str);
+    name->len = 0;
+    push_string(p, name, CSS_STRING("*"));
+    match->values[1].node = node_new2(p, CSS_COMBINATOR, function, self);
+}
+
+static void
+preprocess(css_parser *p, css_node *ast)
+{
+    css_node **matches = NULL;
+    long i, len = 0, capa = 0;
+
+    /* nth-child, nth-last-child */
+    find_pseudo_classes(p, ast, 1, &matches, &len, &capa);
+    for (i = 0; i < len; i++) {
+	css_node *function = matches[i]->values[1].node->values[0].node;
+	css_string name = function->values[0].str;
+
+	if (css_string_prefix_p(name, "nth-child") ||
+	    css_string_prefix_p(name, "nth-last-child"))
+	    rewrite_as_child(p, matches[i], function);
+    }
+
+    /* first-child, last-child, only-child */
+    len = 0;
+    find_pseudo_classes(p, ast, 0, &matches, &len, &capa);
+    for (i = 0; i < len; i++) {
+	css_node *pseudo = matches[i]->values[1].node;
+	css_string name;
+
+	if (pseudo->len == 0) continue;
+	name = pseudo->values[0].str;
+
+	if (css_string_eq(name, "first-child"))
+	    name = CSS_STRING("first(");
+	else if (css_string_eq(name, "last-child"))
+	    name = CSS_STRING("last(");
+	else if (css_string_eq(name, "only-child"))
+	    name = CSS_STRING("only-child(");
+	else
+	    continue;
+	rewrite_as_child(p, matches[i], node_new_string(p, CSS_FUNCTION, name));
+    }
+}
+
+/*
+ * XPathVisitor.  Each visit appends to +buf+ and returns 0 where the Ruby
+ * visitor would interpolate a Node or call a missing method.
+ */
+
+#define CAT(buf, literal) rb_str_buf_cat((buf), (literal), sizeof(literal) - 1)
+#define CAT_STRING(buf, str) rb_str_buf_cat((buf), (str).ptr, (str).len)
+
+static int visit(css_node *node, VALUE buf);
+
+/* "#{node.value[i]}" */
+static int
+cat_value(css_node *node, long i, VALUE buf)
+{
+    if (i >= node->len) return 1;
+    if (node->values[i].node) return 0;
+    CAT_STRING(buf, node->values[i].str);
+    return 1;
+}
+
+/* String#to_i for the values the grammar can produce */
+static int
+value_to_i(css_node *node, long i, long *result)
+{
+    css_string str;
+    long j = 0, n = 0;
+    int negative = 0;
+
+    *result = 0;
+    if (i >= node->len) return 1;
+    if (node->values[i].node) return 0;
+    str = node->values[i].str;
+
+    if (j < str.len && (str.ptr[j] == '-' || str.ptr[j] == '+'))
+	negative = str.ptr[j++] == '-';
+    for (; j < str.len && CSS_IS_DIGIT(str.ptr[j]); j++) {
+	if (n > 99999999999999L) return 0;
+	n = n * 10 + (str.ptr[j] - '0');
+    }
+    *result = negative ? -n : n;
+    return 1;
+}
+
+static void
+cat_long(VALUE buf, long n)
+{
+    char digits[32];
+
+    snprintf(digits, sizeof(digits), "%ld", n);
+    rb_str_buf_cat2(buf, digits);
+}
+
+static int
+visit_an_plus_b(css_node *node, int last, VALUE buf)
+{
+    long a, b;
+
+    if (node->len != 4) return 0;
+    if (!value_to_i(node, 0, &a) || !value_to_i(node, 3, &b)) return 0;
+
+#define POSITION() do { \
+	if (last) CAT(buf, "(last()-position()+1)"); \
+	else CAT(buf, "position()"); \
+    } while (0)
+
+    if (b == 0) {
+	CAT(buf, "(");
+	POSITION();
+	CAT(buf, " mod ");
+	cat_long(buf, a);
+	CAT(buf, ") = 0");
+	return 1;
+    }
+
+    CAT(buf, "(");
+    POSITION();
+    if (a < 0) CAT(buf, " <= ");
+    else CAT(buf, " >= ");
+    cat_long(buf, b);
+    CAT(buf, ") and (((");
+    POSITION();
+    CAT(buf, "-");
+    cat_long(buf, b);
+    CAT(buf, ") mod ");
+    cat_long(buf, a < 0 ? -a : a);
+    CAT(buf, ") = 0)");
+    return 1;
+
+#undef POSITION
+}
+
+static int
+is_an_plus_b(css_node *node, long i)
+{
+    return i < node->len && node->values[i].node &&
+	node->values[i].node->type == CSS_AN_PLUS_B;
+}
+
+static int
+visit_function(css_node *node, VALUE buf)
+{
+    css_string name = node->values[0].str;
+    long i, index;
+
+    if (css_string_prefix_p(name, "text(")) {
+	CAT(buf, "child::text()");
+    } else if (css_string_prefix_p(name, "self(")) {
+	CAT(buf, "self::");
+	return cat_value(node, 1, buf);
+    } else if (css_string_prefix_p(name, "eq(")) {
+	CAT(buf, "position() = ");
+	return cat_value(node, 1, buf);
+    } else if (css_string_prefix_p(name, "nth(") ||
+	       css_string_prefix_p(name, "nth-of-type(") ||
+	       css_string_prefix_p(name, "nth-child(")) {
+	if (is_an_plus_b(node, 1))
+	    return visit_an_plus_b(node->values[1].node, 0, buf);
+	CAT(buf, "position() = ");
+	return cat_value(node, 1, buf);
+    } else if (css_string_prefix_p(name, "nth-last-child(") ||
+	       css_string_prefix_p(name, "nth-last-of-type(")) {
+	if (is_an_plus_b(node, 1))
+	    return visit_an_plus_b(node->values[1].node, 1, buf);
+	if (!value_to_i(node, 1, &index)) return 0;
+	index -= 1;
+	if (index == 0) {
+	    CAT(buf, "position() = last()");
+	} else {
+	    CAT(buf, "position() = last() - ");
+	    cat_long(buf, index);
+	}
+    } else if (css_string_prefix_p(name, "first(") ||
+	       css_string_prefix_p(name, "first-of-type(")) {
+	CAT(buf, "position() = 1");
+    } else if (css_string_prefix_p(name, "last(") ||
+	       css_string_prefix_p(name, "last-of-type(")) {
+	CAT(buf, "position() = last()");
+    } else if (css_string_prefix_p(name, "contains(")) {
+	CAT(buf, "contains(., ");
+	if (!cat_value(node, 1, buf)) return 0;
+	CAT(buf, ")");
+    } else if (css_string_prefix_p(name, "gt(")) {
+	CAT(buf, "position() > ");
+	return cat_value(node, 1, buf);
+    } else if (css_string_prefix_p(name, "only-child(")) {
+	CAT(buf, "last() = 1");
+    } else if (css_string_prefix_p(name, "comment(")) {
+	CAT(buf, "comment()");
+    } else if (css_string_prefix_p(name, "has(")) {
+	if (node->len < 2 || !node->values[1].node) return 0;
+	return visit(node->values[1].node, buf);
+    } else {
+	CAT_STRING(buf, name);
+	CAT(buf, ".");
+	for (i = 1; i < node->len; i++) {
+	    CAT(buf, ", ");
+	    if (!cat_value(node, i, buf)) return 0;
+	}
+	CAT(buf, ")");
+    }
+    return 1;
+}
+
+static int
+visit_attribute_condition(css_node *node, VALUE buf)
+{
+    css_node *name = node->values[0].node;
+    css_string value;
+    VALUE attribute, quoted;
+    const char *ptr;
+    long len;
+
+    attribute = rb_str_buf_new(32);
+    if (name->type != CSS_FUNCTION) {
+	css_string str = name->values[0].str;
+	int axis = 0;
+	long i;
+
+	for (i = 0; i + 1 < str.len; i++)
+	    if (str.ptr[i] == ':' && str.ptr[i + 1] == ':') axis = 1;
+	if (!axis) CAT(attribute, "@");
+    }
+    if (!visit(name, attribute)) return 0;
+
+    /* Support non-standard css */
+    ptr = RSTRING_PTR(attribute);
+    len = RSTRING_LEN(attribute);
+    if (memchr(ptr, '\n', len)) return 0;
+    if (len >= 2 && ptr[0] == '@' && ptr[1] == '@') {
+	ptr++;
+	len--;
+    }
+
+    if (node->len != 3) {
+	rb_str_buf_cat(buf, ptr, len);
+	return 1;
+    }
+
+    value = node->values[2].str;
+    quoted = rb_str_buf_new(value.len + 2);
+    if (value.ptr[0] != '\'' && value.ptr[0] != '"') {
+	CAT(quoted, "'");
+	CAT_STRING(quoted, value);
+	CAT(quoted, "'");
+    } else {
+	CAT_STRING(quoted, value);
+    }
+
+#define A() rb_str_buf_cat(buf, ptr, len)
+#define V() rb_str_buf_append(buf, quoted)
+
+    switch (node->values[1].match) {
+      case CSS_EQUAL:
+	A(); CAT(buf, " = "); V();
+	break;
+      case CSS_NOT_EQUAL:
+	A(); CAT(buf, " != "); V();
+	break;
+      case CSS_SUBSTRING_MATCH:
+	CAT(buf, "contains("); A(); CAT(buf, ", "); V(); CAT(buf, ")");
+	break;
+      case CSS_PREFIX_MATCH:
+	CAT(buf, "starts-with("); A(); CAT(buf, ", "); V(); CAT(buf, ")");
+	break;
+      case CSS_DASH_MATCH:
+	A(); CAT(buf, " = "); V();
+	CAT(buf, " or starts-with("); A(); CAT(buf, ", concat("); V();
+	CAT(buf, ", '-'))");
+	break;
+      case CSS_INCLUDES:
+	CAT(buf, "contains(concat(\" \", "); A();
+	CAT(buf, ", \" \"),concat(\" \", "); V(); CAT(buf, ", \" \"))");
+	break;
+      case CSS_SUFFIX_MATCH:
+	CAT(buf, "substring("); A(); CAT(buf, ", string-length("); A();
+	CAT(buf, ") - string-length("); V(); CAT(buf, ") + 1, string-length(");
+	V(); CAT(buf, ")) = "); V();
+	break;
+      default:
+	return 0;
+    }
+    RB_GC_GUARD(attribute);
+    RB_GC_GUARD(quoted);
+    return 1;
+
+#undef A
+#undef V
+}
+
+static int
+visit_pseudo_class(css_node *node, VALUE buf)
+{
+    css_string name;
+
+    if (node->len == 0) return 0;
+    if (node->values[0].node) {
+	if (node->values[0].node->type != CSS_FUNCTION) return 0;
+	return visit_function(node->values[0].node, buf);
+    }
+
+    name = node->values[0].str;
+    if (css_string_eq(name, "first") || css_string_eq(name, "first-child"))
+	CAT(buf, "position() = 1");
+    else if (css_string_eq(name, "last") || css_string_eq(name, "last-child"))
+	CAT(buf, "position() = last()");
+    else if (css_string_eq(name, "first-of-type"))
+	CAT(buf, "position() = 1");
+    else if (css_string_eq(name, "last-of-type"))
+	CAT(buf, "position() = last()");
+    else if (css_string_eq(name, "only-of-type"))
+	CAT(buf, "last() = 1");
+    else if (css_string_eq(name, "empty"))
+	CAT(buf, "not(node())");
+    else if (css_string_eq(name, "parent"))
+	CAT(buf, "node()");
+    else if (css_string_eq(name, "root"))
+	CAT(buf, "not(parent::*)");
+    else {
+	CAT_STRING(buf, name);
+	CAT(buf, "(.)");
+    }
+    return 1;
+}
+
+static int
+visit_binary(css_node *node, const char *infix, VALUE buf)
+{
+    if (!visit(node->values[0].node, buf)) return 0;
+    rb_str_buf_cat2(buf, infix);
+    return visit(node->values[node->len - 1].node, buf);
+}
+
+static int
+visit(css_node *node, VALUE buf)
+{
+    css_string str;
+
+    if (!node) return 0;
+
+    switch (node->type) {
+      case CSS_CONDITIONAL_SELECTOR:
+	if (!visit(node->values[0].node, buf)) return 0;
+	CAT(buf, "[");
+	if (!visit(node->values[node->len - 1].node, buf)) return 0;
+	CAT(buf, "]");
+	return 1;
+      case CSS_ELEMENT_NAME:
+	CAT_STRING(buf, node->values[0].str);
+	return 1;
+      case CSS_COMBINATOR:
+	return visit_binary(node, " and ", buf);
+      case CSS_DIRECT_ADJACENT_SELECTOR:
+	return visit_binary(node, "/following-sibling::*[1]/self::", buf);
+      case CSS_PRECEDING_SELECTOR:
+	return visit_binary(node, "/following-sibling::", buf);
+      case CSS_DESCENDANT_SELECTOR:
+	return visit_binary(node, "//", buf);
+      case CSS_CHILD_SELECTOR:
+	return visit_binary(node, "/", buf);
+      case CSS_FUNCTION:
+	return visit_function(node, buf);
+      case CSS_PSEUDO_CLASS:
+	return visit_pseudo_class(node, buf);
+      case CSS_ATTRIBUTE_CONDITION:
+	return visit_attribute_condition(node, buf);
+      case CSS_CLASS_CONDITION:
+	CAT(buf, "contains(concat(' ', @class, ' '), ' ");
+	CAT_STRING(buf, node->values[0].str);
+	CAT(buf, " ')");
+	return 1;
+      case CSS_ID:
+	str = node->values[0].str;
+	CAT(buf, "@id = '");
+	rb_str_buf_cat(buf, str.ptr + 1, str.len - 1);
+	CAT(buf, "'");
+	return 1;
+      case CSS_NOT:
+	if (!node->values[0].node) return 0;
+	if (node->values[0].node->type == CSS_ELEMENT_NAME)
+	    CAT(buf, "not(self::");
+	else
+	    CAT(buf, "not(");
+	if (!visit(node->values[0].node, buf)) return 0;
+	CAT(buf, ")");
+	return 1;
+      default:
+	return 0;
+    }
+}
+
+typedef struct {
+    css_parser parser;
+    VALUE selector;
+    VALUE prefix;
+} css_compile_args;
+
+static VALUE
+compile(VALUE data)
+{
+    css_compile_args *args = (css_compile_args *)data;
+    css_parser *p = &args->parser;
+    css_node *list;
+    VALUE result;
+    long i;
+
+    if (!tokenize(p, RSTRING_PTR(args->selector), RSTRING_LEN(args->selector)))
+	return Qnil;
+
+    list = node_new(p, CSS_FUNCTION);
+    if (!parse_selector(p, list) || TOKEN(p) != TOKEN_EOS) return Qnil;
+
+    result = rb_ary_new2(list->len);
+    for (i = 0; i < list->len; i++) {
+	VALUE xpath = NOKOGIRI_STR_NEW("", 0);
+
+	preprocess(p, list->values[i].node);
+	if (!visit(list->values[i].node, xpath)) return Qnil;
+	rb_ary_push(result, rb_str_plus(args->prefix, xpath));
+    }
+    return result;
+}
+
+static VALUE
+cleanup(VALUE data)
+{
+    css_free(&((css_compile_args *)data)->parser);
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *  native_xpath_for(selector, prefix, xmlns)
+ *
+ * Compile the CSS +selector+ to an Array of XPath strings starting with
+ * +prefix+, exactly as CSS::Parser#xpath_for does with the default
+ * XPathVisitor.  +xmlns+ is true when the namespaces in use bind a
+ * default "xmlns" prefix.  Returns nil if the selector has to go through
+ * the Ruby parser, which also reports syntax errors.
+ */
+static VALUE
+native_xpath_for(VALUE self, VALUE selector, VALUE prefix, VALUE xmlns)
+{
+    css_compile_args args;
+
+    StringValue(selector);
+    StringValue(prefix);
+
+#ifdef HAVE_RUBY_ENCODING_H
+    if (!rb_enc_str_asciionly_p(selector) &&
+	(rb_enc_get(selector) != rb_utf8_encoding() ||
+	 rb_enc_str_coderange(selector) == ENC_CODERANGE_BROKEN))
+	return Qnil;
+#endif
+
+    memset(&args, 0, sizeof(args));
+    args.selector = rb_str_new_frozen(selector);
+    args.prefix = prefix;
+    args.parser.xmlns = RTEST(xmlns);
+
+    return rb_ensure(compile, (VALUE)&args, cleanup, (VALUE)&args);
+}
+
+void
+init_css_parser(void)
+{
+    VALUE nokogiri = rb_define_module("Nokogiri");
+    VALUE css = rb_define_module_under(nokogiri, "CSS");
+
+    rb_define_singleton_method(css, "native_xpath_for", native_xpath_for, 3);
+}
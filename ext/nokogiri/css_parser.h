@@ -0,0 +1,8 @@
+#ifndef NOKOGIRI_CSS_PARSER
+#define NOKOGIRI_CSS_PARSER
+
+#include <nokogiri.h>
+
+void init_css_parser();
+
+#endif
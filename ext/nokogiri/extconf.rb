@@ -121,6 +121,18 @@ have_func('xmlRelaxNGSetParserStructuredErrors')
 have_func('xmlRelaxNGSetValidStructuredErrors')
 have_func('xmlSchemaSetValidStructuredErrors')
 have_func('xmlSchemaSetParserStructuredErrors')
+have_func('xmlSaveSetIndentString')
+
+have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_func('rb_thread_call_without_gvl2', 'ruby/thread.h')
+have_func('rb_thread_blocking_region')
+
+have_func('rb_io_descriptor', 'ruby/io.h')
+have_func('rb_io_mode', 'ruby/io.h')
+have_func('rb_method_basic_definition_p')
+
+have_func('mmap', 'sys/mman.h')
+have_func('madvise', 'sys/mman.h')
 
 if ENV['CPUPROFILE']
   unless find_library('profiler', 'ProfilerEnable', *LIB_DIRS)
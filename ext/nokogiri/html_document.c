@@ -1,7 +1,5 @@
 #include <html_document.h>
 
-static ID id_encoding_found;
-
 /*
  * call-seq:
  *  new
@@ -42,33 +40,30 @@ static VALUE read_io( VALUE klass,
   const char * c_url    = NIL_P(url)      ? NULL : StringValuePtr(url);
   const char * c_enc    = NIL_P(encoding) ? NULL : StringValuePtr(encoding);
   VALUE error_list      = rb_ary_new();
-  VALUE document;
+  VALUE document, rb_reader;
+  nokogiriIOReader *reader;
   htmlDocPtr doc;
 
+  rb_reader = Nokogiri_io_reader(io, &reader);
+
   xmlResetLastError();
   xmlSetStructuredErrorFunc((void *)error_list, Nokogiri_error_array_pusher);
 
   doc = htmlReadIO(
-      io_read_callback,
+      io_reader_read_callback,
       io_close_callback,
-      (void *)io,
+      (void *)reader,
       c_url,
       c_enc,
       (int)NUM2INT(options)
   );
   xmlSetStructuredErrorFunc(NULL, NULL);
 
-  /*
-   * If EncodingFound has occurred in EncodingReader, make sure to do
-   * a cleanup and propagate the error.
-   */
-  if (rb_respond_to(io, id_encoding_found)) {
-    VALUE encoding_found = rb_funcall(io, id_encoding_found, 0);
-    if (!NIL_P(encoding_found)) {
-      xmlFreeDoc(doc);
-      rb_exc_raise(encoding_found);
-    }
+  if(reader->state) {
+    xmlFreeDoc(doc);
+    Nokogiri_io_reader_check(reader);
   }
+  RB_GC_GUARD(rb_reader);
 
   if(doc == NULL) {
     xmlErrorPtr error;
@@ -89,50 +84,112 @@ static VALUE read_io( VALUE klass,
   return document;
 }
 
+static xmlDocPtr
+read_memory_reader(nokogiriReadArgs *args)
+{
+    return htmlReadMemory(args->buffer, args->length, args->url,
+			  args->encoding, args->options);
+}
+
 /*
  * call-seq:
  *  read_memory(string, url, encoding, options)
  *
  * Read the HTML document contained in +string+ with given +url+, +encoding+,
- * and +options+.  See Nokogiri::HTML.parse
+ * and +options+.  See Nokogiri::HTML.parse.  The GVL is released while the
+ * document is parsed.
  */
-static VALUE read_memory( VALUE klass,
-                          VALUE string,
-                          VALUE url,
-                          VALUE encoding,
-                          VALUE options )
+static VALUE
+read_memory(VALUE klass, VALUE string, VALUE url, VALUE encoding, VALUE options)
 {
-  const char * c_buffer = StringValuePtr(string);
-  const char * c_url    = NIL_P(url)      ? NULL : StringValuePtr(url);
-  const char * c_enc    = NIL_P(encoding) ? NULL : StringValuePtr(encoding);
-  int len               = (int)RSTRING_LEN(string);
-  VALUE error_list      = rb_ary_new();
-  VALUE document;
-  htmlDocPtr doc;
-
-  xmlResetLastError();
-  xmlSetStructuredErrorFunc((void *)error_list, Nokogiri_error_array_pusher);
-
-  doc = htmlReadMemory(c_buffer, len, c_url, c_enc, (int)NUM2INT(options));
-  xmlSetStructuredErrorFunc(NULL, NULL);
-
-  if(doc == NULL) {
-    xmlErrorPtr error;
-
-    xmlFreeDoc(doc);
+    nokogiriReadArgs args;
+    VALUE document;
+
+    /* Frozen copies share the buffers and keep them stable during the parse */
+    string = rb_str_new_frozen(StringValue(string));
+    if (!NIL_P(url))      url      = rb_str_new_frozen(StringValue(url));
+    if (!NIL_P(encoding)) encoding = rb_str_new_frozen(StringValue(encoding));
+
+    args.reader   = read_memory_reader;
+    args.buffer   = RSTRING_PTR(string);
+    args.length   = (int)RSTRING_LEN(string);
+    args.url      = NIL_P(url)      ? NULL : RSTRING_PTR(url);
+    args.encoding = NIL_P(encoding) ? NULL : RSTRING_PTR(encoding);
+    args.options  = (int)NUM2INT(options);
+
+    document = Nokogiri_read_document(klass, &args);
+
+    RB_GC_GUARD(string);
+    RB_GC_GUARD(url);
+    RB_GC_GUARD(encoding);
+    return document;
+}
 
-    error = xmlGetLastError();
-    if(error)
-      rb_exc_raise(Nokogiri_wrap_xml_syntax_error((VALUE)NULL, error));
-    else
-      rb_raise(rb_eRuntimeError, "Could not parse document");
+/*
+ * call-seq:
+ *  read_memory_many(strings, encodings, options, threads)
+ *
+ * Create an HTML document from each String in +strings+, parsing them on
+ * +threads+ threads with the GVL released.  +encodings+ is nil or an
+ * Array with the encoding of each String.  See Nokogiri::HTML.parse_many.
+ */
+static VALUE
+read_memory_many(VALUE klass, VALUE strings, VALUE encodings, VALUE options,
+                 VALUE threads)
+{
+    return Nokogiri_read_documents(klass, read_memory_reader, strings,
+                                   encodings, options, threads);
+}
 
-    return Qnil;
-  }
+static xmlDocPtr
+read_file_reader(nokogiriReadArgs *args)
+{
+    return htmlReadIO(mapped_file_read_callback, io_close_callback, args->io,
+                      args->url, args->encoding, args->options);
+}
 
-  document = Nokogiri_wrap_xml_document(klass, doc);
-  rb_iv_set(document, "@errors", error_list);
-  return document;
+/*
+ * call-seq:
+ *  read_file(path, url, encoding, options)
+ *
+ * Read the HTML document in the file at +path+ with given +url+,
+ * +encoding+, and +options+.  The file is mapped into memory and parsed
+ * from the mapping with the GVL released.  If +encoding+ is nil, it is
+ * detected from the first 4096 bytes of the file.
+ */
+static VALUE
+read_file(VALUE klass, VALUE path, VALUE url, VALUE encoding, VALUE options)
+{
+    nokogiriReadArgs args;
+    nokogiriMappedFile *file;
+    VALUE rb_file, document;
+
+    /* Frozen copies stay put while the GVL is released */
+    if (!NIL_P(url))      url      = rb_str_new_frozen(StringValue(url));
+    if (!NIL_P(encoding)) encoding = rb_str_new_frozen(StringValue(encoding));
+
+    rb_file = Nokogiri_map_file(path, &file);
+    if (file->length == 0) return rb_funcall(klass, rb_intern("new"), 0);
+
+    if (NIL_P(encoding))
+        encoding = Nokogiri_html_prescan(file->addr,
+            (long)(file->length < 4096 ? file->length : 4096));
+
+    args.reader   = read_file_reader;
+    args.buffer   = NULL;
+    args.length   = 0;
+    args.io       = file;
+    args.url      = NIL_P(url)      ? NULL : RSTRING_PTR(url);
+    args.encoding = NIL_P(encoding) ? NULL : RSTRING_PTR(encoding);
+    args.options  = (int)NUM2INT(options);
+
+    document = Nokogiri_read_document(klass, &args);
+    Nokogiri_unmap_file(file);
+
+    RB_GC_GUARD(rb_file);
+    RB_GC_GUARD(url);
+    RB_GC_GUARD(encoding);
+    return document;
 }
 
 /*
@@ -161,10 +218,10 @@ void init_html_document()
   cNokogiriHtmlDocument = klass;
 
   rb_define_singleton_method(klass, "read_memory", read_memory, 4);
+  rb_define_singleton_method(klass, "read_memory_many", read_memory_many, 4);
+  rb_define_singleton_method(klass, "read_file", read_file, 4);
   rb_define_singleton_method(klass, "read_io", read_io, 4);
   rb_define_singleton_method(klass, "new", new, -1);
 
   rb_define_method(klass, "type", type, 0);
-
-  id_encoding_found = rb_intern("encoding_found");
 }
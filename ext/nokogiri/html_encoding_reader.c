@@ -0,0 +1,350 @@
+#include <html_encoding_reader.h>
+
+/*
+ * The WHATWG "prescan a byte stream to determine its encoding" algorithm
+ * (HTML Standard, 13.2.3.2), preceded by a check for a byte order mark
+ * and an XML declaration.  Labels are returned as written in the document
+ * so that Document#encoding reads the way the author spelled it; only
+ * labels that libxml2 can decode are accepted.
+ */
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} prescan_input;
+
+typedef struct {
+    const unsigned char *ptr;
+    long len;
+} prescan_string;
+
+#define IS_SPACE(c) \
+    ((c) == 0x09 || (c) == 0x0A || (c) == 0x0C || (c) == 0x0D || (c) == 0x20)
+#define IS_ALPHA(c) \
+    (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
+#define LOWER(c) \
+    (((c) >= 'A' && (c) <= 'Z') ? (c) + 0x20 : (c))
+
+/* Does +input+ continue with +lit+, compared ASCII case-insensitively? */
+static int
+looking_at(prescan_input *input, const char *lit)
+{
+    long len = (long)strlen(lit), i;
+
+    if (input->end - input->p < len) return 0;
+    for (i = 0; i < len; i++) {
+        if (LOWER(input->p[i]) != (unsigned char)lit[i]) return 0;
+    }
+    return 1;
+}
+
+static int
+string_is(prescan_string *str, const char *lit)
+{
+    long i;
+
+    if (str->len != (long)strlen(lit)) return 0;
+    for (i = 0; i < str->len; i++) {
+        if (LOWER(str->ptr[i]) != (unsigned char)lit[i]) return 0;
+    }
+    return 1;
+}
+
+/* Move past the next '>' at or after +from+ */
+static void
+skip_to_gt(prescan_input *input, const unsigned char *from)
+{
+    const unsigned char *gt = NULL;
+
+    if (from < input->end)
+        gt = memchr(from, '>', (size_t)(input->end - from));
+    input->p = gt ? gt + 1 : input->end;
+}
+
+/*
+ * The "get an attribute" algorithm.  Attribute names are lowercased into
+ * +name+, which has room for +max+ bytes; longer names are truncated, as
+ * no name we are looking for is that long.  The value is not copied.
+ * Returns 0 when there are no more attributes.
+ */
+static int
+get_attribute(prescan_input *input, char *name, long max,
+              prescan_string *value)
+{
+    long name_len = 0;
+    unsigned char c, quote;
+
+    while (input->p < input->end && (IS_SPACE(*input->p) || *input->p == '/'))
+        input->p++;
+    if (input->p >= input->end || *input->p == '>') return 0;
+
+    value->ptr = input->p;
+    value->len = 0;
+
+    /* attribute name */
+    for (;;) {
+        if (input->p >= input->end) return 0;
+        c = *input->p;
+        if (c == '=' && name_len > 0) {
+            input->p++;
+            goto value;
+        }
+        if (IS_SPACE(c)) break;
+        if (c == '/' || c == '>') goto done;
+        if (name_len < max - 1) name[name_len++] = (char)LOWER(c);
+        input->p++;
+    }
+
+    /* spaces before an optional '=' */
+    while (input->p < input->end && IS_SPACE(*input->p)) input->p++;
+    if (input->p >= input->end) return 0;
+    if (*input->p != '=') goto done;
+    input->p++;
+
+value:
+    while (input->p < input->end && IS_SPACE(*input->p)) input->p++;
+    if (input->p >= input->end) return 0;
+
+    c = *input->p;
+    if (c == '"' || c == '\'') {
+        quote = c;
+        value->ptr = ++input->p;
+        while (input->p < input->end && *input->p != quote) input->p++;
+        if (input->p >= input->end) return 0;
+        value->len = input->p - value->ptr;
+        input->p++;
+        goto done;
+    }
+    if (c == '>') goto done;
+
+    value->ptr = input->p;
+    while (input->p < input->end && !IS_SPACE(*input->p) && *input->p != '>')
+        input->p++;
+    if (input->p >= input->end) return 0;
+    value->len = input->p - value->ptr;
+
+done:
+    name[name_len] = '\0';
+    return 1;
+}
+
+/* The "extract a character encoding from a meta element" algorithm */
+static int
+charset_from_content(prescan_string *content, prescan_string *charset)
+{
+    prescan_input input;
+    const unsigned char *start;
+    unsigned char quote;
+
+    input.p = content->ptr;
+    input.end = content->ptr + content->len;
+
+    for (;;) {
+        while (input.p < input.end && !looking_at(&input, "charset")) input.p++;
+        if (input.p >= input.end) return 0;
+        input.p += 7;
+
+        while (input.p < input.end && IS_SPACE(*input.p)) input.p++;
+        if (input.p < input.end && *input.p == '=') break;
+    }
+    input.p++;
+    while (input.p < input.end && IS_SPACE(*input.p)) input.p++;
+    if (input.p >= input.end) return 0;
+
+    if (*input.p == '"' || *input.p == '\'') {
+        quote = *input.p++;
+        start = input.p;
+        while (input.p < input.end && *input.p != quote) input.p++;
+        if (input.p >= input.end) return 0;
+    } else {
+        start = input.p;
+        while (input.p < input.end && !IS_SPACE(*input.p) && *input.p != ';')
+            input.p++;
+    }
+
+    charset->ptr = start;
+    charset->len = input.p - start;
+    return charset->len > 0;
+}
+
+/*
+ * Strip +label+ and return it as a String if libxml2 can decode it.  A
+ * label with a NUL in it names no encoding.
+ */
+static VALUE
+encoding_label(prescan_string *label)
+{
+    const unsigned char *p = label->ptr, *end = label->ptr + label->len;
+    xmlCharEncodingHandlerPtr handler;
+    VALUE name;
+
+    while (p < end && IS_SPACE(*p)) p++;
+    while (end > p && IS_SPACE(end[-1])) end--;
+    if (p == end) return Qnil;
+    if (memchr(p, 0, (size_t)(end - p))) return Qnil;
+
+    name = rb_str_new((const char *)p, (long)(end - p));
+    handler = xmlFindCharEncodingHandler(RSTRING_PTR(name));
+    if (!handler) return Qnil;
+    xmlCharEncCloseFunc(handler);
+
+    return NOKOGIRI_STR_NEW(p, end - p);
+}
+
+/* Handle a <meta> tag; +input+ is positioned after "<meta" */
+static VALUE
+prescan_meta(prescan_input *input)
+{
+    char name[16];
+    int seen_http_equiv = 0, seen_content = 0, seen_charset = 0;
+    int got_pragma = 0, need_pragma = -1;
+    prescan_string value, charset;
+
+    charset.ptr = NULL;
+    charset.len = 0;
+
+    while (get_attribute(input, name, (long)sizeof(name), &value)) {
+        if (!strcmp(name, "http-equiv")) {
+            if (seen_http_equiv++) continue;
+            if (string_is(&value, "content-type")) got_pragma = 1;
+        } else if (!strcmp(name, "content")) {
+            if (seen_content++) continue;
+            if (!charset.ptr && charset_from_content(&value, &charset))
+                need_pragma = 1;
+        } else if (!strcmp(name, "charset")) {
+            if (seen_charset++) continue;
+            charset = value;
+            need_pragma = 0;
+        }
+    }
+
+    if (need_pragma < 0 || (need_pragma && !got_pragma)) return Qnil;
+    if (string_is(&charset, "utf-16") || string_is(&charset, "utf-16be") ||
+        string_is(&charset, "utf-16le"))
+        return NOKOGIRI_STR_NEW2("UTF-8");
+    if (string_is(&charset, "x-user-defined"))
+        return NOKOGIRI_STR_NEW2("windows-1252");
+
+    return encoding_label(&charset);
+}
+
+/* The encoding named in an XML declaration at the start of +input+ */
+static VALUE
+prescan_xml_declaration(prescan_input *input)
+{
+    prescan_input decl;
+    const unsigned char *gt;
+    char name[16];
+    prescan_string value;
+
+    if (!looking_at(input, "<?xml") || input->end - input->p < 6 ||
+        !IS_SPACE(input->p[5]))
+        return Qnil;
+
+    gt = memchr(input->p, '>', (size_t)(input->end - input->p));
+    if (!gt) return Qnil;
+
+    decl.p = input->p + 5;
+    decl.end = gt;
+    if (gt[-1] == '?') decl.end--;
+
+    while (get_attribute(&decl, name, (long)sizeof(name), &value)) {
+        if (!strcmp(name, "encoding")) return encoding_label(&value);
+    }
+    return Qnil;
+}
+
+/*
+ * The encoding declared by the +len+ bytes of HTML at +chunk+, or nil.
+ */
+VALUE
+Nokogiri_html_prescan(const char *chunk, long len)
+{
+    prescan_input input;
+    VALUE encoding;
+
+    input.p = (const unsigned char *)chunk;
+    input.end = input.p + len;
+
+    if (looking_at(&input, "\xef\xbb\xbf")) return NOKOGIRI_STR_NEW2("UTF-8");
+    if (looking_at(&input, "\xfe\xff")) return NOKOGIRI_STR_NEW2("UTF-16BE");
+    if (looking_at(&input, "\xff\xfe")) return NOKOGIRI_STR_NEW2("UTF-16LE");
+
+    encoding = prescan_xml_declaration(&input);
+    if (!NIL_P(encoding)) return encoding;
+
+    while (input.p < input.end) {
+        if (*input.p != '<') {
+            const unsigned char *lt =
+                memchr(input.p, '<', (size_t)(input.end - input.p));
+            if (!lt) break;
+            input.p = lt;
+        }
+
+        if (looking_at(&input, "<!--")) {
+            const unsigned char *p = input.p + 2;
+            input.p = input.end;
+            for (; p + 2 < input.end; p++) {
+                if (p[0] == '-' && p[1] == '-' && p[2] == '>') {
+                    input.p = p + 3;
+                    break;
+                }
+            }
+        }
+        else if (looking_at(&input, "<meta") && input.end - input.p > 5 &&
+                 (IS_SPACE(input.p[5]) || input.p[5] == '/')) {
+            input.p += 6;
+            encoding = prescan_meta(&input);
+            if (!NIL_P(encoding)) return encoding;
+        }
+        else if (input.end - input.p > 1 && (IS_ALPHA(input.p[1]) ||
+                 (input.p[1] == '/' && input.end - input.p > 2 &&
+                  IS_ALPHA(input.p[2])))) {
+            char name[16];
+            prescan_string value;
+
+            input.p++;
+            while (input.p < input.end && !IS_SPACE(*input.p) && *input.p != '>')
+                input.p++;
+            while (get_attribute(&input, name, (long)sizeof(name), &value))
+                ;
+        }
+        else if (input.end - input.p > 1 &&
+                 (input.p[1] == '!' || input.p[1] == '/' || input.p[1] == '?')) {
+            skip_to_gt(&input, input.p + 2);
+            continue;
+        }
+        else {
+            input.p++;
+            continue;
+        }
+
+        if (input.p < input.end && *input.p == '>') input.p++;
+    }
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *  prescan(chunk)
+ *
+ * Determine the encoding of the HTML in +chunk+, the start of a document,
+ * from its byte order mark, its XML declaration or a <meta> charset
+ * declaration.  Returns nil if none of them name an encoding.
+ */
+static VALUE
+prescan(VALUE klass, VALUE chunk)
+{
+    StringValue(chunk);
+    return Nokogiri_html_prescan(RSTRING_PTR(chunk), RSTRING_LEN(chunk));
+}
+
+void
+init_html_encoding_reader(void)
+{
+    VALUE klass = rb_define_class_under(cNokogiriHtmlDocument,
+                                        "EncodingReader", rb_cObject);
+
+    rb_define_singleton_method(klass, "prescan", prescan, 1);
+}
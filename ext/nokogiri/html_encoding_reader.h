@@ -0,0 +1,9 @@
+#ifndef NOKOGIRI_HTML_ENCODING_READER
+#define NOKOGIRI_HTML_ENCODING_READER
+
+#include <nokogiri.h>
+
+void init_html_encoding_reader();
+VALUE Nokogiri_html_prescan(const char *chunk, long len);
+
+#endif
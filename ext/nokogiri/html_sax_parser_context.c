@@ -58,6 +58,7 @@ parse_doc(VALUE ctxt_val)
 {
     htmlParserCtxtPtr ctxt = (htmlParserCtxtPtr)ctxt_val;
     htmlParseDocument(ctxt);
+    Nokogiri_sax_tuple_flush((nokogiriSAXTuplePtr)ctxt->userData);
     return Qnil;
 }
 
@@ -69,7 +70,7 @@ parse_doc_finalize(VALUE ctxt_val)
     if (ctxt->myDoc)
 	xmlFreeDoc(ctxt->myDoc);
 
-    NOKOGIRI_SAX_TUPLE_DESTROY(ctxt->userData);
+    ctxt->userData = NULL;
     return Qnil;
 }
 
@@ -78,6 +79,8 @@ parse_with(VALUE self, VALUE sax_handler)
 {
     htmlParserCtxtPtr ctxt;
     htmlSAXHandlerPtr sax;
+    nokogiriSAXTuplePtr tuple;
+    VALUE rb_tuple;
 
     if (!rb_obj_is_kind_of(sax_handler, cNokogiriXmlSaxParser))
 	rb_raise(rb_eArgError, "argument must be a Nokogiri::XML::SAX::Parser");
@@ -90,9 +93,11 @@ parse_with(VALUE self, VALUE sax_handler)
 	xmlFree(ctxt->sax);
 
     ctxt->sax = sax;
-    ctxt->userData = (void *)NOKOGIRI_SAX_TUPLE_NEW(ctxt, sax_handler);
+    rb_tuple = Nokogiri_sax_tuple_new(ctxt, sax_handler, &tuple);
+    ctxt->userData = (void *)tuple;
 
     rb_ensure(parse_doc, (VALUE)ctxt, parse_doc_finalize, (VALUE)ctxt);
+    RB_GC_GUARD(rb_tuple);
 
     return self;
 }
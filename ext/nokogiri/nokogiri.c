@@ -35,6 +35,40 @@ void vasprintf_free (void *p)
 }
 #endif
 
+typedef struct {
+  void *(*func)(void *);
+  void *data;
+  int ran;
+} nokogiriDeferredCall;
+
+static void * call_deferred(void *data)
+{
+  nokogiriDeferredCall *call = (nokogiriDeferredCall *)data;
+  call->ran = 1;
+  return call->func(call->data);
+}
+
+/*
+ * rb_thread_call_without_gvl2 skips the call outright when any interrupt
+ * is pending, timer ticks and postponed jobs included.  Processing them
+ * here could raise, and callers rely on nothing being raised before they
+ * clean up, so a skipped call runs with the GVL held instead.
+ */
+void * Nokogiri_without_gvl_defer_ints(void *(*func)(void *), void *data)
+{
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2)
+  nokogiriDeferredCall call;
+  void *result;
+
+  call.func = func;
+  call.data = data;
+  call.ran = 0;
+  result = rb_thread_call_without_gvl2(call_deferred, &call, NULL, NULL);
+  if(call.ran) return result;
+#endif
+  return func(data);
+}
+
 #ifndef __MACRUBY__
 #include "util.h"
 #endif
@@ -86,6 +120,7 @@ void Init_nokogiri()
   init_xml_comment();
   init_xml_node_set();
   init_xml_xpath_context();
+  init_xml_xpath_expression();
   init_xml_sax_parser_context();
   init_xml_sax_parser();
   init_xml_sax_push_parser();
@@ -105,4 +140,6 @@ void Init_nokogiri()
   init_xml_relax_ng();
   init_nokogiri_io();
   init_xml_encoding_handler();
+  init_css_parser();
+  init_html_encoding_reader();
 }
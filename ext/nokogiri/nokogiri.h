@@ -22,6 +22,7 @@ int vasprintf (char **strp, const char *fmt, va_list ap);
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/xmlreader.h>
+#include <libxml/pattern.h>
 #include <libxml/xmlsave.h>
 #include <libxml/xmlschemas.h>
 #include <libxml/HTMLparser.h>
@@ -81,6 +82,7 @@ int vasprintf (char **strp, const char *fmt, va_list ap);
 #include <xml_libxml2_hacks.h>
 
 #include <xml_io.h>
+#include <xml_syntax_error.h>
 #include <xml_document.h>
 #include <html_entity_lookup.h>
 #include <html_document.h>
@@ -98,6 +100,7 @@ int vasprintf (char **strp, const char *fmt, va_list ap);
 #include <xml_element_decl.h>
 #include <xml_entity_decl.h>
 #include <xml_xpath_context.h>
+#include <xml_xpath_expression.h>
 #include <xml_element_content.h>
 #include <xml_sax_parser_context.h>
 #include <xml_sax_parser.h>
@@ -105,12 +108,13 @@ int vasprintf (char **strp, const char *fmt, va_list ap);
 #include <xml_reader.h>
 #include <html_sax_parser_context.h>
 #include <xslt_stylesheet.h>
-#include <xml_syntax_error.h>
 #include <xml_schema.h>
 #include <xml_relax_ng.h>
 #include <html_element_description.h>
 #include <xml_namespace.h>
 #include <xml_encoding_handler.h>
+#include <css_parser.h>
+#include <html_encoding_reader.h>
 
 extern VALUE mNokogiri ;
 extern VALUE mNokogiriXml ;
@@ -153,6 +157,52 @@ extern VALUE mNokogiriXslt ;
 #define RARRAY_LEN(a) RARRAY(a)->len
 #endif
 
+/*
+ * Run func(data) without holding the GVL where this ruby supports it.
+ * func must not touch any Ruby object.
+ */
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+#include <ruby/thread.h>
+#define NOKOGIRI_WITHOUT_GVL(func, data) \
+  rb_thread_call_without_gvl((func), (void *)(data), NULL, NULL)
+#elif defined(HAVE_RB_THREAD_BLOCKING_REGION)
+#define NOKOGIRI_WITHOUT_GVL(func, data) \
+  rb_thread_blocking_region((rb_blocking_function_t *)(func), (void *)(data), NULL, NULL)
+#else
+#define NOKOGIRI_WITHOUT_GVL(func, data) \
+  (func)((void *)(data))
+#endif
+
+/*
+ * Like NOKOGIRI_WITHOUT_GVL, for a func that blocks on a file descriptor.
+ * Thread#raise and Thread#kill interrupt the system call.
+ */
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+#define NOKOGIRI_BLOCKING_IO(func, data) \
+  rb_thread_call_without_gvl((func), (void *)(data), RUBY_UBF_IO, NULL)
+#elif defined(HAVE_RB_THREAD_BLOCKING_REGION)
+#define NOKOGIRI_BLOCKING_IO(func, data) \
+  rb_thread_blocking_region((rb_blocking_function_t *)(func), (void *)(data), RUBY_UBF_IO, NULL)
+#else
+#define NOKOGIRI_BLOCKING_IO(func, data) \
+  (func)((void *)(data))
+#endif
+
+/*
+ * Like NOKOGIRI_WITHOUT_GVL, but interrupts that arrive meanwhile are left
+ * pending instead of being raised as soon as func returns, so the caller
+ * can release what it holds and then call rb_thread_check_ints.  func
+ * always runs exactly once; if an interrupt is already pending, or this
+ * ruby lacks rb_thread_call_without_gvl2, it runs with the GVL held.
+ */
+void * Nokogiri_without_gvl_defer_ints(void *(*func)(void *), void *data);
+#define NOKOGIRI_WITHOUT_GVL_DEFER_INTS(func, data) \
+  Nokogiri_without_gvl_defer_ints((func), (void *)(data))
+
+#ifndef RB_GC_GUARD
+#define RB_GC_GUARD(v) (*(volatile VALUE *)&(v))
+#endif
+
 #ifndef __builtin_expect
 # if defined(__GNUC__)
 #  define __builtin_expect(expr, c) __builtin_expect((long)(expr), (long)(c))
@@ -9,8 +9,17 @@
 static VALUE set_value(VALUE self, VALUE content)
 {
   xmlAttrPtr attr;
+  xmlNodePtr cur, next;
   Data_Get_Struct(self, xmlAttr, attr);
 
+  /* Children that are still referenced from Ruby must outlive the list. */
+  for(cur = attr->children; cur; cur = next) {
+    next = cur->next;
+    if(cur->_private) {
+      xmlUnlinkNode(cur);
+      NOKOGIRI_ROOT_NODE(cur);
+    }
+  }
   if(attr->children) xmlFreeNodeList(attr->children);
 
   attr->children = attr->last = NULL;
@@ -17,12 +17,11 @@ static int dealloc_node_i(xmlNodePtr key, xmlNodePtr node, xmlDocPtr doc)
   return ST_CONTINUE;
 }
 
-static void dealloc(xmlDocPtr doc)
+static void free_document(xmlDocPtr doc)
 {
   xmlDeregisterNodeFunc func;
   st_table *node_hash;
 
-  NOKOGIRI_DEBUG_START(doc);
   func = xmlDeregisterNodeDefault(NULL);
 
   node_hash  = DOC_UNLINKED_NODE_HASH(doc);
@@ -35,9 +34,58 @@ static void dealloc(xmlDocPtr doc)
   xmlFreeDoc(doc);
 
   xmlDeregisterNodeDefault(func);
+}
+
+/*
+ * Node wrappers are collected independently of their Document and clear
+ * node->_private when they go, so the libxml2 tree has to outlive every
+ * one of them.  If the GC sweeps the Document first, freeing is left to
+ * the last node wrapper.
+ */
+static void dealloc(xmlDocPtr doc)
+{
+  nokogiriTuplePtr tuple = DOC_RUBY_OBJECT_TEST(doc);
+
+  NOKOGIRI_DEBUG_START(doc);
+  if(tuple->live_nodes > 0) {
+    tuple->doc = Qnil;
+    tuple->node_cache = Qnil;
+    tuple->orphaned = 1;
+  } else {
+    free_document(doc);
+  }
   NOKOGIRI_DEBUG_END(doc);
 }
 
+/*
+ * Called when a node wrapper belonging to +doc+ is swept.
+ */
+void Nokogiri_xml_document_node_unwrapped(xmlDocPtr doc)
+{
+  nokogiriTuplePtr tuple = DOC_RUBY_OBJECT_TEST(doc);
+
+  if(--tuple->live_nodes == 0 && tuple->orphaned)
+    free_document(doc);
+}
+
+/*
+ * libxml2 structs hold raw references to the Document, its node cache and
+ * the wrappers in it, so all of them are marked here to pin them in place
+ * during GC.compact.
+ */
+static void mark(xmlDocPtr doc)
+{
+  nokogiriTuplePtr tuple = DOC_RUBY_OBJECT_TEST(doc);
+  long i;
+
+  if(!tuple) return;
+
+  rb_gc_mark(tuple->doc);
+  rb_gc_mark(tuple->node_cache);
+  for(i = 0; i < RARRAY_LEN(tuple->node_cache); i++)
+    rb_gc_mark(RARRAY_PTR(tuple->node_cache)[i]);
+}
+
 static void recursively_remove_namespaces_from_node(xmlNodePtr node)
 {
   xmlNodePtr child ;
@@ -205,22 +253,31 @@ static VALUE read_io( VALUE klass,
   const char * c_url    = NIL_P(url)      ? NULL : StringValuePtr(url);
   const char * c_enc    = NIL_P(encoding) ? NULL : StringValuePtr(encoding);
   VALUE error_list      = rb_ary_new();
-  VALUE document;
+  VALUE document, rb_reader;
+  nokogiriIOReader *reader;
   xmlDocPtr doc;
 
+  rb_reader = Nokogiri_io_reader(io, &reader);
+
   xmlResetLastError();
   xmlSetStructuredErrorFunc((void *)error_list, Nokogiri_error_array_pusher);
 
   doc = xmlReadIO(
-      (xmlInputReadCallback)io_read_callback,
+      (xmlInputReadCallback)io_reader_read_callback,
       (xmlInputCloseCallback)io_close_callback,
-      (void *)io,
+      (void *)reader,
       c_url,
       c_enc,
       (int)NUM2INT(options)
   );
   xmlSetStructuredErrorFunc(NULL, NULL);
 
+  if(reader->state) {
+    xmlFreeDoc(doc);
+    Nokogiri_io_reader_check(reader);
+  }
+  RB_GC_GUARD(rb_reader);
+
   if(doc == NULL) {
     xmlErrorPtr error;
 
@@ -240,48 +297,385 @@ static VALUE read_io( VALUE klass,
   return document;
 }
 
+static void *
+read_without_gvl(void *data)
+{
+    nokogiriReadArgs *args = (nokogiriReadArgs *)data;
+    xmlErrorPtr error;
+
+    xmlResetLastError();
+    xmlSetStructuredErrorFunc((void *)&args->errors, Nokogiri_error_list_pusher);
+    args->doc = args->reader(args);
+    xmlSetStructuredErrorFunc(NULL, NULL);
+
+    if (args->doc == NULL && (error = xmlGetLastError()) != NULL)
+	xmlCopyError(error, &args->last_error);
+
+    return NULL;
+}
+
 /*
- * call-seq:
- *  read_memory(string, url, encoding, options)
- *
- * Create a new document from a String
+ * Run args->reader with the GVL released, then wrap the resulting document
+ * in an instance of +klass+ and store the collected errors on it.  Raises
+ * the last libxml2 error if no document was produced.  An interrupt that
+ * arrives during the parse is raised only once the document is owned by
+ * Ruby, so it cannot leak.
  */
-static VALUE read_memory( VALUE klass,
-                          VALUE string,
-                          VALUE url,
-                          VALUE encoding,
-                          VALUE options )
+VALUE
+Nokogiri_read_document(VALUE klass, nokogiriReadArgs *args)
 {
-  const char * c_buffer = StringValuePtr(string);
-  const char * c_url    = NIL_P(url)      ? NULL : StringValuePtr(url);
-  const char * c_enc    = NIL_P(encoding) ? NULL : StringValuePtr(encoding);
-  int len               = (int)RSTRING_LEN(string);
-  VALUE error_list      = rb_ary_new();
-  VALUE document;
-  xmlDocPtr doc;
+    VALUE error_list, document;
+
+    memset(&args->errors, 0, sizeof(args->errors));
+    memset(&args->last_error, 0, sizeof(args->last_error));
+    args->doc = NULL;
+
+    NOKOGIRI_WITHOUT_GVL_DEFER_INTS(read_without_gvl, args);
+
+    if (args->doc == NULL) {
+	VALUE exception;
+
+	Nokogiri_error_list_free(&args->errors);
+	if (args->last_error.code != XML_ERR_OK) {
+	    exception = Nokogiri_wrap_xml_syntax_error((VALUE)NULL, &args->last_error);
+	    xmlResetError(&args->last_error);
+	} else {
+	    exception = rb_exc_new2(rb_eRuntimeError, "Could not parse document");
+	}
+	rb_thread_check_ints();
+	rb_exc_raise(exception);
+    }
 
-  xmlResetLastError();
-  xmlSetStructuredErrorFunc((void *)error_list, Nokogiri_error_array_pusher);
-  doc = xmlReadMemory(c_buffer, len, c_url, c_enc, (int)NUM2INT(options));
-  xmlSetStructuredErrorFunc(NULL, NULL);
+    error_list = Nokogiri_error_list_to_ary(&args->errors);
+    document = Nokogiri_wrap_xml_document(klass, args->doc);
+    rb_iv_set(document, "@errors", error_list);
+    rb_thread_check_ints();
+    return document;
+}
 
-  if(doc == NULL) {
-    xmlErrorPtr error;
+/*
+ * Every +step+th document of a batch, starting at +first+, parsed by one
+ * worker thread.
+ */
+typedef struct {
+    nokogiriReadArgs *args;
+    long             count;
+    long             first;
+    long             step;
+} nokogiriReadSlice;
+
+typedef struct {
+    nokogiriReadSlice *slices;
+    int               nslices;
+    VALUE             threads;
+    VALUE             klass;
+    nokogiriReadArgs  *args;
+    long              count;
+    VALUE             documents;
+} nokogiriReadBatch;
+
+static void *
+read_slice_without_gvl(void *data)
+{
+    nokogiriReadSlice *slice = (nokogiriReadSlice *)data;
+    long i;
 
-    xmlFreeDoc(doc);
+    for (i = slice->first; i < slice->count; i += slice->step)
+	read_without_gvl(&slice->args[i]);
 
-    error = xmlGetLastError();
-    if(error)
-      rb_exc_raise(Nokogiri_wrap_xml_syntax_error((VALUE)NULL, error));
-    else
-      rb_raise(rb_eRuntimeError, "Could not parse document");
+    return NULL;
+}
 
+/*
+ * Interrupts are left pending so that every parsed document is wrapped
+ * before they are raised.
+ */
+static VALUE
+read_slice(void *data)
+{
+    NOKOGIRI_WITHOUT_GVL_DEFER_INTS(read_slice_without_gvl, data);
     return Qnil;
-  }
+}
 
-  document = Nokogiri_wrap_xml_document(klass, doc);
-  rb_iv_set(document, "@errors", error_list);
-  return document;
+static VALUE
+start_workers(VALUE data)
+{
+    nokogiriReadBatch *batch = (nokogiriReadBatch *)data;
+    int i;
+
+    for (i = 1; i < batch->nslices; i++)
+	rb_ary_push(batch->threads, rb_thread_create(read_slice, &batch->slices[i]));
+
+    /* The calling thread takes the first slice */
+    return read_slice(&batch->slices[0]);
+}
+
+static VALUE
+join_thread(VALUE thread)
+{
+    return rb_funcall(thread, rb_intern("join"), 0);
+}
+
+/*
+ * Wait for every worker, even if the calling thread is interrupted while
+ * it waits, since the workers write to the batch until they finish.  The
+ * first interrupt is raised once they all have.
+ */
+static VALUE
+join_workers(VALUE data)
+{
+    nokogiriReadBatch *batch = (nokogiriReadBatch *)data;
+    VALUE thread;
+    long i;
+    int state, pending = 0;
+
+    for (i = 0; i < RARRAY_LEN(batch->threads); i++) {
+	thread = rb_ary_entry(batch->threads, i);
+	do {
+	    rb_protect(join_thread, thread, &state);
+	    if (state && !pending) pending = state;
+	} while (state && RTEST(rb_funcall(thread, rb_intern("alive?"), 0)));
+    }
+
+    if (pending) rb_jump_tag(pending);
+    return Qnil;
+}
+
+static VALUE
+read_batch(VALUE data)
+{
+    nokogiriReadBatch *batch = (nokogiriReadBatch *)data;
+    nokogiriReadArgs *args = batch->args;
+    VALUE document;
+    long i;
+
+    rb_ensure(start_workers, data, join_workers, data);
+
+    for (i = 0; i < batch->count; i++) {
+	if (args[i].doc) {
+	    document = Nokogiri_wrap_xml_document(batch->klass, args[i].doc);
+	    args[i].doc = NULL;
+	    rb_iv_set(document, "@errors", Nokogiri_error_list_to_ary(&args[i].errors));
+	} else {
+	    Nokogiri_error_list_free(&args[i].errors);
+	    if (args[i].last_error.code != XML_ERR_OK) {
+		document = Nokogiri_wrap_xml_syntax_error((VALUE)NULL, &args[i].last_error);
+		xmlResetError(&args[i].last_error);
+	    } else {
+		document = rb_exc_new2(rb_eRuntimeError, "Could not parse document");
+	    }
+	}
+	rb_ary_push(batch->documents, document);
+    }
+
+    return Qnil;
+}
+
+/* Free whatever of the batch was not handed to Ruby */
+static VALUE
+free_batch(VALUE data)
+{
+    nokogiriReadBatch *batch = (nokogiriReadBatch *)data;
+    long i;
+
+    for (i = 0; i < batch->count; i++) {
+	if (batch->args[i].doc) xmlFreeDoc(batch->args[i].doc);
+	Nokogiri_error_list_free(&batch->args[i].errors);
+	xmlResetError(&batch->args[i].last_error);
+    }
+    xfree(batch->args);
+
+    return Qnil;
+}
+
+/*
+ * Parse +count+ documents with +reader+, spread over +threads+ Ruby
+ * threads that each release the GVL for their whole share.  Ruby threads
+ * rather than bare native ones are used because libxml2 allocates with
+ * ruby_xmalloc, which may need to take the GVL to run the GC.
+ *
+ * +sources+ is an Array of Strings, and +encodings+ an Array of the
+ * encoding of each, or nil.  Every source is checked before any is
+ * parsed.  Returns an Array of the documents, each an instance of +klass+
+ * with its errors, in the order of +sources+; a document that could not
+ * be parsed at all is replaced by the exception read_memory would have
+ * raised.
+ */
+VALUE
+Nokogiri_read_documents(VALUE klass, xmlDocPtr (*reader)(nokogiriReadArgs *),
+                        VALUE sources, VALUE encodings, VALUE options,
+                        VALUE threads)
+{
+    nokogiriReadArgs *args;
+    nokogiriReadBatch batch;
+    VALUE keep, documents;
+    long count, i;
+    int nthreads, c_options;
+
+    Check_Type(sources, T_ARRAY);
+    count     = RARRAY_LEN(sources);
+    c_options = (int)NUM2INT(options);
+    nthreads  = NUM2INT(threads);
+    if (nthreads > count) nthreads = (int)count;
+    if (nthreads < 1) nthreads = 1;
+
+    documents = rb_ary_new2(count);
+    if (count == 0) return documents;
+
+    /*
+     * Frozen copies of every String keep their buffers stable.  Taking
+     * them first means nothing below can raise before the parse.
+     */
+    keep = rb_ary_new2(2 * count);
+    for (i = 0; i < count; i++) {
+	VALUE string = rb_ary_entry(sources, i);
+	VALUE encoding = NIL_P(encodings) ? Qnil : rb_ary_entry(encodings, i);
+
+	string = rb_str_new_frozen(StringValue(string));
+	if (!NIL_P(encoding)) {
+	    encoding = rb_str_new_frozen(StringValue(encoding));
+	    StringValueCStr(encoding);
+	}
+	rb_ary_push(keep, string);
+	rb_ary_push(keep, encoding);
+    }
+
+    batch.threads = rb_ary_new2(nthreads);
+    args = ALLOC_N(nokogiriReadArgs, count);
+    memset(args, 0, sizeof(nokogiriReadArgs) * (size_t)count);
+
+    for (i = 0; i < count; i++) {
+	VALUE string = RARRAY_PTR(keep)[2 * i];
+	VALUE encoding = RARRAY_PTR(keep)[2 * i + 1];
+
+	args[i].reader   = reader;
+	args[i].buffer   = RSTRING_PTR(string);
+	args[i].length   = (int)RSTRING_LEN(string);
+	args[i].options  = c_options;
+	args[i].encoding = NIL_P(encoding) ? NULL : RSTRING_PTR(encoding);
+    }
+
+    batch.slices    = ALLOCA_N(nokogiriReadSlice, nthreads);
+    batch.nslices   = nthreads;
+    batch.klass     = klass;
+    batch.args      = args;
+    batch.count     = count;
+    batch.documents = documents;
+    for (i = 0; i < nthreads; i++) {
+	batch.slices[i].args  = args;
+	batch.slices[i].count = count;
+	batch.slices[i].first = i;
+	batch.slices[i].step  = nthreads;
+    }
+
+    rb_ensure(read_batch, (VALUE)&batch, free_batch, (VALUE)&batch);
+    rb_thread_check_ints();
+
+    RB_GC_GUARD(keep);
+    RB_GC_GUARD(batch.threads);
+    return documents;
+}
+
+static xmlDocPtr
+read_memory_reader(nokogiriReadArgs *args)
+{
+    return xmlReadMemory(args->buffer, args->length, args->url,
+			 args->encoding, args->options);
+}
+
+/*
+ * call-seq:
+ *  read_memory(string, url, encoding, options)
+ *
+ * Create a new document from a String.  The GVL is released while the
+ * document is parsed.
+ */
+static VALUE
+read_memory(VALUE klass, VALUE string, VALUE url, VALUE encoding, VALUE options)
+{
+    nokogiriReadArgs args;
+    VALUE document;
+
+    /* Frozen copies share the buffers and keep them stable during the parse */
+    string = rb_str_new_frozen(StringValue(string));
+    if (!NIL_P(url))      url      = rb_str_new_frozen(StringValue(url));
+    if (!NIL_P(encoding)) encoding = rb_str_new_frozen(StringValue(encoding));
+
+    args.reader   = read_memory_reader;
+    args.buffer   = RSTRING_PTR(string);
+    args.length   = (int)RSTRING_LEN(string);
+    args.url      = NIL_P(url)      ? NULL : RSTRING_PTR(url);
+    args.encoding = NIL_P(encoding) ? NULL : RSTRING_PTR(encoding);
+    args.options  = (int)NUM2INT(options);
+
+    document = Nokogiri_read_document(klass, &args);
+
+    RB_GC_GUARD(string);
+    RB_GC_GUARD(url);
+    RB_GC_GUARD(encoding);
+    return document;
+}
+
+static xmlDocPtr
+read_file_reader(nokogiriReadArgs *args)
+{
+    return xmlReadIO(mapped_file_read_callback, io_close_callback, args->io,
+                     args->url, args->encoding, args->options);
+}
+
+/*
+ * call-seq:
+ *  read_file(path, url, encoding, options)
+ *
+ * Create a new document from the file at +path+.  The file is mapped into
+ * memory and parsed from the mapping with the GVL released, so its
+ * contents are never copied into a Ruby String.
+ */
+static VALUE
+read_file(VALUE klass, VALUE path, VALUE url, VALUE encoding, VALUE options)
+{
+    nokogiriReadArgs args;
+    nokogiriMappedFile *file;
+    VALUE rb_file, document;
+
+    /* Frozen copies stay put while the GVL is released */
+    if (!NIL_P(url))      url      = rb_str_new_frozen(StringValue(url));
+    if (!NIL_P(encoding)) encoding = rb_str_new_frozen(StringValue(encoding));
+
+    rb_file = Nokogiri_map_file(path, &file);
+    if (file->length == 0) return rb_funcall(klass, rb_intern("new"), 0);
+
+    args.reader   = read_file_reader;
+    args.buffer   = NULL;
+    args.length   = 0;
+    args.io       = file;
+    args.url      = NIL_P(url)      ? NULL : RSTRING_PTR(url);
+    args.encoding = NIL_P(encoding) ? NULL : RSTRING_PTR(encoding);
+    args.options  = (int)NUM2INT(options);
+
+    document = Nokogiri_read_document(klass, &args);
+    Nokogiri_unmap_file(file);
+
+    RB_GC_GUARD(rb_file);
+    RB_GC_GUARD(url);
+    RB_GC_GUARD(encoding);
+    return document;
+}
+
+/*
+ * call-seq:
+ *  read_memory_many(strings, encodings, options, threads)
+ *
+ * Create a document from each String in +strings+, parsing them on
+ * +threads+ threads with the GVL released.  +encodings+ is nil or an
+ * Array with the encoding of each String.  See Nokogiri::XML.parse_many.
+ */
+static VALUE
+read_memory_many(VALUE klass, VALUE strings, VALUE encodings, VALUE options,
+                 VALUE threads)
+{
+    return Nokogiri_read_documents(klass, read_memory_reader, strings,
+                                   encodings, options, threads);
 }
 
 /*
@@ -472,18 +866,19 @@ static VALUE canonicalize(int argc, VALUE* argv, VALUE self)
   xmlC14NIsVisibleCallback cb = NULL;
   void * ctx = NULL;
 
-  VALUE rb_cStringIO;
-  VALUE io;
+  nokogiriIOWriter *writer;
+  VALUE rb_writer;
+  VALUE string;
 
   Data_Get_Struct(self, xmlDoc, doc);
 
-  rb_cStringIO = rb_const_get_at(rb_cObject, rb_intern("StringIO"));
-  io           = rb_class_new_instance(0, 0, rb_cStringIO);
+  string       = NOKOGIRI_STR_NEW2("");
+  rb_writer    = Nokogiri_io_writer(string, &writer);
   buf          = xmlAllocOutputBuffer(NULL);
 
-  buf->writecallback = (xmlOutputWriteCallback)io_write_callback;
-  buf->closecallback = (xmlOutputCloseCallback)io_close_callback;
-  buf->context       = (void *)io;
+  buf->writecallback = (xmlOutputWriteCallback)io_writer_write_callback;
+  buf->closecallback = (xmlOutputCloseCallback)io_writer_close_callback;
+  buf->context       = (void *)writer;
 
   if(rb_block_given_p()) {
     cb = block_caller;
@@ -511,8 +906,11 @@ static VALUE canonicalize(int argc, VALUE* argv, VALUE self)
     buf);
 
   xmlOutputBufferClose(buf);
+  free(ns);
 
-  return rb_funcall(io, rb_intern("string"), 0);
+  Nokogiri_io_writer_check(writer);
+  RB_GC_GUARD(rb_writer);
+  return string;
 }
 
 VALUE cNokogiriXmlDocument ;
@@ -530,6 +928,8 @@ void init_xml_document()
   cNokogiriXmlDocument = klass;
 
   rb_define_singleton_method(klass, "read_memory", read_memory, 4);
+  rb_define_singleton_method(klass, "read_memory_many", read_memory_many, 4);
+  rb_define_singleton_method(klass, "read_file", read_file, 4);
   rb_define_singleton_method(klass, "read_io", read_io, 4);
   rb_define_singleton_method(klass, "new", new, -1);
 
@@ -553,7 +953,7 @@ VALUE Nokogiri_wrap_xml_document(VALUE klass, xmlDocPtr doc)
 
   VALUE rb_doc = Data_Wrap_Struct(
       klass ? klass : cNokogiriXmlDocument,
-      0,
+      mark,
       dealloc,
       doc
   );
@@ -565,6 +965,8 @@ VALUE Nokogiri_wrap_xml_document(VALUE klass, xmlDocPtr doc)
   tuple->doc = rb_doc;
   tuple->unlinkedNodes = st_init_numtable_with_size(128);
   tuple->node_cache = cache;
+  tuple->live_nodes = 0;
+  tuple->orphaned = 0;
   doc->_private = tuple ;
 
   rb_obj_call_init(rb_doc, 0, NULL);
@@ -7,17 +7,45 @@ struct _nokogiriTuple {
   VALUE         doc;
   st_table     *unlinkedNodes;
   VALUE         node_cache;
+  long          live_nodes;   /* node wrappers not yet swept by the GC */
+  int           orphaned;     /* the Document was swept first */
 };
 typedef struct _nokogiriTuple nokogiriTuple;
 typedef nokogiriTuple * nokogiriTuplePtr;
 
+typedef struct _nokogiriReadArgs nokogiriReadArgs;
+
+/*
+ * Everything a parser needs to build a document without touching Ruby.
+ * +reader+ runs with the GVL released; the document is wrapped and the
+ * errors are converted once it returns.
+ */
+struct _nokogiriReadArgs {
+  xmlDocPtr         (*reader)(nokogiriReadArgs *args);
+  const char        *buffer;
+  int               length;
+  void              *io;        /* context for readers with input callbacks */
+  const char        *url;
+  const char        *encoding;
+  int               options;
+  xmlDocPtr         doc;
+  nokogiriErrorList errors;
+  xmlError          last_error;
+};
+
 void init_xml_document();
 VALUE Nokogiri_wrap_xml_document(VALUE klass, xmlDocPtr doc);
+VALUE Nokogiri_read_document(VALUE klass, nokogiriReadArgs *args);
+VALUE Nokogiri_read_documents(VALUE klass, xmlDocPtr (*reader)(nokogiriReadArgs *),
+                              VALUE sources, VALUE encodings, VALUE options,
+                              VALUE threads);
+void Nokogiri_xml_document_node_unwrapped(xmlDocPtr doc);
 
 #define DOC_RUBY_OBJECT_TEST(x) ((nokogiriTuplePtr)(x->_private))
 #define DOC_RUBY_OBJECT(x) (((nokogiriTuplePtr)(x->_private))->doc)
 #define DOC_UNLINKED_NODE_HASH(x) (((nokogiriTuplePtr)(x->_private))->unlinkedNodes)
 #define DOC_NODE_CACHE(x) (((nokogiriTuplePtr)(x->_private))->node_cache)
+#define DOC_NODE_WRAPPED(x) (((nokogiriTuplePtr)(x->_private))->live_nodes++)
 
 extern VALUE cNokogiriXmlDocument ;
 #endif
@@ -1,56 +1,610 @@
 #include <xml_io.h>
 
-static ID id_read, id_write;
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_RUBY_ENCODING_H
+#include <ruby/io.h>
+#endif
 
-VALUE read_check(VALUE *args) {
-  return rb_funcall(args[0], id_read, 1, args[1]);
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static ID id_read, id_write, id_readpartial, id_method, id_arity;
+static ID id_external_encoding, id_internal_encoding;
+
+static long io_buffer_size = 64 * 1024;
+
+static void *read_fd(void *data) {
+  nokogiriIOReader *reader = (nokogiriIOReader *)data;
+
+  reader->result = read(reader->fd, reader->buffer, (size_t)reader->size);
+  reader->error = errno;
+  return NULL;
+}
+
+static VALUE fill_from_fd(nokogiriIOReader *reader) {
+  if(!reader->buffer) {
+    reader->buffer = malloc((size_t)reader->size);
+    if(!reader->buffer) rb_memerror();
+  }
+
+  for(;;) {
+    NOKOGIRI_BLOCKING_IO(read_fd, reader);
+    if(reader->result >= 0) break;
+
+    /* Waits out EAGAIN on non-blocking sockets and handles interrupts */
+    errno = reader->error;
+    if(!rb_io_wait_readable(reader->fd)) rb_sys_fail(0);
+  }
+
+  reader->offset = 0;
+  reader->length = (long)reader->result;
+  return Qnil;
+}
+
+static VALUE fill_from_ruby(nokogiriIOReader *reader) {
+  VALUE string;
+
+  if(reader->readpartial == READPARTIAL_OUTBUF) {
+    if(NIL_P(reader->string)) reader->string = rb_str_buf_new(reader->size);
+    string = rb_funcall(reader->io, id_readpartial, 2,
+        LONG2NUM(reader->size), reader->string);
+  } else if(reader->readpartial == READPARTIAL_LENGTH) {
+    string = rb_funcall(reader->io, id_readpartial, 1, LONG2NUM(reader->size));
+  } else {
+    string = rb_funcall(reader->io, id_read, 1, LONG2NUM(reader->size));
+  }
+
+  reader->offset = reader->length = 0;
+  if(NIL_P(string)) return Qnil;
+
+  reader->string = StringValue(string);
+  reader->length = RSTRING_LEN(string);
+  return Qnil;
+}
+
+static VALUE fill_from_io(VALUE data) {
+  nokogiriIOReader *reader = (nokogiriIOReader *)data;
+
+  if(reader->fd >= 0) return fill_from_fd(reader);
+  return fill_from_ruby(reader);
+}
+
+/* readpartial signals the end of the input with EOFError */
+static VALUE fill_at_eof(VALUE data) {
+  nokogiriIOReader *reader = (nokogiriIOReader *)data;
+
+  reader->offset = reader->length = 0;
+  return Qnil;
+}
+
+static VALUE fill(VALUE data) {
+  return rb_rescue2(fill_from_io, data, fill_at_eof, data, rb_eEOFError, 0);
+}
+
+int io_reader_read_callback(void * ctx, char * buffer, int len) {
+  nokogiriIOReader *reader = (nokogiriIOReader *)ctx;
+  const char *chunk;
+  long safe_len;
+
+  if(reader->offset >= reader->length) {
+    if(reader->eof) return 0;
+    /*
+     * Any other exception is kept in +reader+ rather than raised through
+     * libxml2, and ends the input until Nokogiri_io_reader_check() raises
+     * it.
+     */
+    rb_protect(fill, (VALUE)reader, &reader->state);
+    if(reader->state) reader->offset = reader->length = 0;
+    if(reader->length == 0) {
+      reader->eof = 1;
+      return 0;
+    }
+  }
+
+  chunk = reader->fd >= 0 ? reader->buffer : RSTRING_PTR(reader->string);
+  safe_len = reader->length - reader->offset;
+  if(safe_len > (long)len) safe_len = (long)len;
+
+  memcpy(buffer, chunk + reader->offset, (size_t)safe_len);
+  reader->offset += safe_len;
+
+  return (int)safe_len;
 }
 
-VALUE read_failed(void) {
-	return Qnil;
+/*
+ * Re-raise an exception that ended the input of +reader+, once libxml2 is
+ * done with it.
+ */
+void Nokogiri_io_reader_check(nokogiriIOReader *reader) {
+  int state = reader->state;
+
+  reader->state = 0;
+  if(state) rb_jump_tag(state);
+}
+
+/*
+ * How can +io+, which is not read through its descriptor, be read?
+ * readpartial is passed a buffer to reuse only if it takes one.
+ */
+static int io_readpartial(VALUE io) {
+  int arity;
+
+  if(!rb_respond_to(io, id_readpartial)) return READPARTIAL_NONE;
+  arity = NUM2INT(rb_funcall(
+        rb_funcall(io, id_method, 1, ID2SYM(id_readpartial)), id_arity, 0));
+  if(arity == 2 || (arity < 0 && -arity - 1 <= 2)) return READPARTIAL_OUTBUF;
+  return READPARTIAL_LENGTH;
+}
+
+static void mark_io_reader(nokogiriIOReader *reader) {
+  rb_gc_mark(reader->io);
+  rb_gc_mark(reader->string);
+}
+
+static void dealloc_io_reader(nokogiriIOReader *reader) {
+  free(reader->buffer);
+  free(reader);
 }
 
-int io_read_callback(void * ctx, char * buffer, int len) {
-  VALUE string, args[2];
-  size_t str_len, safe_len;
+/*
+ * Can +io+ be read through its file descriptor?  Only when it is a real IO
+ * whose read methods have not been redefined, and Ruby has not buffered
+ * any of its input already.
+ */
+static int io_descriptor(VALUE io) {
+#ifdef HAVE_RUBY_ENCODING_H
+  rb_io_t *fptr;
+
+  if(TYPE(io) != T_FILE) return -1;
+#ifdef HAVE_RB_METHOD_BASIC_DEFINITION_P
+  if(!rb_method_basic_definition_p(CLASS_OF(io), id_read) ||
+     !rb_method_basic_definition_p(CLASS_OF(io), id_readpartial))
+    return -1;
+#else
+  if(rb_obj_class(io) != rb_cFile && rb_obj_class(io) != rb_cIO) return -1;
+#endif
+
+  GetOpenFile(io, fptr);
+  rb_io_check_readable(fptr);
+  if(rb_io_read_pending(fptr)) return -1;
+
+#ifdef HAVE_RB_IO_DESCRIPTOR
+  return rb_io_descriptor(io);
+#else
+  return fptr->fd;
+#endif
+#else
+  return -1;
+#endif
+}
+
+/*
+ * Wrap +io+ for io_reader_read_callback and store the state in +reader+.
+ * The returned object owns the state and must be kept alive while libxml2
+ * reads from it.
+ */
+VALUE Nokogiri_io_reader(VALUE io, nokogiriIOReader **reader) {
+  nokogiriIOReader *state;
+  VALUE rb_reader;
+
+  state = calloc(1, sizeof(nokogiriIOReader));
+  if(!state) rb_memerror();
+  state->io = io;
+  state->string = Qnil;
+  state->size = io_buffer_size;
+  state->fd = -1;
+  rb_reader = Data_Wrap_Struct(0, mark_io_reader, dealloc_io_reader, state);
 
-  args[0] = (VALUE)ctx;
-  args[1] = INT2NUM(len);
+  state->fd = io_descriptor(io);
+  if(state->fd < 0) state->readpartial = io_readpartial(io);
 
-  string = rb_rescue(read_check, (VALUE)args, read_failed, 0);
+  *reader = state;
+  return rb_reader;
+}
 
-  if(NIL_P(string)) return 0;
+static void *write_fd(void *data) {
+  nokogiriIOWriter *writer = (nokogiriIOWriter *)data;
 
-  str_len = (size_t)RSTRING_LEN(string);
-  safe_len = str_len > (size_t)len ? (size_t)len : str_len;
-  memcpy(buffer, StringValuePtr(string), safe_len);
+  writer->result = write(writer->fd, writer->pending, (size_t)writer->pending_len);
+  writer->error = errno;
+  return NULL;
+}
 
-  return safe_len;
+static VALUE flush_to_fd(nokogiriIOWriter *writer) {
+  while(writer->pending_len > 0) {
+    NOKOGIRI_BLOCKING_IO(write_fd, writer);
+    if(writer->result < 0) {
+      /* Waits out EAGAIN on non-blocking sockets and handles interrupts */
+      errno = writer->error;
+      if(!rb_io_wait_writable(writer->fd)) rb_sys_fail(0);
+      continue;
+    }
+    writer->pending += writer->result;
+    writer->pending_len -= (long)writer->result;
+  }
+  return Qnil;
 }
 
-VALUE write_check(VALUE *args) {
-  return rb_funcall(args[0], id_write, 1, args[1]);
+static VALUE flush_to_ruby(nokogiriIOWriter *writer) {
+  if(TYPE(writer->io) == T_STRING) {
+    rb_str_cat(writer->io, writer->pending, writer->pending_len);
+  } else {
+    rb_funcall(writer->io, id_write, 1,
+        rb_str_new(writer->pending, writer->pending_len));
+  }
+  writer->pending_len = 0;
+  return Qnil;
 }
 
-VALUE write_failed(void) {
-	return Qnil;
+static VALUE flush(VALUE data) {
+  nokogiriIOWriter *writer = (nokogiriIOWriter *)data;
+
+  if(writer->fd >= 0) return flush_to_fd(writer);
+  return flush_to_ruby(writer);
 }
 
-int io_write_callback(void * ctx, char * buffer, int len) {
-  VALUE args[2];
+/*
+ * Write +len+ bytes at +bytes+ to the target of +writer+.  An exception is
+ * kept in +writer+ rather than raised through libxml2, and the rest of the
+ * output is dropped until Nokogiri_io_writer_check() raises it.  libxml2
+ * is not told, so that it does not report an I/O error of its own.
+ */
+static void flush_bytes(nokogiriIOWriter *writer, const char *bytes, long len) {
+  if(writer->state) return;
+
+  writer->pending = bytes;
+  writer->pending_len = len;
+  rb_protect(flush, (VALUE)writer, &writer->state);
+}
+
+int io_writer_write_callback(void * ctx, char * buffer, int len) {
+  nokogiriIOWriter *writer = (nokogiriIOWriter *)ctx;
+
+  if(writer->state) return len;
 
-  args[0] = (VALUE)ctx;
-  args[1] = rb_str_new(buffer, (long)len);
+  /* A String grows in place; buffering would only add a copy */
+  if(!writer->buffer) {
+    flush_bytes(writer, buffer, (long)len);
+    return len;
+  }
 
-  rb_rescue(write_check, (VALUE)args, write_failed, 0);
+  if(writer->length + len > writer->size) {
+    if(writer->length > 0)
+      flush_bytes(writer, writer->buffer, writer->length);
+    writer->length = 0;
+
+    /* Too big to be worth buffering */
+    if((long)len >= writer->size) {
+      flush_bytes(writer, buffer, (long)len);
+      return len;
+    }
+  }
+
+  memcpy(writer->buffer + writer->length, buffer, (size_t)len);
+  writer->length += len;
   return len;
 }
 
+int io_writer_close_callback(void * ctx) {
+  nokogiriIOWriter *writer = (nokogiriIOWriter *)ctx;
+
+  if(writer->length > 0)
+    flush_bytes(writer, writer->buffer, writer->length);
+  writer->length = 0;
+
+  return 0;
+}
+
+/*
+ * Re-raise an exception that stopped the output of +writer+, once libxml2
+ * is done with it.
+ */
+void Nokogiri_io_writer_check(nokogiriIOWriter *writer) {
+  int state = writer->state;
+
+  writer->state = 0;
+  if(state) rb_jump_tag(state);
+}
+
+static void mark_io_writer(nokogiriIOWriter *writer) {
+  rb_gc_mark(writer->io);
+}
+
+static void dealloc_io_writer(nokogiriIOWriter *writer) {
+  free(writer->buffer);
+  free(writer);
+}
+
+/*
+ * Can +io+ be written through its file descriptor?  Only when it is a real
+ * IO whose write method has not been redefined and which does no encoding
+ * or newline conversion.  Ruby marks an IO that converts newlines as text
+ * mode.  Output Ruby has buffered is flushed first.
+ */
+static int io_writable_descriptor(VALUE io) {
+#ifdef HAVE_RUBY_ENCODING_H
+  rb_io_t *fptr;
+  int mode;
+
+  if(TYPE(io) != T_FILE) return -1;
+#ifdef HAVE_RB_METHOD_BASIC_DEFINITION_P
+  if(!rb_method_basic_definition_p(CLASS_OF(io), id_write)) return -1;
+#else
+  if(rb_obj_class(io) != rb_cFile && rb_obj_class(io) != rb_cIO) return -1;
+#endif
+
+  io = rb_io_get_write_io(io);
+  GetOpenFile(io, fptr);
+  rb_io_check_writable(fptr);
+#ifdef HAVE_RB_IO_MODE
+  mode = rb_io_mode(io);
+#else
+  mode = fptr->mode;
+#endif
+  if(!(mode & FMODE_BINMODE)) {
+    if(mode & FMODE_TEXTMODE) return -1;
+    if(!NIL_P(rb_funcall(io, id_external_encoding, 0))) return -1;
+    if(!NIL_P(rb_funcall(io, id_internal_encoding, 0))) return -1;
+  }
+
+  rb_io_flush(io);
+
+#ifdef HAVE_RB_IO_DESCRIPTOR
+  return rb_io_descriptor(io);
+#else
+  return fptr->fd;
+#endif
+#else
+  return -1;
+#endif
+}
+
+/*
+ * Wrap +io+ for io_writer_write_callback and io_writer_close_callback and
+ * store the state in +writer+.  +io+ may also be a String, which is
+ * appended to.  The returned object owns the state and must be kept alive
+ * while libxml2 writes to it.
+ */
+VALUE Nokogiri_io_writer(VALUE io, nokogiriIOWriter **writer) {
+  nokogiriIOWriter *state;
+  VALUE rb_writer;
+
+  state = calloc(1, sizeof(nokogiriIOWriter));
+  if(!state) rb_memerror();
+  state->io = io;
+  state->fd = -1;
+  state->size = io_buffer_size;
+  rb_writer = Data_Wrap_Struct(0, mark_io_writer, dealloc_io_writer, state);
+
+  if(TYPE(io) == T_STRING) {
+    rb_str_modify(io);
+  } else {
+    state->buffer = malloc((size_t)state->size);
+    if(!state->buffer) rb_memerror();
+    state->fd = io_writable_descriptor(io);
+  }
+
+  *writer = state;
+  return rb_writer;
+}
+
 int io_close_callback(void * ctx) {
   return 0;
 }
 
+int mapped_file_read_callback(void * ctx, char * buffer, int len) {
+  nokogiriMappedFile *file = (nokogiriMappedFile *)ctx;
+  size_t left = file->length - file->offset;
+  size_t safe_len = left > (size_t)len ? (size_t)len : left;
+
+  memcpy(buffer, file->addr + file->offset, safe_len);
+  file->offset += safe_len;
+
+  return (int)safe_len;
+}
+
+void Nokogiri_unmap_file(nokogiriMappedFile *file) {
+  if(file->addr) {
+#ifdef HAVE_MMAP
+    if(file->mapped)
+      munmap(file->addr, file->length);
+    else
+#endif
+      free(file->addr);
+  }
+  file->addr = NULL;
+  file->length = file->offset = 0;
+}
+
+static void dealloc_mapped_file(nokogiriMappedFile *file) {
+  Nokogiri_unmap_file(file);
+  free(file);
+}
+
+typedef struct {
+  int                fd;
+  nokogiriMappedFile *file;
+  int                error;
+} nokogiriMapArgs;
+
+/*
+ * Read a pipe, socket or special file, whose size is not known up front,
+ * until EOF into a growing buffer.  Reads release the GVL and, as for IO
+ * input, wait out EAGAIN and handle interrupts.
+ */
+static void read_to_end(nokogiriMapArgs *args) {
+  nokogiriMappedFile *file = args->file;
+  nokogiriIOReader reader;
+  size_t capacity = 0;
+  char *addr;
+
+  memset(&reader, 0, sizeof(reader));
+  reader.fd = args->fd;
+
+  for(;;) {
+    if(file->length == capacity) {
+      capacity = capacity ? capacity * 2 : (size_t)io_buffer_size;
+      if(!(addr = realloc(file->addr, capacity))) rb_memerror();
+      file->addr = addr;
+    }
+    reader.buffer = file->addr + file->length;
+    reader.size = (long)(capacity - file->length);
+
+    NOKOGIRI_BLOCKING_IO(read_fd, &reader);
+    if(reader.result == 0) return;
+    if(reader.result > 0) {
+      file->length += (size_t)reader.result;
+      continue;
+    }
+
+    errno = reader.error;
+    if(!rb_io_wait_readable(args->fd)) {
+      args->error = reader.error;
+      return;
+    }
+  }
+}
+
+static VALUE map_fd(VALUE data) {
+  nokogiriMapArgs *args = (nokogiriMapArgs *)data;
+  nokogiriMappedFile *file = args->file;
+  struct stat st;
+  size_t done = 0;
+  ssize_t n = 0;
+
+  if(fstat(args->fd, &st) < 0) {
+    args->error = errno;
+    return Qnil;
+  }
+  if(S_ISDIR(st.st_mode)) {
+    args->error = EISDIR;
+    return Qnil;
+  }
+
+  /* Only regular files have a size to map; /proc files claim to be empty */
+  if(!S_ISREG(st.st_mode) || st.st_size <= 0) {
+    read_to_end(args);
+    return Qnil;
+  }
+
+  file->length = (size_t)st.st_size;
+
+#ifdef HAVE_MMAP
+  file->addr = mmap(NULL, file->length, PROT_READ, MAP_PRIVATE, args->fd, 0);
+  if(file->addr != MAP_FAILED) {
+    file->mapped = 1;
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+    madvise(file->addr, file->length, MADV_SEQUENTIAL);
+#endif
+    return Qnil;
+  }
+  file->addr = NULL;
+#endif
+
+  /* Not mappable, fall back to reading the whole file */
+  if(!(file->addr = malloc(file->length))) {
+    file->length = 0;
+    args->error = ENOMEM;
+    return Qnil;
+  }
+  while(done < file->length) {
+    n = read(args->fd, file->addr + done, file->length - done);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) break;
+    done += (size_t)n;
+  }
+  if(n < 0) args->error = errno;
+  file->length = done;
+  return Qnil;
+}
+
+static VALUE close_mapped_fd(VALUE data) {
+  close(((nokogiriMapArgs *)data)->fd);
+  return Qnil;
+}
+
+/*
+ * Map the file at +path+ into memory and store it in +file+.  Files that
+ * cannot be mapped, such as pipes and devices, are read into memory
+ * instead.  The contents are owned by the returned object and released
+ * when that object is collected, or earlier by Nokogiri_unmap_file().
+ * Raises SystemCallError if the file cannot be read.
+ */
+VALUE Nokogiri_map_file(VALUE path, nokogiriMappedFile **file) {
+  nokogiriMappedFile *mapped;
+  nokogiriMapArgs args;
+  VALUE rb_file;
+
+  FilePathValue(path);
+
+  mapped = calloc(1, sizeof(nokogiriMappedFile));
+  if(!mapped) rb_memerror();
+  rb_file = Data_Wrap_Struct(0, NULL, dealloc_mapped_file, mapped);
+
+  args.fd = open(StringValueCStr(path), O_RDONLY | O_BINARY);
+  if(args.fd < 0) rb_sys_fail(StringValueCStr(path));
+  args.file = mapped;
+  args.error = 0;
+
+  rb_ensure(map_fd, (VALUE)&args, close_mapped_fd, (VALUE)&args);
+  if(args.error) {
+    Nokogiri_unmap_file(mapped);
+    errno = args.error;
+    rb_sys_fail(StringValueCStr(path));
+  }
+
+  *file = mapped;
+  return rb_file;
+}
+
+/*
+ * call-seq:
+ *  io_buffer_size
+ *
+ * The number of bytes read from an IO at a time while parsing it, and
+ * written at a time while serializing to it
+ */
+static VALUE get_io_buffer_size(VALUE self) {
+  return LONG2NUM(io_buffer_size);
+}
+
+/*
+ * call-seq:
+ *  io_buffer_size = bytes
+ *
+ * Set the number of bytes read from an IO at a time while parsing it, and
+ * written at a time while serializing to it
+ */
+static VALUE set_io_buffer_size(VALUE self, VALUE size) {
+  long c_size = NUM2LONG(size);
+
+  if(c_size <= 0 || c_size > INT_MAX)
+    rb_raise(rb_eArgError, "io_buffer_size must be between 1 and %d", INT_MAX);
+  io_buffer_size = c_size;
+  return size;
+}
+
 void init_nokogiri_io() {
+  VALUE nokogiri = rb_define_module("Nokogiri");
+
+  rb_define_singleton_method(nokogiri, "io_buffer_size", get_io_buffer_size, 0);
+  rb_define_singleton_method(nokogiri, "io_buffer_size=", set_io_buffer_size, 1);
+
   id_read = rb_intern("read");
   id_write = rb_intern("write");
+  id_readpartial = rb_intern("readpartial");
+  id_method = rb_intern("method");
+  id_arity = rb_intern("arity");
+  id_external_encoding = rb_intern("external_encoding");
+  id_internal_encoding = rb_intern("internal_encoding");
 }
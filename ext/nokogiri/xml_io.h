@@ -3,9 +3,74 @@
 
 #include <nokogiri.h>
 
-int io_read_callback(void * ctx, char * buffer, int len);
-int io_write_callback(void * ctx, char * buffer, int len);
+/*
+ * Buffered input from a Ruby IO for libxml2's read callbacks.  Real File
+ * and Socket objects are read through their file descriptor with the GVL
+ * released; anything else is read with readpartial, or read, in chunks of
+ * Nokogiri.io_buffer_size bytes.
+ */
+#define READPARTIAL_NONE    0 /* read(length) */
+#define READPARTIAL_LENGTH  1 /* readpartial(length) */
+#define READPARTIAL_OUTBUF  2 /* readpartial(length, buffer) */
+
+typedef struct _nokogiriIOReader {
+  VALUE   io;
+  VALUE   string;     /* last chunk returned by the Ruby protocol */
+  char    *buffer;    /* chunk read from +fd+ */
+  long    size;
+  long    offset;     /* unread bytes of the chunk are [offset, length) */
+  long    length;
+  int     fd;         /* -1 unless the descriptor is read directly */
+  int     readpartial;
+  int     eof;
+  int     state;      /* tag of an exception raised while reading */
+  ssize_t result;
+  int     error;
+} nokogiriIOReader;
+
+/*
+ * Buffered output to a Ruby IO or String for libxml2's write callbacks.
+ * Output is flushed in blocks of Nokogiri.io_buffer_size bytes, straight
+ * to the file descriptor of a real File or Socket.  A String is appended
+ * to directly.
+ */
+typedef struct _nokogiriIOWriter {
+  VALUE      io;
+  char       *buffer;     /* NULL when +io+ is a String */
+  long       size;
+  long       length;
+  int        fd;          /* -1 unless the descriptor is written directly */
+  int        state;       /* tag of an exception raised while writing */
+  const char *pending;    /* bytes being flushed */
+  long       pending_len;
+  ssize_t    result;
+  int        error;
+} nokogiriIOWriter;
+
+/*
+ * The contents of a file, mapped into memory where mmap() is available and
+ * read into a malloc()ed buffer elsewhere, or when the file is a pipe,
+ * device or other file that is not regular.  +offset+ is the read position
+ * of mapped_file_read_callback.
+ */
+typedef struct _nokogiriMappedFile {
+  char   *addr;
+  size_t length;
+  size_t offset;
+  int    mapped;
+} nokogiriMappedFile;
+
+int io_reader_read_callback(void * ctx, char * buffer, int len);
+VALUE Nokogiri_io_reader(VALUE io, nokogiriIOReader **reader);
+void Nokogiri_io_reader_check(nokogiriIOReader *reader);
+int io_writer_write_callback(void * ctx, char * buffer, int len);
+int io_writer_close_callback(void * ctx);
+VALUE Nokogiri_io_writer(VALUE io, nokogiriIOWriter **writer);
+void Nokogiri_io_writer_check(nokogiriIOWriter *writer);
 int io_close_callback(void * ctx);
+int mapped_file_read_callback(void * ctx, char * buffer, int len);
+VALUE Nokogiri_map_file(VALUE path, nokogiriMappedFile **file);
+void Nokogiri_unmap_file(nokogiriMappedFile *file);
 void init_nokogiri_io();
 
 #endif
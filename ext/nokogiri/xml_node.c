@@ -12,11 +12,76 @@ static void debug_node_dealloc(xmlNodePtr x)
 #  define debug_node_dealloc 0
 #endif
 
+/*
+ * Wrappers of nodes that belong to a Document are held weakly, keyed by
+ * the node's address.  The GC sweeps lazily, so a wrapper it has found
+ * unreachable may look intact for a while before it is freed; a raw
+ * reference in node->_private can not tell, but the weak map can.
+ * node->_private is only a hint that the node has been wrapped.
+ *
+ * Qnil when this Ruby's WeakMap does not take Integer keys.  The
+ * Document then holds every wrapper until it is freed itself.
+ */
+static VALUE weak_wrappers = Qnil;
+static ID id_aref, id_aset;
+
+#define WRAPPER_KEY(node) LONG2FIX((long)((size_t)(node) >> 3))
+
+static VALUE find_wrapper(xmlNodePtr node)
+{
+  if(!node->_private) return Qnil;
+  if(NIL_P(weak_wrappers)) return (VALUE)node->_private;
+  return rb_funcall(weak_wrappers, id_aref, 1, WRAPPER_KEY(node));
+}
+
+static void remember_wrapper(xmlNodePtr node, VALUE wrapper)
+{
+  node->_private = (void *)wrapper;
+  if(!NIL_P(weak_wrappers))
+    rb_funcall(weak_wrappers, id_aset, 2, WRAPPER_KEY(node), wrapper);
+}
+
+static VALUE new_weak_map(VALUE unused)
+{
+  VALUE map = rb_class_new_instance(0, NULL,
+      rb_path2class("ObjectSpace::WeakMap"));
+
+  rb_funcall(map, id_aset, 2, INT2FIX(0), map);
+  return map;
+}
+
 static void mark(xmlNodePtr node)
 {
   rb_gc_mark(DOC_RUBY_OBJECT(node->doc));
 }
 
+/*
+ * An unreferenced wrapper is collected and a new one is created the next
+ * time the node is reached.  The node itself lives on until its Document
+ * is freed.
+ */
+static void unwrap(xmlNodePtr node)
+{
+  NOKOGIRI_DEBUG_START(node)
+  Nokogiri_xml_document_node_unwrapped(node->doc);
+  NOKOGIRI_DEBUG_END(node)
+}
+
+/*
+ * xmlTextMerge frees +second+.  If it has been wrapped, it is unlinked
+ * and rooted instead so that no wrapper refers to freed memory.
+ */
+static xmlNodePtr merge_text(xmlNodePtr first, xmlNodePtr second)
+{
+  if(!second->_private || first->name != second->name)
+    return xmlTextMerge(first, second);
+
+  xmlNodeAddContent(first, second->content);
+  xmlUnlinkNode(second);
+  NOKOGIRI_ROOT_NODE(second);
+  return first;
+}
+
 /* :nodoc: */
 typedef xmlNodePtr (*pivot_reparentee_func)(xmlNodePtr, xmlNodePtr);
 
@@ -86,10 +151,10 @@ static xmlNodePtr xmlReplaceNodeWrapper(xmlNodePtr pivot, xmlNodePtr new_node)
   /* work around libxml2 issue: https://bugzilla.gnome.org/show_bug.cgi?id=615612 */
   if (retval->type == XML_TEXT_NODE) {
     if (retval->prev && retval->prev->type == XML_TEXT_NODE) {
-      retval = xmlTextMerge(retval->prev, retval);
+      retval = merge_text(retval->prev, retval);
     }
     if (retval->next && retval->next->type == XML_TEXT_NODE) {
-      retval = xmlTextMerge(retval, retval->next);
+      retval = merge_text(retval, retval->next);
     }
   }
 
@@ -100,7 +165,7 @@ static xmlNodePtr xmlReplaceNodeWrapper(xmlNodePtr pivot, xmlNodePtr new_node)
 static VALUE reparent_node_with(VALUE pivot_obj, VALUE reparentee_obj, pivot_reparentee_func prf)
 {
   VALUE reparented_obj ;
-  xmlNodePtr reparentee, pivot, reparented, next_text, new_next_text ;
+  xmlNodePtr reparentee, original, pivot, reparented, next_text, new_next_text ;
 
   if(!rb_obj_is_kind_of(reparentee_obj, cNokogiriXmlNode))
     rb_raise(rb_eArgError, "node must be a Nokogiri::XML::Node");
@@ -114,6 +179,7 @@ static VALUE reparent_node_with(VALUE pivot_obj, VALUE reparentee_obj, pivot_rep
     rb_raise(rb_eArgError, "cannot reparent a document node");
 
   xmlUnlinkNode(reparentee);
+  original = reparentee;
 
   if (reparentee->doc != pivot->doc || reparentee->type == XML_TEXT_NODE) {
     /*
@@ -175,6 +241,22 @@ static VALUE reparent_node_with(VALUE pivot_obj, VALUE reparentee_obj, pivot_rep
    *  might be a duplicate (see above) or might be the result of merging
    *  adjacent text nodes.
    */
+  if (reparented != original) {
+    if (find_wrapper(original) == reparentee_obj)
+      original->_private = NULL;
+
+    /* the wrapper now counts against the document it was moved into */
+    if (reparented->doc != original->doc) {
+      DOC_NODE_WRAPPED(reparented->doc);
+      Nokogiri_xml_document_node_unwrapped(original->doc);
+    }
+
+    /*
+     *  a merged text node may already have a wrapper of its own; the
+     *  reparentee takes over, so it is the one found from now on.
+     */
+    remember_wrapper(reparented, reparentee_obj);
+  }
   DATA_PTR(reparentee_obj) = reparented ;
 
   relink_namespace(reparented);
@@ -211,7 +293,7 @@ static VALUE pointer_id(VALUE self)
   xmlNodePtr node;
   Data_Get_Struct(self, xmlNode, node);
 
-  return INT2NUM((long)(node));
+  return LONG2NUM((long)(node));
 }
 
 /*
@@ -1014,11 +1096,150 @@ static VALUE add_previous_sibling(VALUE self, VALUE new_sibling)
   return reparent_node_with(self, new_sibling, xmlAddPrevSibling) ;
 }
 
+/*
+ * Output collected in memory while the GVL is released.  It is grown
+ * with realloc rather than the Ruby allocator.
+ */
+typedef struct {
+  char   *ptr;
+  size_t length;
+  size_t capacity;
+  int    failed;
+} nokogiriSaveBuffer;
+
+static int save_buffer_write_callback(void * ctx, const char * buffer, int len)
+{
+  nokogiriSaveBuffer *out = (nokogiriSaveBuffer *)ctx;
+
+  if(out->failed) return -1;
+
+  if(out->length + (size_t)len > out->capacity) {
+    size_t capacity = out->capacity ? out->capacity * 2 : 4096;
+    char *ptr;
+
+    while(capacity < out->length + (size_t)len) capacity *= 2;
+    ptr = realloc(out->ptr, capacity);
+    if(!ptr) {
+      out->failed = 1;
+      return -1;
+    }
+    out->ptr = ptr;
+    out->capacity = capacity;
+  }
+
+  memcpy(out->ptr + out->length, buffer, (size_t)len);
+  out->length += (size_t)len;
+  return len;
+}
+
+/* The longest indentation libxml2 keeps in a save context */
+#define MAX_INDENT 60
+
+/*
+ * Create a save context writing to +write+ that indents each level with
+ * +indent+.  The context keeps its own copy of the indentation, so
+ * nothing global is left changed while the tree is written.  Older
+ * libxml2 only copies it from xmlTreeIndentString when the context is
+ * created, so there it is swapped in for that moment alone.  That is also
+ * done for an indentation longer than MAX_INDENT, which
+ * xmlSaveSetIndentString refuses and libxml2 then leaves out, as it
+ * always has.
+ */
+static xmlSaveCtxtPtr save_context(xmlOutputWriteCallback write,
+    xmlOutputCloseCallback close, void *ctx, const char *encoding,
+    const char *indent, int options)
+{
+  xmlSaveCtxtPtr savectx;
+  const char *before_indent;
+
+#ifdef HAVE_XMLSAVESETINDENTSTRING
+  if(strlen(indent) <= MAX_INDENT) {
+    savectx = xmlSaveToIO(write, close, ctx, encoding, options);
+    if(savectx) xmlSaveSetIndentString(savectx, indent);
+  } else
+#endif
+  {
+    before_indent = xmlTreeIndentString;
+    xmlTreeIndentString = indent;
+    savectx = xmlSaveToIO(write, close, ctx, encoding, options);
+    xmlTreeIndentString = before_indent;
+  }
+
+  if(!savectx) rb_raise(rb_eRuntimeError, "Could not serialize the node");
+  return savectx;
+}
+
+typedef struct {
+  xmlSaveCtxtPtr savectx;
+  xmlNodePtr     node;
+} nokogiriSaveArgs;
+
+static void *save_tree(void *data)
+{
+  nokogiriSaveArgs *args = (nokogiriSaveArgs *)data;
+
+  xmlSaveTree(args->savectx, args->node);
+  xmlSaveFlush(args->savectx);
+  return NULL;
+}
+
+/*
+ * Can +node+ be serialized with +options+ without writing to its
+ * document?  Saving a Document swaps in the output encoding, and HTML
+ * output rewrites the meta charset, so those must keep the GVL to stay
+ * out of each other's way.
+ */
+static int save_is_read_only(xmlNodePtr node, const char *encoding, int options)
+{
+  if(encoding) return 0;
+  if(options & XML_SAVE_AS_HTML) return 0;
+  if(node->type == XML_DOCUMENT_NODE || node->type == XML_HTML_DOCUMENT_NODE)
+    return 0;
+  if(node->doc && node->doc->type == XML_HTML_DOCUMENT_NODE) return 0;
+  return 1;
+}
+
+/*
+ * Append the serialization of +node+ to the String +string+.  Formatting
+ * runs into memory, with the GVL released when it leaves the document
+ * untouched; the String is only touched once it is done.  An interrupt
+ * that arrives meanwhile is raised once the buffer has been released.
+ */
+static void write_to_string(xmlNodePtr node, VALUE string,
+    const char *encoding, const char *indent, int options)
+{
+  nokogiriSaveBuffer out;
+  nokogiriSaveArgs args;
+
+  rb_str_modify(string);
+  memset(&out, 0, sizeof(out));
+
+  args.node = node;
+  args.savectx = save_context(save_buffer_write_callback, NULL, &out,
+      encoding, indent, options);
+
+  if(save_is_read_only(node, encoding, options))
+    NOKOGIRI_WITHOUT_GVL_DEFER_INTS(save_tree, &args);
+  else
+    save_tree(&args);
+  xmlSaveClose(args.savectx);
+
+  if(out.failed) {
+    free(out.ptr);
+    rb_memerror();
+  }
+  if(out.length > 0) rb_str_cat(string, out.ptr, (long)out.length);
+  free(out.ptr);
+  rb_thread_check_ints();
+}
+
 /*
  * call-seq:
- *  native_write_to(io, encoding, options)
+ *  native_write_to(io, encoding, indent_string, options)
  *
- * Write this Node to +io+ with +encoding+ and +options+
+ * Write this Node to +io+ with +encoding+ and +options+, indenting each
+ * level with +indent_string+.  +io+ may be a String, which is appended
+ * to.
  */
 static VALUE native_write_to(
     VALUE self,
@@ -1028,29 +1249,39 @@ static VALUE native_write_to(
     VALUE options
 ) {
   xmlNodePtr node;
-  const char * before_indent;
   xmlSaveCtxtPtr savectx;
+  nokogiriIOWriter *writer;
+  VALUE rb_writer;
+  const char *c_encoding, *c_indent;
 
   Data_Get_Struct(self, xmlNode, node);
 
-  xmlIndentTreeOutput = 1;
+  c_encoding = RTEST(encoding) ? StringValuePtr(encoding) : NULL;
+  c_indent = StringValueCStr(indent_string);
 
-  before_indent = xmlTreeIndentString;
+  if(TYPE(io) == T_STRING) {
+    write_to_string(node, io, c_encoding, c_indent, (int)NUM2INT(options));
+    RB_GC_GUARD(indent_string);
+    return io;
+  }
 
-  xmlTreeIndentString = StringValuePtr(indent_string);
+  rb_writer = Nokogiri_io_writer(io, &writer);
 
-  savectx = xmlSaveToIO(
-      (xmlOutputWriteCallback)io_write_callback,
-      (xmlOutputCloseCallback)io_close_callback,
-      (void *)io,
-      RTEST(encoding) ? StringValuePtr(encoding) : NULL,
+  savectx = save_context(
+      (xmlOutputWriteCallback)io_writer_write_callback,
+      (xmlOutputCloseCallback)io_writer_close_callback,
+      (void *)writer,
+      c_encoding,
+      c_indent,
       (int)NUM2INT(options)
   );
 
   xmlSaveTree(savectx, node);
   xmlSaveClose(savectx);
 
-  xmlTreeIndentString = before_indent;
+  Nokogiri_io_writer_check(writer);
+  RB_GC_GUARD(rb_writer);
+  RB_GC_GUARD(indent_string);
   return io;
 }
 
@@ -1291,7 +1522,7 @@ VALUE Nokogiri_wrap_xml_node(VALUE klass, xmlNodePtr node)
   VALUE node_cache = Qnil ;
   VALUE rb_node = Qnil ;
   nokogiriTuplePtr node_has_a_document;
-  void (*mark_method)(xmlNodePtr) = NULL ;
+  VALUE default_class ;
 
   assert(node);
 
@@ -1303,65 +1534,79 @@ VALUE Nokogiri_wrap_xml_node(VALUE klass, xmlNodePtr node)
   /* and https://github.com/tenderlove/nokogiri/issues/439 */
   node_has_a_document = DOC_RUBY_OBJECT_TEST(node->doc);
 
-  if(node->_private && node_has_a_document)
-    return (VALUE)node->_private;
+  if(node_has_a_document) {
+    rb_node = find_wrapper(node);
+    if(!NIL_P(rb_node)) return rb_node;
+  }
 
-  if(!RTEST(klass)) {
-    switch(node->type)
-    {
-    case XML_ELEMENT_NODE:
-      klass = cNokogiriXmlElement;
-      break;
-    case XML_TEXT_NODE:
-      klass = cNokogiriXmlText;
-      break;
-    case XML_ATTRIBUTE_NODE:
-      klass = cNokogiriXmlAttr;
-      break;
-    case XML_ENTITY_REF_NODE:
-      klass = cNokogiriXmlEntityReference;
-      break;
-    case XML_COMMENT_NODE:
-      klass = cNokogiriXmlComment;
-      break;
-    case XML_DOCUMENT_FRAG_NODE:
-      klass = cNokogiriXmlDocumentFragment;
-      break;
-    case XML_PI_NODE:
-      klass = cNokogiriXmlProcessingInstruction;
-      break;
-    case XML_ENTITY_DECL:
-      klass = cNokogiriXmlEntityDecl;
-      break;
-    case XML_CDATA_SECTION_NODE:
-      klass = cNokogiriXmlCData;
-      break;
-    case XML_DTD_NODE:
-      klass = cNokogiriXmlDtd;
-      break;
-    case XML_ATTRIBUTE_DECL:
-      klass = cNokogiriXmlAttributeDecl;
-      break;
-    case XML_ELEMENT_DECL:
-      klass = cNokogiriXmlElementDecl;
-      break;
-    default:
-      klass = cNokogiriXmlNode;
-    }
+  switch(node->type)
+  {
+  case XML_ELEMENT_NODE:
+    default_class = cNokogiriXmlElement;
+    break;
+  case XML_TEXT_NODE:
+    default_class = cNokogiriXmlText;
+    break;
+  case XML_ATTRIBUTE_NODE:
+    default_class = cNokogiriXmlAttr;
+    break;
+  case XML_ENTITY_REF_NODE:
+    default_class = cNokogiriXmlEntityReference;
+    break;
+  case XML_COMMENT_NODE:
+    default_class = cNokogiriXmlComment;
+    break;
+  case XML_DOCUMENT_FRAG_NODE:
+    default_class = cNokogiriXmlDocumentFragment;
+    break;
+  case XML_PI_NODE:
+    default_class = cNokogiriXmlProcessingInstruction;
+    break;
+  case XML_ENTITY_DECL:
+    default_class = cNokogiriXmlEntityDecl;
+    break;
+  case XML_CDATA_SECTION_NODE:
+    default_class = cNokogiriXmlCData;
+    break;
+  case XML_DTD_NODE:
+    default_class = cNokogiriXmlDtd;
+    break;
+  case XML_ATTRIBUTE_DECL:
+    default_class = cNokogiriXmlAttributeDecl;
+    break;
+  case XML_ELEMENT_DECL:
+    default_class = cNokogiriXmlElementDecl;
+    break;
+  default:
+    default_class = cNokogiriXmlNode;
+  }
+
+  if(!RTEST(klass)) klass = default_class;
+
+  if (!node_has_a_document) {
+    rb_node = Data_Wrap_Struct(klass, NULL, debug_node_dealloc, node) ;
+    node->_private = (void *)rb_node;
+    return rb_node ;
   }
 
-  mark_method = node_has_a_document ? mark : NULL ;
+  rb_node = Data_Wrap_Struct(klass, mark, unwrap, node) ;
+  remember_wrapper(node, rb_node);
+  DOC_NODE_WRAPPED(node->doc);
 
-  rb_node = Data_Wrap_Struct(klass, mark_method, debug_node_dealloc, node) ;
-  node->_private = (void *)rb_node;
+  document = DOC_RUBY_OBJECT(node->doc);
 
-  if (node_has_a_document) {
-    document = DOC_RUBY_OBJECT(node->doc);
+  /*
+   * Instances of user-defined subclasses may carry state of their own, so
+   * the Document keeps them alive rather than letting them be recreated
+   * as the default class.
+   */
+  if (klass != default_class || NIL_P(weak_wrappers)) {
     node_cache = DOC_NODE_CACHE(node->doc);
     rb_ary_push(node_cache, rb_node);
-    rb_funcall(document, decorate, 1, rb_node);
   }
 
+  rb_funcall(document, decorate, 1, rb_node);
+
   return rb_node ;
 }
 
@@ -1384,11 +1629,25 @@ void init_xml_node()
   VALUE nokogiri = rb_define_module("Nokogiri");
   VALUE xml = rb_define_module_under(nokogiri, "XML");
   VALUE klass = rb_define_class_under(xml, "Node", rb_cObject);
+  int state;
 
   cNokogiriXmlNode = klass;
 
   cNokogiriXmlElement = rb_define_class_under(xml, "Element", klass);
 
+  id_aref = rb_intern("[]");
+  id_aset = rb_intern("[]=");
+  weak_wrappers = rb_protect(new_weak_map, Qnil, &state);
+  if(state) {
+    rb_set_errinfo(Qnil);
+    weak_wrappers = Qnil;
+  }
+  rb_global_variable(&weak_wrappers);
+
+  /* Indentation is always on; how much is set per save context */
+  xmlIndentTreeOutput = 1;
+  xmlThrDefIndentTreeOutput(1);
+
   rb_define_singleton_method(klass, "new", new, -1);
 
   rb_define_method(klass, "add_namespace_definition", add_namespace_definition, 2);
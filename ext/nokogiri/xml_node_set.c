@@ -1,7 +1,55 @@
 #include <xml_node_set.h>
 #include <libxml/xpathInternals.h>
 
-static ID decorate ;
+static ID decorate, id_name ;
+
+/* Sets smaller than this are searched linearly, like libxml2 does */
+#define INDEX_THRESHOLD 64
+
+/*
+ * Get a pointer index of the nodes in +tuple+, or NULL if the set is too
+ * small for one to pay off.  The index is built on first use and kept up
+ * to date by push and delete.  Namespace nodes are copies that libxml2
+ * compares by value, so they are never indexed.
+ */
+static st_table * node_index(nokogiriNodeSetTuple *tuple)
+{
+  xmlNodeSetPtr node_set = tuple->node_set;
+  int j;
+
+  if (tuple->index) return tuple->index;
+  if (!node_set || node_set->nodeNr < INDEX_THRESHOLD) return NULL;
+
+  tuple->index = st_init_numtable_with_size((st_index_t)node_set->nodeNr);
+  for (j = 0 ; j < node_set->nodeNr ; ++j) {
+    if (XML_NAMESPACE_DECL != node_set->nodeTab[j]->type)
+      st_insert(tuple->index, (st_data_t)node_set->nodeTab[j], (st_data_t)0);
+  }
+  return tuple->index;
+}
+
+static void drop_index(nokogiriNodeSetTuple *tuple)
+{
+  if (!tuple->index) return;
+  st_free_table(tuple->index);
+  tuple->index = NULL;
+}
+
+static int contains(nokogiriNodeSetTuple *tuple, xmlNodePtr node)
+{
+  st_table *index;
+
+  if (XML_NAMESPACE_DECL != node->type && (index = node_index(tuple)))
+    return st_lookup(index, (st_data_t)node, NULL);
+
+  return xmlXPathNodeSetContains(tuple->node_set, node);
+}
+
+/* Sort +node_set+ into document order if +document_order+ is true */
+static void order(xmlNodeSetPtr node_set, VALUE document_order)
+{
+  if (RTEST(document_order)) xmlXPathNodeSetSort(node_set);
+}
 
 /*
  * call-seq:
@@ -51,7 +99,15 @@ static VALUE push(VALUE self, VALUE rb_node)
 
   Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
   Data_Get_Struct(rb_node, xmlNode, node);
-  xmlXPathNodeSetAdd(tuple->node_set, node);
+
+  if (XML_NAMESPACE_DECL != node->type && node_index(tuple)) {
+    if (!st_lookup(tuple->index, (st_data_t)node, NULL)) {
+      xmlXPathNodeSetAddUnique(tuple->node_set, node);
+      st_insert(tuple->index, (st_data_t)node, (st_data_t)0);
+    }
+  } else {
+    xmlXPathNodeSetAdd(tuple->node_set, node);
+  }
   return self;
 }
 
@@ -73,8 +129,9 @@ static VALUE delete(VALUE self, VALUE rb_node)
   Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
   Data_Get_Struct(rb_node, xmlNode, node);
 
-  if (xmlXPathNodeSetContains(tuple->node_set, node)) {
+  if (contains(tuple, node)) {
     xmlXPathNodeSetDel(tuple->node_set, node);
+    if (tuple->index) st_delete(tuple->index, (st_data_t *)&node, NULL);
     return rb_node ;
   }
 
@@ -85,13 +142,19 @@ static VALUE delete(VALUE self, VALUE rb_node)
 /*
  * call-seq:
  *  &(node_set)
+ *  intersection(node_set, document_order = false)
  *
  * Set Intersection — Returns a new NodeSet containing nodes common to the two NodeSets.
+ * The nodes are in the order of this NodeSet unless +document_order+ is true.
  */
-static VALUE intersection(VALUE self, VALUE rb_other)
+static VALUE intersection(int argc, VALUE *argv, VALUE self)
 {
+  VALUE rb_other, document_order;
   nokogiriNodeSetTuple *tuple, *other;
   xmlNodeSetPtr intersection;
+  int j;
+
+  rb_scan_args(argc, argv, "11", &rb_other, &document_order);
 
   if(!rb_obj_is_kind_of(rb_other, cNokogiriXmlNodeSet))
     rb_raise(rb_eArgError, "node_set must be a Nokogiri::XML::NodeSet");
@@ -99,7 +162,13 @@ static VALUE intersection(VALUE self, VALUE rb_other)
   Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
   Data_Get_Struct(rb_other, nokogiriNodeSetTuple, other);
 
-  intersection = xmlXPathIntersection(tuple->node_set, other->node_set);
+  intersection = xmlXPathNodeSetCreate(NULL);
+  for (j = 0 ; j < tuple->node_set->nodeNr ; ++j) {
+    if (contains(other, tuple->node_set->nodeTab[j]))
+      xmlXPathNodeSetAddUnique(intersection, tuple->node_set->nodeTab[j]);
+  }
+
+  order(intersection, document_order);
   return Nokogiri_wrap_xml_node_set(intersection, rb_iv_get(self, "@document"));
 }
 
@@ -121,21 +190,26 @@ static VALUE include_eh(VALUE self, VALUE rb_node)
   Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
   Data_Get_Struct(rb_node, xmlNode, node);
 
-  return (xmlXPathNodeSetContains(tuple->node_set, node) ? Qtrue : Qfalse);
+  return (contains(tuple, node) ? Qtrue : Qfalse);
 }
 
 
 /*
  * call-seq:
  *  |(node_set)
+ *  union(node_set, document_order = false)
  *
  * Returns a new set built by merging the set and the elements of the given
- * set.
+ * set.  The nodes of this set come first unless +document_order+ is true.
  */
-static VALUE set_union(VALUE self, VALUE rb_other)
+static VALUE set_union(int argc, VALUE *argv, VALUE self)
 {
+  VALUE rb_other, document_order;
   nokogiriNodeSetTuple *tuple, *other;
   xmlNodeSetPtr new;
+  int j;
+
+  rb_scan_args(argc, argv, "11", &rb_other, &document_order);
 
   if(!rb_obj_is_kind_of(rb_other, cNokogiriXmlNodeSet))
     rb_raise(rb_eArgError, "node_set must be a Nokogiri::XML::NodeSet");
@@ -144,39 +218,58 @@ static VALUE set_union(VALUE self, VALUE rb_other)
   Data_Get_Struct(rb_other, nokogiriNodeSetTuple, other);
 
   new = xmlXPathNodeSetMerge(NULL, tuple->node_set);
-  new = xmlXPathNodeSetMerge(new, other->node_set);
+  for (j = 0 ; j < other->node_set->nodeNr ; ++j) {
+    if (!contains(tuple, other->node_set->nodeTab[j]))
+      xmlXPathNodeSetAddUnique(new, other->node_set->nodeTab[j]);
+  }
 
+  order(new, document_order);
   return Nokogiri_wrap_xml_node_set(new, rb_iv_get(self, "@document"));
 }
 
 /*
  * call-seq:
  *  -(node_set)
+ *  difference(node_set, document_order = false)
  *
  *  Difference - returns a new NodeSet that is a copy of this NodeSet, removing
- *  each item that also appears in +node_set+
+ *  each item that also appears in +node_set+.  The nodes are in the order of
+ *  this NodeSet unless +document_order+ is true.
  */
-static VALUE minus(VALUE self, VALUE rb_other)
+static VALUE minus(int argc, VALUE *argv, VALUE self)
 {
+  VALUE rb_other, document_order;
   nokogiriNodeSetTuple *tuple, *other;
   xmlNodeSetPtr new;
   int j ;
 
+  rb_scan_args(argc, argv, "11", &rb_other, &document_order);
+
   if(!rb_obj_is_kind_of(rb_other, cNokogiriXmlNodeSet))
     rb_raise(rb_eArgError, "node_set must be a Nokogiri::XML::NodeSet");
 
   Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
   Data_Get_Struct(rb_other, nokogiriNodeSetTuple, other);
 
-  new = xmlXPathNodeSetMerge(NULL, tuple->node_set);
-  for (j = 0 ; j < other->node_set->nodeNr ; ++j) {
-    xmlXPathNodeSetDel(new, other->node_set->nodeTab[j]);
+  new = xmlXPathNodeSetCreate(NULL);
+  for (j = 0 ; j < tuple->node_set->nodeNr ; ++j) {
+    if (!contains(other, tuple->node_set->nodeTab[j]))
+      xmlXPathNodeSetAddUnique(new, tuple->node_set->nodeTab[j]);
   }
 
+  order(new, document_order);
   return Nokogiri_wrap_xml_node_set(new, rb_iv_get(self, "@document"));
 }
 
 
+/* Wrap +node+, a member of this NodeSet, as a Node or Namespace */
+static VALUE member(VALUE self, xmlNodePtr node)
+{
+  if (XML_NAMESPACE_DECL == node->type)
+    return Nokogiri_wrap_xml_namespace2(rb_iv_get(self, "@document"), (xmlNsPtr)node);
+  return Nokogiri_wrap_xml_node(Qnil, node);
+}
+
 static VALUE index_at(VALUE self, long offset)
 {
   xmlNodeSetPtr node_set;
@@ -191,9 +284,7 @@ static VALUE index_at(VALUE self, long offset)
   if (offset < 0)
     offset += node_set->nodeNr;
 
-  if (XML_NAMESPACE_DECL == node_set->nodeTab[offset]->type)
-    return Nokogiri_wrap_xml_namespace2(rb_iv_get(self, "@document"), (xmlNsPtr)(node_set->nodeTab[offset]));
-  return Nokogiri_wrap_xml_node(Qnil, node_set->nodeTab[offset]);
+  return member(self, node_set->nodeTab[offset]);
 }
 
 static VALUE subseq(VALUE self, long beg, long len)
@@ -285,7 +376,6 @@ static VALUE slice(int argc, VALUE *argv, VALUE self)
 static VALUE to_array(VALUE self, VALUE rb_node)
 {
   xmlNodeSetPtr set;
-  VALUE *elts;
   VALUE list;
   int i;
   nokogiriNodeSetTuple *tuple;
@@ -293,18 +383,157 @@ static VALUE to_array(VALUE self, VALUE rb_node)
   Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
   set = tuple->node_set;
 
-  elts = calloc((size_t)set->nodeNr, sizeof(VALUE *));
+  /* Nodes are only kept alive by a reference, so push them as we go */
+  list = rb_ary_new2((long)set->nodeNr);
   for(i = 0; i < set->nodeNr; i++) {
-    if (XML_NAMESPACE_DECL == set->nodeTab[i]->type)
-      elts[i] = Nokogiri_wrap_xml_namespace2(rb_iv_get(self, "@document"), (xmlNsPtr)(set->nodeTab[i]));
-    else
-      elts[i] = Nokogiri_wrap_xml_node(Qnil, set->nodeTab[i]);
+    rb_ary_push(list, member(self, set->nodeTab[i]));
   }
 
-  list = rb_ary_new4((long)set->nodeNr, elts);
+  return list;
+}
+
+/*
+ * call-seq:
+ *  each { |node| ... }
+ *
+ * Iterate over each node in this NodeSet, yielding it to the block.  The
+ * block may add or delete nodes while the NodeSet is iterated.
+ */
+static VALUE each(VALUE self)
+{
+  nokogiriNodeSetTuple *tuple;
+  int i;
+
+  RETURN_ENUMERATOR(self, 0, 0);
 
-  /*free(elts); */
+  Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
+  for(i = 0; i < tuple->node_set->nodeNr; i++) {
+    rb_yield(member(self, tuple->node_set->nodeTab[i]));
+  }
+  return self;
+}
 
+/*
+ * call-seq:
+ *  map { |node| ... }
+ *
+ * Returns an Array of the results of yielding each node to the block.
+ */
+static VALUE map(VALUE self)
+{
+  nokogiriNodeSetTuple *tuple;
+  VALUE list;
+  int i;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
+  list = rb_ary_new2((long)tuple->node_set->nodeNr);
+  for(i = 0; i < tuple->node_set->nodeNr; i++) {
+    rb_ary_push(list, rb_yield(member(self, tuple->node_set->nodeTab[i])));
+  }
+  return list;
+}
+
+/*
+ * call-seq:
+ *  pluck(name)
+ *
+ * Returns an Array of the value of attribute +name+ on each node, or nil
+ * for nodes without that attribute.  Equivalent to
+ * <tt>map { |node| node[name] }</tt>, without creating a Node object per
+ * node.
+ */
+static VALUE pluck(VALUE self, VALUE name)
+{
+  nokogiriNodeSetTuple *tuple;
+  xmlNodePtr node;
+  xmlChar *value;
+  VALUE list;
+  int i;
+
+  Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
+  name = rb_obj_as_string(name);
+
+  list = rb_ary_new2((long)tuple->node_set->nodeNr);
+  for(i = 0; i < tuple->node_set->nodeNr; i++) {
+    node = tuple->node_set->nodeTab[i];
+    value = NULL;
+    if (XML_NAMESPACE_DECL != node->type)
+      value = xmlGetProp(node, (xmlChar *)StringValuePtr(name));
+
+    rb_ary_push(list, RBSTR_OR_QNIL(value));
+    if (value) xmlFree(value);
+  }
+  return list;
+}
+
+/*
+ * call-seq:
+ *  texts
+ *
+ * Returns an Array of the text content of each node.  Equivalent to
+ * <tt>map { |node| node.text }</tt>, without creating a Node object per
+ * node.
+ */
+static VALUE texts(VALUE self)
+{
+  nokogiriNodeSetTuple *tuple;
+  xmlNodePtr node;
+  xmlChar *content;
+  VALUE list;
+  int i;
+
+  Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
+
+  list = rb_ary_new2((long)tuple->node_set->nodeNr);
+  for(i = 0; i < tuple->node_set->nodeNr; i++) {
+    node = tuple->node_set->nodeTab[i];
+    content = NULL;
+    if (XML_NAMESPACE_DECL != node->type)
+      content = xmlNodeGetContent(node);
+
+    rb_ary_push(list, RBSTR_OR_QNIL(content));
+    if (content) xmlFree(content);
+  }
+  return list;
+}
+
+/*
+ * call-seq:
+ *  names
+ *
+ * Returns an Array of the name of each node.  Equivalent to
+ * <tt>map { |node| node.name }</tt>, without creating a Node object per
+ * node.
+ */
+static VALUE names(VALUE self)
+{
+  nokogiriNodeSetTuple *tuple;
+  xmlNodePtr node;
+  VALUE list;
+  int i;
+
+  Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
+
+  list = rb_ary_new2((long)tuple->node_set->nodeNr);
+  for(i = 0; i < tuple->node_set->nodeNr; i++) {
+    node = tuple->node_set->nodeTab[i];
+    switch (node->type) {
+      case XML_NAMESPACE_DECL:
+        rb_ary_push(list, Qnil);
+        break;
+      /* Their Node#name is defined in Ruby */
+      case XML_DOCUMENT_NODE:
+      case XML_HTML_DOCUMENT_NODE:
+      case XML_DOCUMENT_FRAG_NODE:
+      case XML_CDATA_SECTION_NODE:
+        rb_ary_push(list, rb_funcall(member(self, node), id_name, 0));
+        break;
+      default:
+        rb_ary_push(list, RBSTR_OR_QNIL(node->name));
+    }
+  }
   return list;
 }
 
@@ -321,6 +550,7 @@ static VALUE unlink_nodeset(VALUE self)
   nokogiriNodeSetTuple *tuple;
 
   Data_Get_Struct(self, nokogiriNodeSetTuple, tuple);
+  drop_index(tuple);
   node_set = tuple->node_set;
   nodeNr = node_set->nodeNr ;
   for (j = 0 ; j < nodeNr ; j++) {
@@ -389,6 +619,7 @@ static void deallocate(nokogiriNodeSetTuple *tuple)
 
   xmlFree(node_set);
   st_free_table(tuple->namespaces);
+  if (tuple->index) st_free_table(tuple->index);
   free(tuple);
   NOKOGIRI_DEBUG_END(node_set) ;
 }
@@ -410,6 +641,7 @@ VALUE Nokogiri_wrap_xml_node_set(xmlNodeSetPtr node_set, VALUE document)
 
   tuple->node_set = node_set;
   tuple->namespaces = st_init_numtable();
+  tuple->index = NULL;
 
   if (!NIL_P(document)) {
     rb_iv_set(new_set, "@document", document);
@@ -440,14 +672,21 @@ void init_xml_node_set(void)
   rb_define_method(klass, "[]", slice, -1);
   rb_define_method(klass, "slice", slice, -1);
   rb_define_method(klass, "push", push, 1);
-  rb_define_method(klass, "|", set_union, 1);
-  rb_define_method(klass, "-", minus, 1);
+  rb_define_method(klass, "|", set_union, -1);
+  rb_define_method(klass, "-", minus, -1);
   rb_define_method(klass, "unlink", unlink_nodeset, 0);
   rb_define_method(klass, "to_a", to_array, 0);
+  rb_define_method(klass, "each", each, 0);
+  rb_define_method(klass, "map", map, 0);
+  rb_define_method(klass, "collect", map, 0);
+  rb_define_method(klass, "pluck", pluck, 1);
+  rb_define_method(klass, "texts", texts, 0);
+  rb_define_method(klass, "names", names, 0);
   rb_define_method(klass, "dup", duplicate, 0);
   rb_define_method(klass, "delete", delete, 1);
-  rb_define_method(klass, "&", intersection, 1);
+  rb_define_method(klass, "&", intersection, -1);
   rb_define_method(klass, "include?", include_eh, 1);
 
   decorate      = rb_intern("decorate");
+  id_name       = rb_intern("name");
 }
@@ -10,5 +10,6 @@ VALUE Nokogiri_wrap_xml_node_set(xmlNodeSetPtr node_set, VALUE document) ;
 typedef struct _nokogiriNodeSetTuple {
   xmlNodeSetPtr node_set;
   st_table     *namespaces;
+  st_table     *index;
 } nokogiriNodeSetTuple;
 #endif
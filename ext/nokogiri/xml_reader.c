@@ -1,5 +1,7 @@
 #include <xml_reader.h>
 
+static ID id_mapped_file, id_io_reader, id_match, id_document, id_names;
+
 static void dealloc(xmlTextReaderPtr reader)
 {
   NOKOGIRI_DEBUG_START(reader);
@@ -149,6 +151,49 @@ static VALUE namespaces(VALUE self)
   return attr ;
 }
 
+/*
+ * call-seq:
+ *   attributes
+ *
+ * Get a hash of the attributes and namespace definitions on this Node,
+ * keyed by attribute name and by "xmlns" or "xmlns:prefix".  Unlike
+ * attribute_nodes, no Attr is created.
+ */
+static VALUE attributes(VALUE self)
+{
+  xmlTextReaderPtr reader;
+  xmlNodePtr node;
+  xmlAttrPtr prop;
+  xmlChar *content;
+  VALUE attr, value;
+
+  Data_Get_Struct(self, xmlTextReader, reader);
+
+  attr = rb_hash_new();
+
+  if (! has_attributes(reader))
+    return attr;
+
+  node = xmlTextReaderCurrentNode(reader);
+
+  for (prop = node->properties; prop != NULL; prop = prop->next) {
+    if (prop->children && prop->children->next == NULL &&
+        prop->children->type == XML_TEXT_NODE) {
+      /* the usual case, a single text child, needs no copy */
+      value = RBSTR_OR_QNIL(prop->children->content);
+    } else {
+      content = xmlNodeGetContent((xmlNodePtr)prop);
+      value = content ? NOKOGIRI_STR_NEW2(content) : NOKOGIRI_STR_NEW2("");
+      xmlFree(content);
+    }
+    rb_hash_aset(attr, NOKOGIRI_STR_NEW2(prop->name), value);
+  }
+
+  Nokogiri_xml_node_namespaces(node, attr);
+
+  return attr;
+}
+
 /*
  * call-seq:
  *   attribute_nodes
@@ -448,29 +493,71 @@ static VALUE node_type(VALUE self)
   return INT2NUM((long)xmlTextReaderNodeType(reader));
 }
 
+/* Which nodes a reader stops at */
+typedef struct {
+  xmlPatternPtr pattern;  /* nodes matching pattern, if set */
+  const xmlChar *name;    /* elements with this qualified or local name */
+  int elements;           /* element start tags only */
+} reader_filter;
+
+static int accepts(xmlTextReaderPtr reader, reader_filter *filter)
+{
+  int type = xmlTextReaderNodeType(reader);
+  const xmlChar *node_name;
+
+  if(filter->elements && type != XML_READER_TYPE_ELEMENT) return 0;
+  if(type == XML_READER_TYPE_END_ELEMENT || type == XML_READER_TYPE_END_ENTITY)
+    return 0;
+
+  if(filter->pattern)
+    return xmlPatternMatch(filter->pattern, xmlTextReaderCurrentNode(reader)) == 1;
+
+  if(filter->name) {
+    node_name = xmlTextReaderConstName(reader);
+    if(node_name && xmlStrEqual(node_name, filter->name)) return 1;
+    node_name = xmlTextReaderConstLocalName(reader);
+    return node_name && xmlStrEqual(node_name, filter->name);
+  }
+
+  return 1;
+}
+
 /*
- * call-seq:
- *   read
- *
- * Move the Reader forward through the XML document.
+ * Move +reader+ with +step+, then read on until a node that +filter+
+ * accepts, if there is a filter.  Errors are collected in the reader's
+ * errors.  Returns 1, or 0 at the end of the document, and raises on
+ * failure.
  */
-static VALUE read_more(VALUE self)
+/* Raise an exception that ended the input of a Reader made with from_io */
+static void check_io_reader(VALUE self)
+{
+  VALUE rb_io_reader = rb_attr_get(self, id_io_reader);
+  nokogiriIOReader *io_reader;
+
+  if(NIL_P(rb_io_reader)) return;
+  Data_Get_Struct(rb_io_reader, nokogiriIOReader, io_reader);
+  Nokogiri_io_reader_check(io_reader);
+}
+
+static int reader_step(VALUE self, xmlTextReaderPtr reader,
+                       int (*step)(xmlTextReaderPtr), reader_filter *filter)
 {
-  xmlTextReaderPtr reader;
   xmlErrorPtr error;
   VALUE error_list;
   int ret;
 
-  Data_Get_Struct(self, xmlTextReader, reader);
-
   error_list = rb_funcall(self, rb_intern("errors"), 0);
 
   xmlSetStructuredErrorFunc((void *)error_list, Nokogiri_error_array_pusher);
-  ret = xmlTextReaderRead(reader);
+  ret = step(reader);
+  if(filter) {
+    while(ret == 1 && !accepts(reader, filter))
+      ret = xmlTextReaderRead(reader);
+  }
   xmlSetStructuredErrorFunc(NULL, NULL);
+  check_io_reader(self);
 
-  if(ret == 1) return self;
-  if(ret == 0) return Qnil;
+  if(ret >= 0) return ret;
 
   error = xmlGetLastError();
   if(error)
@@ -478,9 +565,375 @@ static VALUE read_more(VALUE self)
   else
     rb_raise(rb_eRuntimeError, "Error pulling: %d", ret);
 
+  return ret;
+}
+
+/* The pattern set with Reader#match, or NULL */
+static xmlPatternPtr match_pattern(VALUE self)
+{
+  VALUE rb_pattern = rb_attr_get(self, id_match);
+  xmlPatternPtr pattern;
+
+  if(NIL_P(rb_pattern)) return NULL;
+  Data_Get_Struct(rb_pattern, xmlPattern, pattern);
+  return pattern;
+}
+
+/*
+ * call-seq:
+ *   read
+ *
+ * Move the Reader forward through the XML document.  If a pattern has
+ * been set with #match, move to the next node that matches it.
+ */
+static VALUE read_more(VALUE self)
+{
+  xmlTextReaderPtr reader;
+  reader_filter filter;
+
+  Data_Get_Struct(self, xmlTextReader, reader);
+
+  filter.pattern = match_pattern(self);
+  filter.name = NULL;
+  filter.elements = 0;
+
+  if(reader_step(self, reader, xmlTextReaderRead,
+        filter.pattern ? &filter : NULL))
+    return self;
   return Qnil;
 }
 
+static int mark_name(st_data_t key, st_data_t value, st_data_t arg)
+{
+  rb_gc_mark((VALUE)value);
+  return ST_CONTINUE;
+}
+
+static int free_name(st_data_t key, st_data_t value, st_data_t arg)
+{
+  xmlFree((xmlChar *)key);
+  return ST_CONTINUE;
+}
+
+static void mark_names(st_table *names)
+{
+  st_foreach(names, mark_name, 0);
+}
+
+static void free_names(st_table *names)
+{
+  st_foreach(names, free_name, 0);
+  st_free_table(names);
+}
+
+/*
+ * The frozen String for +name+, shared by every record this reader
+ * returns.
+ */
+static VALUE record_name(VALUE self, const xmlChar *name)
+{
+  VALUE rb_names = rb_attr_get(self, id_names);
+  st_table *names;
+  st_data_t value;
+  VALUE string;
+
+  if(name == NULL) return Qnil;
+
+  if(NIL_P(rb_names)) {
+    names = st_init_strtable();
+    rb_names = Data_Wrap_Struct(0, mark_names, free_names, names);
+    rb_ivar_set(self, id_names, rb_names);
+  }
+  Data_Get_Struct(rb_names, st_table, names);
+
+  if(st_lookup(names, (st_data_t)name, &value))
+    return (VALUE)value;
+
+  string = rb_obj_freeze(NOKOGIRI_STR_NEW2(name));
+  st_insert(names, (st_data_t)xmlStrdup(name), (st_data_t)string);
+  return string;
+}
+
+/*
+ * call-seq:
+ *   read_record
+ *
+ * Move the Reader forward like #read, and return the node as a frozen
+ * Array of
+ *
+ *   [node_type, name, depth, value, attributes?, empty_element?]
+ *
+ * or nil at the end of the document.  Names are frozen Strings, one per
+ * distinct name for the life of the reader.
+ */
+static VALUE read_record(VALUE self)
+{
+  xmlTextReaderPtr reader;
+  reader_filter filter;
+  const xmlChar *value;
+  VALUE record;
+
+  Data_Get_Struct(self, xmlTextReader, reader);
+
+  filter.pattern = match_pattern(self);
+  filter.name = NULL;
+  filter.elements = 0;
+
+  if(!reader_step(self, reader, xmlTextReaderRead,
+        filter.pattern ? &filter : NULL))
+    return Qnil;
+
+  value = xmlTextReaderConstValue(reader);
+  record = rb_ary_new3(6,
+      INT2NUM(xmlTextReaderNodeType(reader)),
+      record_name(self, xmlTextReaderConstName(reader)),
+      INT2NUM(xmlTextReaderDepth(reader)),
+      value ? NOKOGIRI_STR_NEW2(value) : Qnil,
+      has_attributes(reader) ? Qtrue : Qfalse,
+      xmlTextReaderIsEmptyElement(reader) == 1 ? Qtrue : Qfalse);
+
+  return rb_obj_freeze(record);
+}
+
+/*
+ * call-seq:
+ *   each_record { |record| ... }
+ *
+ * Yield #read_record for each remaining node.
+ */
+static VALUE each_record(VALUE self)
+{
+  VALUE record;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  while(!NIL_P(record = read_record(self)))
+    rb_yield(record);
+
+  return self;
+}
+
+/*
+ * Fill +ns+, with room for 2 * RARRAY_LEN(pairs) + 2 entries, with the
+ * [prefix, href] +pairs+ of a namespace Hash in the NULL terminated
+ * href, prefix order that libxml2 patterns take.
+ */
+static const xmlChar **pattern_namespaces(VALUE pairs, const xmlChar **ns)
+{
+  long i, n = RARRAY_LEN(pairs);
+
+  for(i = 0; i < n; i++) {
+    VALUE pair = rb_ary_entry(pairs, i);
+    VALUE prefix = rb_ary_entry(pair, 0);
+    VALUE href = rb_ary_entry(pair, 1);
+
+    ns[2 * i] = (const xmlChar *)StringValueCStr(href);
+    ns[2 * i + 1] = NIL_P(prefix) ? NULL :
+      (const xmlChar *)StringValueCStr(prefix);
+  }
+  ns[2 * n] = NULL;
+  ns[2 * n + 1] = NULL;
+  return ns;
+}
+
+#define NAMESPACE_PAIRS(namespaces) \
+  (NIL_P(namespaces) ? rb_ary_new() : rb_funcall(namespaces, rb_intern("to_a"), 0))
+
+#define PATTERN_NAMESPACES(pairs) \
+  pattern_namespaces((pairs), ALLOCA_N(const xmlChar *, 2 * RARRAY_LEN(pairs) + 2))
+
+/*
+ * Compile +pattern+, a streamable XPath subset such as "/feed/entry" or
+ * "entry//link", with the prefixes in the Hash +namespaces+.
+ */
+static xmlPatternPtr compile_pattern(VALUE pattern, VALUE namespaces)
+{
+  VALUE pairs = NAMESPACE_PAIRS(namespaces);
+  xmlPatternPtr compiled;
+
+  StringValue(pattern);
+  compiled = xmlPatterncompile((const xmlChar *)StringValueCStr(pattern),
+      NULL, XML_PATTERN_DEFAULT, PATTERN_NAMESPACES(pairs));
+  RB_GC_GUARD(pairs);
+
+  if(compiled == NULL)
+    rb_raise(rb_eArgError, "invalid pattern: %s", StringValueCStr(pattern));
+  return compiled;
+}
+
+static void dealloc_pattern(xmlPatternPtr pattern)
+{
+  NOKOGIRI_DEBUG_START(pattern);
+  xmlFreePattern(pattern);
+  NOKOGIRI_DEBUG_END(pattern);
+}
+
+/*
+ * call-seq:
+ *   match(pattern, namespaces = {})
+ *
+ * Make #read, and so #each, skip every node that does not match
+ * +pattern+ natively.  +pattern+ is the streamable XPath subset that
+ * libxml2 supports, e.g. "/feed/entry/link", "entry//a:link" or
+ * "entry | item"; prefixes are bound in +namespaces+, a Hash of prefix
+ * to URI.  End tags never match.  Returns self.
+ */
+static VALUE match(int argc, VALUE *argv, VALUE self)
+{
+  VALUE pattern, namespaces;
+  xmlPatternPtr compiled;
+
+  rb_scan_args(argc, argv, "11", &pattern, &namespaces);
+
+  compiled = compile_pattern(pattern, namespaces);
+  rb_ivar_set(self, id_match,
+      Data_Wrap_Struct(0, NULL, dealloc_pattern, compiled));
+  return self;
+}
+
+/*
+ * call-seq:
+ *   preserve(pattern, namespaces = {})
+ *
+ * Keep the subtrees that match +pattern+ once the reader has moved past
+ * them, instead of freeing them.  After reading, #document returns them.
+ * See #match for the syntax of +pattern+.  Returns self.
+ */
+static VALUE preserve(int argc, VALUE *argv, VALUE self)
+{
+  VALUE pattern, namespaces, pairs;
+  xmlTextReaderPtr reader;
+
+  rb_scan_args(argc, argv, "11", &pattern, &namespaces);
+  Data_Get_Struct(self, xmlTextReader, reader);
+
+  /* Validate it the same way as #match */
+  xmlFreePattern(compile_pattern(pattern, namespaces));
+
+  pairs = NAMESPACE_PAIRS(namespaces);
+  if(xmlTextReaderPreservePattern(reader,
+        (const xmlChar *)StringValueCStr(pattern), PATTERN_NAMESPACES(pairs)) < 0)
+    rb_raise(rb_eRuntimeError, "Could not preserve %s", StringValueCStr(pattern));
+  RB_GC_GUARD(pairs);
+
+  return self;
+}
+
+/* Forget wrappers made before the document had a Ruby object */
+static void forget_wrappers(xmlNodePtr node)
+{
+  for(; node; node = node->next) {
+    node->_private = NULL;
+    if(node->type == XML_ELEMENT_NODE)
+      forget_wrappers((xmlNodePtr)node->properties);
+    forget_wrappers(node->children);
+  }
+}
+
+/*
+ * call-seq:
+ *   document
+ *
+ * The Document the reader has built, with the subtrees kept by
+ * #preserve.  From then on the reader frees nothing, so call this once
+ * reading is done.
+ */
+static VALUE reader_document(VALUE self)
+{
+  xmlTextReaderPtr reader;
+  xmlDocPtr doc;
+  VALUE rb_doc = rb_attr_get(self, id_document);
+
+  if(!NIL_P(rb_doc)) return rb_doc;
+
+  Data_Get_Struct(self, xmlTextReader, reader);
+
+  doc = xmlTextReaderCurrentDoc(reader);
+  if(doc == NULL) return Qnil;
+
+  forget_wrappers(doc->children);
+  rb_doc = Nokogiri_wrap_xml_document(cNokogiriXmlDocument, doc);
+  /* The reader may still add to the document, so they live together */
+  rb_ivar_set(self, id_document, rb_doc);
+  return rb_doc;
+}
+
+/*
+ * Copy the expanded subtree at +node+ into a Document of its own.
+ */
+static VALUE subtree_document(xmlNodePtr node)
+{
+  xmlDocPtr source = node->doc;
+  xmlDocPtr doc;
+  xmlNodePtr root;
+
+  doc = xmlNewDoc(source && source->version ? source->version : BAD_CAST "1.0");
+  if(source && source->encoding) doc->encoding = xmlStrdup(source->encoding);
+  if(source && source->URL) doc->URL = xmlStrdup(source->URL);
+
+  root = xmlDocCopyNode(node, doc, 1);
+  if(root == NULL) {
+    xmlFreeDoc(doc);
+    rb_raise(rb_eRuntimeError, "Could not copy the subtree");
+  }
+  xmlDocSetRootElement(doc, root);
+
+  Nokogiri_wrap_xml_document(cNokogiriXmlDocument, doc);
+  return Nokogiri_wrap_xml_node(Qnil, root);
+}
+
+/* xmlTextReaderExpand as a reader_step */
+static int expand(xmlTextReaderPtr reader)
+{
+  return xmlTextReaderExpand(reader) ? 1 : -1;
+}
+
+/*
+ * call-seq:
+ *   each_subtree(name = nil) { |node| ... }
+ *
+ * Move the cursor through the document and yield each element named
+ * +name+, matched by qualified or local name, or each element matching
+ * the #match pattern if +name+ is nil.  Each one is yielded as an
+ * Element in a Document of its own, so it can be searched with xpath and
+ * css.  The subtree is expanded in the reader, copied, and skipped, so
+ * the reader frees it before moving on and memory use does not grow with
+ * the size of the document.
+ */
+static VALUE each_subtree(int argc, VALUE *argv, VALUE self)
+{
+  xmlTextReaderPtr reader;
+  reader_filter filter;
+  VALUE name;
+  int ret;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+  rb_scan_args(argc, argv, "01", &name);
+
+  Data_Get_Struct(self, xmlTextReader, reader);
+
+  filter.elements = 1;
+  filter.name = NULL;
+  filter.pattern = NULL;
+  if(NIL_P(name)) {
+    filter.pattern = match_pattern(self);
+    if(!filter.pattern)
+      rb_raise(rb_eArgError, "a name or a #match pattern is required");
+  } else {
+    filter.name = (const xmlChar *)StringValueCStr(name);
+  }
+
+  ret = reader_step(self, reader, xmlTextReaderRead, &filter);
+  while(ret == 1) {
+    reader_step(self, reader, expand, NULL);
+    rb_yield(subtree_document(xmlTextReaderExpand(reader)));
+    ret = reader_step(self, reader, xmlTextReaderNext, &filter);
+  }
+
+  RB_GC_GUARD(name);
+  return self;
+}
+
 /*
  * call-seq:
  *   inner_xml
@@ -583,7 +1036,8 @@ static VALUE from_memory(int argc, VALUE *argv, VALUE klass)
  */
 static VALUE from_io(int argc, VALUE *argv, VALUE klass)
 {
-  VALUE rb_io, rb_url, encoding, rb_options;
+  VALUE rb_io, rb_url, encoding, rb_options, rb_io_reader;
+  nokogiriIOReader *io_reader;
   xmlTextReaderPtr reader;
   const char * c_url      = NULL;
   const char * c_encoding = NULL;
@@ -597,10 +1051,12 @@ static VALUE from_io(int argc, VALUE *argv, VALUE klass)
   if (RTEST(encoding)) c_encoding = StringValuePtr(encoding);
   if (RTEST(rb_options)) c_options = (int)NUM2INT(rb_options);
 
+  rb_io_reader = Nokogiri_io_reader(rb_io, &io_reader);
+
   reader = xmlReaderForIO(
-      (xmlInputReadCallback)io_read_callback,
+      (xmlInputReadCallback)io_reader_read_callback,
       (xmlInputCloseCallback)io_close_callback,
-      (void *)rb_io,
+      (void *)io_reader,
       c_url,
       c_encoding,
       c_options
@@ -612,6 +1068,9 @@ static VALUE from_io(int argc, VALUE *argv, VALUE klass)
   }
 
   rb_reader = Data_Wrap_Struct(klass, NULL, dealloc, reader);
+  /* Hidden from Ruby; keeps the buffered input alive as long as the reader */
+  rb_ivar_set(rb_reader, id_io_reader, rb_io_reader);
+
   args[0] = rb_io;
   args[1] = rb_url;
   args[2] = encoding;
@@ -620,6 +1079,60 @@ static VALUE from_io(int argc, VALUE *argv, VALUE klass)
   return rb_reader;
 }
 
+/*
+ * call-seq:
+ *   from_file(path, url = nil, encoding = nil, options = 0)
+ *
+ * Create a new reader that parses the file at +path+.  The file is mapped
+ * into memory for as long as the reader exists, and read from the mapping
+ * without creating a Ruby String.  +url+ defaults to +path+.
+ */
+static VALUE from_file(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE rb_path, rb_url, encoding, rb_options, rb_file;
+  nokogiriMappedFile *file;
+  xmlTextReaderPtr reader;
+  const char * c_url      = NULL;
+  const char * c_encoding = NULL;
+  int c_options           = 0;
+  VALUE rb_reader, args[3];
+
+  rb_scan_args(argc, argv, "13", &rb_path, &rb_url, &encoding, &rb_options);
+
+  if (!RTEST(rb_path)) rb_raise(rb_eArgError, "path cannot be nil");
+  rb_path = rb_str_new_frozen(FilePathValue(rb_path));
+  c_url = RTEST(rb_url) ? StringValuePtr(rb_url) : StringValueCStr(rb_path);
+  if (RTEST(encoding)) c_encoding = StringValuePtr(encoding);
+  if (RTEST(rb_options)) c_options = (int)NUM2INT(rb_options);
+
+  rb_file = Nokogiri_map_file(rb_path, &file);
+
+  reader = xmlReaderForIO(
+      (xmlInputReadCallback)mapped_file_read_callback,
+      (xmlInputCloseCallback)io_close_callback,
+      (void *)file,
+      c_url,
+      c_encoding,
+      c_options
+  );
+
+  if(reader == NULL) {
+    xmlFreeTextReader(reader);
+    rb_raise(rb_eRuntimeError, "couldn't create a parser");
+  }
+
+  rb_reader = Data_Wrap_Struct(klass, NULL, dealloc, reader);
+  /* Hidden from Ruby; keeps the mapping alive as long as the reader */
+  rb_ivar_set(rb_reader, id_mapped_file, rb_file);
+
+  args[0] = rb_path;
+  args[1] = rb_url;
+  args[2] = encoding;
+  rb_obj_call_init(rb_reader, 3, args);
+
+  return rb_reader;
+}
+
 /*
  * call-seq:
  *   reader.empty_element? # => true or false
@@ -656,8 +1169,15 @@ void init_xml_reader()
 
   rb_define_singleton_method(klass, "from_memory", from_memory, -1);
   rb_define_singleton_method(klass, "from_io", from_io, -1);
+  rb_define_singleton_method(klass, "from_file", from_file, -1);
 
   rb_define_method(klass, "read", read_more, 0);
+  rb_define_method(klass, "read_record", read_record, 0);
+  rb_define_method(klass, "each_record", each_record, 0);
+  rb_define_method(klass, "each_subtree", each_subtree, -1);
+  rb_define_method(klass, "match", match, -1);
+  rb_define_method(klass, "preserve", preserve, -1);
+  rb_define_method(klass, "document", reader_document, 0);
   rb_define_method(klass, "inner_xml", inner_xml, 0);
   rb_define_method(klass, "outer_xml", outer_xml, 0);
   rb_define_method(klass, "state", state, 0);
@@ -673,6 +1193,7 @@ void init_xml_reader()
   rb_define_method(klass, "attribute_count", attribute_count, 0);
   rb_define_method(klass, "attribute", reader_attribute, 1);
   rb_define_method(klass, "namespaces", namespaces, 0);
+  rb_define_method(klass, "attributes", attributes, 0);
   rb_define_method(klass, "attribute_at", attribute_at, 1);
   rb_define_method(klass, "empty_element?", empty_element_p, 0);
   rb_define_method(klass, "attributes?", attributes_eh, 0);
@@ -681,4 +1202,10 @@ void init_xml_reader()
   rb_define_method(klass, "base_uri", base_uri, 0);
 
   rb_define_private_method(klass, "attr_nodes", attribute_nodes, 0);
+
+  id_mapped_file = rb_intern("mapped_file");
+  id_io_reader = rb_intern("io_reader");
+  id_match = rb_intern("match");
+  id_document = rb_intern("document");
+  id_names = rb_intern("names");
 }
@@ -8,17 +8,227 @@ static ID id_start_element_namespace, id_end_element_namespace;
 static ID id_comment, id_characters, id_xmldecl, id_error, id_warning;
 static ID id_cdata_block, id_cAttribute;
 
+static ID id_owner, id_events;
+
 #define STRING_OR_NULL(str) \
    (RTEST(str) ? StringValuePtr(str) : NULL)
 
+#define SAX_XMLDECL           (1 << 0)
+#define SAX_START_DOCUMENT    (1 << 1)
+#define SAX_END_DOCUMENT      (1 << 2)
+#define SAX_START_ELEMENT     (1 << 3)
+#define SAX_END_ELEMENT       (1 << 4)
+#define SAX_START_ELEMENT_NS  (1 << 5)
+#define SAX_END_ELEMENT_NS    (1 << 6)
+#define SAX_CHARACTERS        (1 << 7)
+#define SAX_COMMENT           (1 << 8)
+#define SAX_WARNING           (1 << 9)
+#define SAX_ERROR             (1 << 10)
+#define SAX_CDATA_BLOCK       (1 << 11)
+#define SAX_ALL               ((1 << 12) - 1)
+
+#define SAX_TUPLE(_ctxt)  ((nokogiriSAXTuplePtr)(_ctxt))
+#define SAX_HANDLES(_ctxt, _event) (SAX_TUPLE(_ctxt)->events & (_event))
+#define SAX_LEAN(_ctxt)   RTEST(SAX_TUPLE(_ctxt)->lean)
+
+/*
+ * The Ruby String for +name+.  In lean mode names are frozen and shared
+ * for the rest of the parse.
+ */
+static VALUE name_string(void * ctx, const xmlChar * name)
+{
+  nokogiriSAXTuplePtr tuple = SAX_TUPLE(ctx);
+  st_data_t value;
+  VALUE string;
+
+  if(name == NULL) return Qnil;
+  if(!RTEST(tuple->lean)) return NOKOGIRI_STR_NEW2(name);
+
+  if(st_lookup(tuple->names, (st_data_t)name, &value))
+    return (VALUE)value;
+
+  string = rb_obj_freeze(NOKOGIRI_STR_NEW2(name));
+  st_insert(tuple->names, (st_data_t)xmlStrdup(name), (st_data_t)string);
+  return string;
+}
+
+/* The name_string of +prefix+:+localname+ */
+static VALUE qname_string(void * ctx, const xmlChar * prefix,
+    const xmlChar * localname)
+{
+  xmlChar buffer[64];
+  xmlChar * qname = xmlBuildQName(localname, prefix, buffer, (int)sizeof(buffer));
+  VALUE string = name_string(ctx, qname);
+
+  if(qname != buffer && qname != localname) xmlFree(qname);
+  return string;
+}
+
+/*
+ * Send +event+ with +argc+ arguments to the document, or add it to the
+ * current batch when events are batched.
+ */
+static void sax_call(void * ctx, ID event, int argc, ...)
+{
+  nokogiriSAXTuplePtr tuple = SAX_TUPLE(ctx);
+  VALUE argv[5];
+  va_list args;
+  int i;
+
+  va_start(args, argc);
+  for(i = 0; i < argc; i++) argv[i] = va_arg(args, VALUE);
+  va_end(args);
+
+  if(tuple->batch_limit <= 0) {
+    rb_funcall2(tuple->doc, event, argc, argv);
+    return;
+  }
+
+  rb_ary_push(tuple->batch, ID2SYM(event));
+  for(i = 0; i < argc; i++) rb_ary_push(tuple->batch, argv[i]);
+
+  if(++tuple->batch_length >= tuple->batch_limit)
+    Nokogiri_sax_tuple_flush(tuple);
+}
+
+/*
+ * While Nokogiri_sax_parse_chunk has the GVL released, callbacks append
+ * their arguments to the tuple's journal instead of calling Ruby.  The
+ * journal is replayed through the same callbacks once the GVL is back.
+ * Each entry is an int event type followed by its arguments; a string is
+ * an int length (-1 for NULL) followed by its bytes and a NUL.
+ */
+enum {
+  JOURNAL_START_DOCUMENT,
+  JOURNAL_END_DOCUMENT,
+  JOURNAL_START_ELEMENT,
+  JOURNAL_END_ELEMENT,
+  JOURNAL_START_ELEMENT_NS,
+  JOURNAL_END_ELEMENT_NS,
+  JOURNAL_CHARACTERS,
+  JOURNAL_COMMENT,
+  JOURNAL_WARNING,
+  JOURNAL_ERROR,
+  JOURNAL_CDATA_BLOCK
+};
+
+#define RECORDING(_ctxt) (SAX_TUPLE(_ctxt)->recording)
+
+static void record_bytes(void * ctx, const void * bytes, long len)
+{
+  nokogiriSAXTuplePtr tuple = SAX_TUPLE(ctx);
+
+  if(tuple->journal_failed) return;
+
+  if(tuple->journal_length + len > tuple->journal_capacity) {
+    long capacity = tuple->journal_capacity ? tuple->journal_capacity : 4096;
+    char * journal;
+
+    while(capacity < tuple->journal_length + len) capacity *= 2;
+    journal = realloc(tuple->journal, (size_t)capacity);
+    if(journal == NULL) {
+      tuple->journal_failed = 1;
+      return;
+    }
+    tuple->journal = journal;
+    tuple->journal_capacity = capacity;
+  }
+
+  memcpy(tuple->journal + tuple->journal_length, bytes, (size_t)len);
+  tuple->journal_length += len;
+}
+
+static void record_int(void * ctx, int value)
+{
+  record_bytes(ctx, &value, (long)sizeof(value));
+}
+
+/* Record +len+ bytes of +string+, or all of it if +len+ is -1 */
+static void record_string(void * ctx, const xmlChar * string, int len)
+{
+  if(string == NULL) {
+    record_int(ctx, -1);
+    return;
+  }
+  if(len < 0) len = xmlStrlen(string);
+  record_int(ctx, len);
+  record_bytes(ctx, string, (long)len);
+  record_bytes(ctx, "", 1L);
+}
+
+typedef struct {
+  const char * p;
+} journal_reader;
+
+static int read_int(journal_reader * reader)
+{
+  int value;
+  memcpy(&value, reader->p, sizeof(value));
+  reader->p += sizeof(value);
+  return value;
+}
+
+static const xmlChar * read_string(journal_reader * reader, int * len)
+{
+  const xmlChar * string;
+  int length = read_int(reader);
+
+  if(len) *len = length;
+  if(length < 0) return NULL;
+  string = (const xmlChar *)reader->p;
+  reader->p += length + 1;
+  return string;
+}
+
+/* Scratch space for +count+ pointers of replayed arguments */
+static const xmlChar ** replay_pointers(void * ctx, long count)
+{
+  nokogiriSAXTuplePtr tuple = SAX_TUPLE(ctx);
+
+  if(count > tuple->pointers_capacity) {
+    const xmlChar ** pointers =
+      realloc((void *)tuple->pointers, sizeof(xmlChar *) * (size_t)count);
+    if(pointers == NULL) rb_memerror();
+    tuple->pointers = pointers;
+    tuple->pointers_capacity = count;
+  }
+  return tuple->pointers;
+}
+
+/*
+ * Send the characters coalesced since the last event, unless they are
+ * whitespace to be dropped.
+ */
+static void flush_characters(void * ctx)
+{
+  nokogiriSAXTuplePtr tuple = SAX_TUPLE(ctx);
+  long length = tuple->text_length, i;
+
+  if(length == 0) return;
+  tuple->text_length = 0;
+
+  if(tuple->drop_whitespace) {
+    for(i = 0; i < length; i++) {
+      char c = tuple->text[i];
+      if(c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+    }
+    if(i == length) return;
+  }
+
+  sax_call(ctx, id_characters, 1, NOKOGIRI_STR_NEW(tuple->text, length));
+}
+
 static void start_document(void * ctx)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_START_DOCUMENT);
+    return;
+  }
+
 
   xmlParserCtxtPtr ctxt = NOKOGIRI_SAX_CTXT(ctx);
 
-  if(NULL != ctxt && ctxt->html != 1) {
+  if(NULL != ctxt && ctxt->html != 1 && SAX_HANDLES(ctx, SAX_XMLDECL)) {
     if(ctxt->standalone != -1) {  /* -1 means there was no declaration */
       VALUE encoding = ctxt->encoding ?
         NOKOGIRI_STR_NEW2(ctxt->encoding) :
@@ -40,49 +250,80 @@ static void start_document(void * ctx)
           break;
       }
 
-      rb_funcall(doc, id_xmldecl, 3, version, encoding, standalone);
+      sax_call(ctx, id_xmldecl, 3, version, encoding, standalone);
     }
   }
 
-  rb_funcall(doc, id_start_document, 0);
+  if(SAX_HANDLES(ctx, SAX_START_DOCUMENT))
+    sax_call(ctx, id_start_document, 0);
 }
 
 static void end_document(void * ctx)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
-  rb_funcall(doc, id_end_document, 0);
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_END_DOCUMENT);
+    return;
+  }
+
+  flush_characters(ctx);
+  if(SAX_HANDLES(ctx, SAX_END_DOCUMENT))
+    sax_call(ctx, id_end_document, 0);
+  Nokogiri_sax_tuple_flush(SAX_TUPLE(ctx));
 }
 
 static void start_element(void * ctx, const xmlChar *name, const xmlChar **atts)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
   VALUE attributes = rb_ary_new();
+  int lean = SAX_LEAN(ctx);
   const xmlChar * attr;
   int i = 0;
+
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_START_ELEMENT);
+    record_string(ctx, name, -1);
+    if(atts) while(atts[i] != NULL) i += 2;
+    record_int(ctx, atts ? i : -1);
+    for(i = 0; atts && atts[i] != NULL; i++)
+      record_string(ctx, atts[i], -1);
+    return;
+  }
+
+  flush_characters(ctx);
+  if(!SAX_HANDLES(ctx, SAX_START_ELEMENT)) return;
+
   if(atts) {
     while((attr = atts[i]) != NULL) {
       const xmlChar * val = atts[i+1];
       VALUE value = val != NULL ? NOKOGIRI_STR_NEW2(val) : Qnil;
-      rb_ary_push(attributes, rb_ary_new3(2, NOKOGIRI_STR_NEW2(attr), value));
+      if(lean) {
+        rb_ary_push(attributes, name_string(ctx, attr));
+        rb_ary_push(attributes, value);
+      } else {
+        rb_ary_push(attributes, rb_ary_new3(2, NOKOGIRI_STR_NEW2(attr), value));
+      }
       i+=2;
     }
   }
 
-  rb_funcall( doc,
+  sax_call(   ctx,
               id_start_element,
               2,
-              NOKOGIRI_STR_NEW2(name),
+              name_string(ctx, name),
               attributes
   );
 }
 
 static void end_element(void * ctx, const xmlChar *name)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
-  rb_funcall(doc, id_end_element, 1, NOKOGIRI_STR_NEW2(name));
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_END_ELEMENT);
+    record_string(ctx, name, -1);
+    return;
+  }
+
+  flush_characters(ctx);
+  if(!SAX_HANDLES(ctx, SAX_END_ELEMENT)) return;
+  sax_call(ctx, id_end_element, 1, name_string(ctx, name));
 }
 
 static VALUE attributes_as_list(
@@ -115,6 +356,70 @@ static VALUE attributes_as_list(
   return list;
 }
 
+/*
+ * Lean start_element_ns: attributes are a flat list of localname, prefix,
+ * URI and value, and namespaces a flat list of prefix and URI.  If the
+ * document only handles start_element, it is called directly with the
+ * qualified name and a flat list of names and values.
+ */
+static void
+start_element_ns_lean (
+  void * ctx,
+  const xmlChar * localname,
+  const xmlChar * prefix,
+  const xmlChar * uri,
+  int nb_namespaces,
+  const xmlChar ** namespaces,
+  int nb_attributes,
+  const xmlChar ** attributes)
+{
+  int sax1 = !SAX_HANDLES(ctx, SAX_START_ELEMENT_NS);
+  VALUE attribute_list, ns_list;
+  int i;
+
+  if(sax1) {
+    attribute_list = rb_ary_new2(2L * (nb_namespaces + nb_attributes));
+    ns_list = attribute_list;
+  } else {
+    attribute_list = rb_ary_new2(4L * nb_attributes);
+    ns_list = rb_ary_new2(2L * nb_namespaces);
+  }
+
+  for (i = 0; namespaces && i < nb_namespaces * 2; i += 2) {
+    if(sax1 && namespaces[i + 0]) {
+      rb_ary_push(ns_list, qname_string(ctx, (const xmlChar *)"xmlns",
+            namespaces[i + 0]));
+    } else if(sax1) {
+      rb_ary_push(ns_list, name_string(ctx, (const xmlChar *)"xmlns"));
+    } else {
+      rb_ary_push(ns_list, name_string(ctx, namespaces[i + 0]));
+    }
+    rb_ary_push(ns_list, name_string(ctx, namespaces[i + 1]));
+  }
+
+  for (i = 0; attributes && i < nb_attributes * 5; i += 5) {
+    if(sax1) {
+      rb_ary_push(attribute_list,
+          qname_string(ctx, attributes[i + 1], attributes[i + 0]));
+    } else {
+      rb_ary_push(attribute_list, name_string(ctx, attributes[i + 0]));
+      rb_ary_push(attribute_list, name_string(ctx, attributes[i + 1]));
+      rb_ary_push(attribute_list, name_string(ctx, attributes[i + 2]));
+    }
+    rb_ary_push(attribute_list, NOKOGIRI_STR_NEW((const char*)attributes[i+3],
+          (attributes[i+4] - attributes[i+3])));
+  }
+
+  if(sax1) {
+    sax_call(ctx, id_start_element, 2,
+        qname_string(ctx, prefix, localname), attribute_list);
+  } else {
+    sax_call(ctx, id_start_element_namespace, 5,
+        name_string(ctx, localname), attribute_list,
+        name_string(ctx, prefix), name_string(ctx, uri), ns_list);
+  }
+}
+
 static void
 start_element_ns (
   void * ctx,
@@ -128,11 +433,42 @@ start_element_ns (
   const xmlChar ** attributes)
 {
   VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
+  VALUE attribute_list, ns_list;
 
-  VALUE attribute_list = attributes_as_list(self, nb_attributes, attributes);
+  if(RECORDING(ctx)) {
+    int i;
 
-  VALUE ns_list = rb_ary_new2((long)nb_namespaces);
+    record_int(ctx, JOURNAL_START_ELEMENT_NS);
+    record_string(ctx, localname, -1);
+    record_string(ctx, prefix, -1);
+    record_string(ctx, uri, -1);
+    record_int(ctx, nb_namespaces);
+    for(i = 0; i < nb_namespaces * 2; i++)
+      record_string(ctx, namespaces[i], -1);
+    record_int(ctx, nb_attributes);
+    record_int(ctx, nb_defaulted);
+    for(i = 0; i < nb_attributes * 5; i += 5) {
+      record_string(ctx, attributes[i + 0], -1);
+      record_string(ctx, attributes[i + 1], -1);
+      record_string(ctx, attributes[i + 2], -1);
+      record_string(ctx, attributes[i + 3],
+          (int)(attributes[i + 4] - attributes[i + 3]));
+    }
+    return;
+  }
+
+  flush_characters(ctx);
+  if(!SAX_HANDLES(ctx, SAX_START_ELEMENT_NS | SAX_START_ELEMENT)) return;
+
+  if(SAX_LEAN(ctx)) {
+    start_element_ns_lean(ctx, localname, prefix, uri, nb_namespaces,
+        namespaces, nb_attributes, attributes);
+    return;
+  }
+
+  attribute_list = attributes_as_list(self, nb_attributes, attributes);
+
+  ns_list = rb_ary_new2((long)nb_namespaces);
 
   if (namespaces) {
     int i;
@@ -147,7 +483,7 @@ start_element_ns (
     }
   }
 
-  rb_funcall( doc,
+  sax_call(   ctx,
               id_start_element_namespace,
               5,
               NOKOGIRI_STR_NEW2(localname),
@@ -168,72 +504,449 @@ end_element_ns (
   const xmlChar * prefix,
   const xmlChar * uri)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_END_ELEMENT_NS);
+    record_string(ctx, localname, -1);
+    record_string(ctx, prefix, -1);
+    record_string(ctx, uri, -1);
+    return;
+  }
+
+  flush_characters(ctx);
+
+  if(SAX_LEAN(ctx) && !SAX_HANDLES(ctx, SAX_END_ELEMENT_NS)) {
+    if(SAX_HANDLES(ctx, SAX_END_ELEMENT))
+      sax_call(ctx, id_end_element, 1, qname_string(ctx, prefix, localname));
+    return;
+  }
 
-  rb_funcall(doc, id_end_element_namespace, 3, 
-    NOKOGIRI_STR_NEW2(localname),
-    RBSTR_OR_QNIL(prefix),
-    RBSTR_OR_QNIL(uri)
+  sax_call(ctx, id_end_element_namespace, 3, 
+    name_string(ctx, localname),
+    name_string(ctx, prefix),
+    name_string(ctx, uri)
   );
 }
 
 static void characters_func(void * ctx, const xmlChar * ch, int len)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
-  VALUE str = NOKOGIRI_STR_NEW(ch, len);
-  rb_funcall(doc, id_characters, 1, str);
+  nokogiriSAXTuplePtr tuple = SAX_TUPLE(ctx);
+  VALUE str;
+
+  if(!SAX_HANDLES(ctx, SAX_CHARACTERS)) return;
+
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_CHARACTERS);
+    record_string(ctx, ch, len);
+    return;
+  }
+
+  if(tuple->coalesce) {
+    if(tuple->text_length + len > tuple->text_capacity) {
+      long capacity = tuple->text_capacity ? tuple->text_capacity : 256;
+      char * text;
+
+      while(capacity < tuple->text_length + len) capacity *= 2;
+      text = realloc(tuple->text, (size_t)capacity);
+      if(text == NULL) rb_memerror();
+      tuple->text = text;
+      tuple->text_capacity = capacity;
+    }
+    memcpy(tuple->text + tuple->text_length, ch, (size_t)len);
+    tuple->text_length += len;
+    return;
+  }
+
+  flush_characters(ctx);
+  str = NOKOGIRI_STR_NEW(ch, len);
+  sax_call(ctx, id_characters, 1, str);
 }
 
 static void comment_func(void * ctx, const xmlChar * value)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
-  VALUE str = NOKOGIRI_STR_NEW2(value);
-  rb_funcall(doc, id_comment, 1, str);
+  VALUE str;
+
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_COMMENT);
+    record_string(ctx, value, -1);
+    return;
+  }
+
+  flush_characters(ctx);
+  if(!SAX_HANDLES(ctx, SAX_COMMENT)) return;
+  str = NOKOGIRI_STR_NEW2(value);
+  sax_call(ctx, id_comment, 1, str);
 }
 
 static void warning_func(void * ctx, const char *msg, ...)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
   char * message;
   VALUE ruby_message;
-
   va_list args;
+
+  if(!SAX_HANDLES(ctx, SAX_WARNING)) return;
+
   va_start(args, msg);
   vasprintf(&message, msg, args);
   va_end(args);
 
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_WARNING);
+    record_string(ctx, (const xmlChar *)message, -1);
+    vasprintf_free(message);
+    return;
+  }
+
   ruby_message = NOKOGIRI_STR_NEW2(message);
   vasprintf_free(message);
-  rb_funcall(doc, id_warning, 1, ruby_message);
+  flush_characters(ctx);
+  sax_call(ctx, id_warning, 1, ruby_message);
 }
 
 static void error_func(void * ctx, const char *msg, ...)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
   char * message;
   VALUE ruby_message;
-
   va_list args;
+
+  if(!SAX_HANDLES(ctx, SAX_ERROR)) return;
+
   va_start(args, msg);
   vasprintf(&message, msg, args);
   va_end(args);
 
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_ERROR);
+    record_string(ctx, (const xmlChar *)message, -1);
+    vasprintf_free(message);
+    return;
+  }
+
   ruby_message = NOKOGIRI_STR_NEW2(message);
   vasprintf_free(message);
-  rb_funcall(doc, id_error, 1, ruby_message);
+  flush_characters(ctx);
+  sax_call(ctx, id_error, 1, ruby_message);
 }
 
 static void cdata_block(void * ctx, const xmlChar * value, int len)
 {
-  VALUE self = NOKOGIRI_SAX_SELF(ctx);
-  VALUE doc = rb_iv_get(self, "@document");
-  VALUE string = NOKOGIRI_STR_NEW(value, len);
-  rb_funcall(doc, id_cdata_block, 1, string);
+  VALUE string;
+
+  if(RECORDING(ctx)) {
+    record_int(ctx, JOURNAL_CDATA_BLOCK);
+    record_string(ctx, value, len);
+    return;
+  }
+
+  flush_characters(ctx);
+  if(!SAX_HANDLES(ctx, SAX_CDATA_BLOCK)) return;
+  string = NOKOGIRI_STR_NEW(value, len);
+  sax_call(ctx, id_cdata_block, 1, string);
+}
+
+/*
+ * Call the callbacks for the events in the journal.
+ */
+static void replay(void * ctx)
+{
+  nokogiriSAXTuplePtr tuple = SAX_TUPLE(ctx);
+  journal_reader reader;
+  const char * end;
+  const xmlChar ** pointers;
+  const xmlChar * string;
+  int count, defaulted, len, i;
+
+  reader.p = tuple->journal;
+  end = tuple->journal + tuple->journal_length;
+
+  while(reader.p < end) {
+    switch(read_int(&reader)) {
+      case JOURNAL_START_DOCUMENT:
+        start_document(ctx);
+        break;
+      case JOURNAL_END_DOCUMENT:
+        end_document(ctx);
+        break;
+      case JOURNAL_START_ELEMENT:
+        string = read_string(&reader, NULL);
+        count = read_int(&reader);
+        pointers = replay_pointers(ctx, (long)(count < 0 ? 1 : count + 1));
+        for(i = 0; i < count; i++) pointers[i] = read_string(&reader, NULL);
+        if(count >= 0) pointers[count] = NULL;
+        start_element(ctx, string, count < 0 ? NULL : pointers);
+        break;
+      case JOURNAL_END_ELEMENT:
+        end_element(ctx, read_string(&reader, NULL));
+        break;
+      case JOURNAL_START_ELEMENT_NS:
+        {
+          const xmlChar * localname = read_string(&reader, NULL);
+          const xmlChar * prefix = read_string(&reader, NULL);
+          const xmlChar * uri = read_string(&reader, NULL);
+          const xmlChar ** namespaces;
+          int nb_namespaces = read_int(&reader);
+
+          /* Reserve room for the attributes before taking pointers */
+          const char * mark = reader.p;
+          for(i = 0; i < nb_namespaces * 2; i++) read_string(&reader, NULL);
+          count = read_int(&reader);
+          reader.p = mark;
+
+          pointers = replay_pointers(ctx, (long)(nb_namespaces * 2 + count * 5 + 1));
+          namespaces = pointers;
+          for(i = 0; i < nb_namespaces * 2; i++)
+            namespaces[i] = read_string(&reader, NULL);
+
+          count = read_int(&reader);
+          defaulted = read_int(&reader);
+          pointers += nb_namespaces * 2;
+          for(i = 0; i < count * 5; i += 5) {
+            pointers[i + 0] = read_string(&reader, NULL);
+            pointers[i + 1] = read_string(&reader, NULL);
+            pointers[i + 2] = read_string(&reader, NULL);
+            pointers[i + 3] = read_string(&reader, &len);
+            pointers[i + 4] = pointers[i + 3] + len;
+          }
+          start_element_ns(ctx, localname, prefix, uri, nb_namespaces,
+              namespaces, count, defaulted, pointers);
+        }
+        break;
+      case JOURNAL_END_ELEMENT_NS:
+        {
+          const xmlChar * localname = read_string(&reader, NULL);
+          const xmlChar * prefix = read_string(&reader, NULL);
+          end_element_ns(ctx, localname, prefix, read_string(&reader, NULL));
+        }
+        break;
+      case JOURNAL_CHARACTERS:
+        string = read_string(&reader, &len);
+        characters_func(ctx, string, len);
+        break;
+      case JOURNAL_COMMENT:
+        comment_func(ctx, read_string(&reader, NULL));
+        break;
+      case JOURNAL_WARNING:
+        warning_func(ctx, "%s", read_string(&reader, NULL));
+        break;
+      case JOURNAL_ERROR:
+        error_func(ctx, "%s", read_string(&reader, NULL));
+        break;
+      case JOURNAL_CDATA_BLOCK:
+        string = read_string(&reader, &len);
+        cdata_block(ctx, string, len);
+        break;
+    }
+  }
+}
+
+static int mark_name(st_data_t key, st_data_t value, st_data_t arg)
+{
+  rb_gc_mark((VALUE)value);
+  return ST_CONTINUE;
+}
+
+static int free_name(st_data_t key, st_data_t value, st_data_t arg)
+{
+  xmlFree((xmlChar *)key);
+  return ST_CONTINUE;
+}
+
+static void mark_tuple(nokogiriSAXTuplePtr tuple)
+{
+  rb_gc_mark(tuple->self);
+  rb_gc_mark(tuple->doc);
+  rb_gc_mark(tuple->lean);
+  rb_gc_mark(tuple->batch_size);
+  rb_gc_mark(tuple->batch);
+  st_foreach(tuple->names, mark_name, 0);
+}
+
+static void free_tuple(nokogiriSAXTuplePtr tuple)
+{
+  st_foreach(tuple->names, free_name, 0);
+  st_free_table(tuple->names);
+  free(tuple->text);
+  free(tuple->journal);
+  free((void *)tuple->pointers);
+  free(tuple);
+}
+
+/*
+ * Does doc's +name+ method come from somewhere other than +base+?  The
+ * method is looked up directly, since a handler may define its own
+ * #method.
+ */
+static int overrides(VALUE doc, VALUE base, ID name)
+{
+  VALUE method = rb_obj_method(doc, ID2SYM(name));
+  return rb_funcall(method, id_owner, 0) != base;
+}
+
+/*
+ * The callbacks that +doc+ handles.  Callbacks a SAX::Document subclass
+ * inherits unchanged are skipped in lean mode, unless the document takes
+ * batches with its own #events.
+ */
+static unsigned int handled_events(VALUE doc, VALUE lean, int batched)
+{
+  VALUE base = rb_const_get(mNokogiriXmlSax, rb_intern("Document"));
+  unsigned int events = 0;
+
+  if(!RTEST(lean) || !rb_obj_is_kind_of(doc, base)) return SAX_ALL;
+  if(batched && overrides(doc, base, id_events)) return SAX_ALL;
+
+  if(overrides(doc, base, id_xmldecl)) events |= SAX_XMLDECL;
+  if(overrides(doc, base, id_start_document)) events |= SAX_START_DOCUMENT;
+  if(overrides(doc, base, id_end_document)) events |= SAX_END_DOCUMENT;
+  if(overrides(doc, base, id_start_element)) events |= SAX_START_ELEMENT;
+  if(overrides(doc, base, id_end_element)) events |= SAX_END_ELEMENT;
+  if(overrides(doc, base, id_start_element_namespace))
+    events |= SAX_START_ELEMENT_NS;
+  if(overrides(doc, base, id_end_element_namespace))
+    events |= SAX_END_ELEMENT_NS;
+  if(overrides(doc, base, id_characters)) events |= SAX_CHARACTERS;
+  if(overrides(doc, base, id_comment)) events |= SAX_COMMENT;
+  if(overrides(doc, base, id_warning)) events |= SAX_WARNING;
+  if(overrides(doc, base, id_error)) events |= SAX_ERROR;
+  if(overrides(doc, base, id_cdata_block)) events |= SAX_CDATA_BLOCK;
+
+  return events;
+}
+
+/*
+ * Create the userData for a parse of +ctxt+ whose events go to the
+ * @document of +self+.  The tuple belongs to the returned object, which
+ * must be kept alive for as long as +ctxt+ may call back.
+ */
+VALUE Nokogiri_sax_tuple_new(xmlParserCtxtPtr ctxt, VALUE self,
+    nokogiriSAXTuplePtr *tuple)
+{
+  nokogiriSAXTuplePtr t = calloc((size_t)1, sizeof(nokogiriSAXTuple));
+  VALUE rb_tuple;
+
+  t->ctxt  = ctxt;
+  t->self  = self;
+  t->doc   = Qundef;
+  t->lean  = Qnil;
+  t->batch_size = Qnil;
+  t->batch = Qnil;
+  t->names = st_init_strtable();
+  rb_tuple = Data_Wrap_Struct(0, mark_tuple, free_tuple, t);
+
+  Nokogiri_sax_tuple_update(t);
+  *tuple = t;
+  return rb_tuple;
+}
+
+/*
+ * Pick up changes to the @document, @lean, @batch_size,
+ * @coalesce_characters and @drop_whitespace of the tuple's owner.  Any
+ * batched events go to the old document first.
+ */
+void Nokogiri_sax_tuple_update(nokogiriSAXTuplePtr tuple)
+{
+  VALUE doc = rb_iv_get(tuple->self, "@document");
+  VALUE lean = rb_iv_get(tuple->self, "@lean");
+  VALUE batch_size = rb_iv_get(tuple->self, "@batch_size");
+  long limit = NIL_P(batch_size) ? 0 : NUM2LONG(batch_size);
+
+  tuple->drop_whitespace = RTEST(rb_iv_get(tuple->self, "@drop_whitespace"));
+  tuple->coalesce = tuple->drop_whitespace ||
+    RTEST(rb_iv_get(tuple->self, "@coalesce_characters"));
+
+  if(doc == tuple->doc && lean == tuple->lean &&
+      batch_size == tuple->batch_size) return;
+
+  Nokogiri_sax_tuple_flush(tuple);
+
+  tuple->events = handled_events(doc, lean, limit > 0);
+  tuple->doc = doc;
+  tuple->lean = lean;
+  tuple->batch_size = batch_size;
+  tuple->batch_limit = limit;
+  if(limit > 0 && NIL_P(tuple->batch)) tuple->batch = rb_ary_new();
+}
+
+/*
+ * Send the batched events to the document's #events.
+ */
+void Nokogiri_sax_tuple_flush(nokogiriSAXTuplePtr tuple)
+{
+  VALUE batch = tuple->batch;
+
+  if(tuple->batch_length == 0) return;
+
+  tuple->batch = rb_ary_new();
+  tuple->batch_length = 0;
+  rb_funcall(tuple->doc, id_events, 1, batch);
+}
+
+typedef struct {
+  nokogiriSAXTuplePtr tuple;
+  xmlParserCtxtPtr ctxt;
+  const char * chunk;
+  int size;
+  int terminate;
+  int status;
+} parse_chunk_args;
+
+static void * parse_chunk_without_gvl(void * data)
+{
+  parse_chunk_args * args = (parse_chunk_args *)data;
+  args->status = xmlParseChunk(args->ctxt, args->chunk, args->size,
+      args->terminate);
+  return NULL;
+}
+
+static VALUE parse_chunk(VALUE data)
+{
+  parse_chunk_args * args = (parse_chunk_args *)data;
+  nokogiriSAXTuplePtr tuple = args->tuple;
+
+  tuple->journal_length = 0;
+  tuple->journal_failed = 0;
+  tuple->recording = 1;
+  NOKOGIRI_WITHOUT_GVL_DEFER_INTS(parse_chunk_without_gvl, args);
+  tuple->recording = 0;
+
+  if(tuple->journal_failed) rb_memerror();
+  replay(tuple);
+  return Qnil;
+}
+
+static VALUE parse_chunk_done(VALUE data)
+{
+  ((nokogiriSAXTuplePtr)data)->parsing = 0;
+  return Qnil;
+}
+
+/*
+ * xmlParseChunk with the GVL released.  The events are journaled while
+ * libxml2 parses, and the callbacks run after it returns.  An interrupt
+ * such as Thread#raise is raised only once recording has stopped and the
+ * journal has been replayed, so the parser can be written to again.
+ * Writing to the parser from another thread, or from a callback, while
+ * the journal is parsed or replayed raises RuntimeError.
+ */
+int Nokogiri_sax_parse_chunk(nokogiriSAXTuplePtr tuple, const char *chunk,
+    int size, int terminate)
+{
+  parse_chunk_args args;
+
+  if(tuple->parsing)
+    rb_raise(rb_eRuntimeError, "the parser is already parsing a chunk");
+
+  args.tuple = tuple;
+  args.ctxt = tuple->ctxt;
+  args.chunk = chunk;
+  args.size = size;
+  args.terminate = terminate;
+  args.status = 0;
+
+  tuple->parsing = 1;
+  rb_ensure(parse_chunk, (VALUE)&args, parse_chunk_done, (VALUE)tuple);
+  rb_thread_check_ints();
+
+  return args.status;
 }
 
 static void deallocate(xmlSAXHandlerPtr handler)
@@ -290,4 +1003,6 @@ void init_xml_sax_parser()
   id_cAttribute     = rb_intern("Attribute");
   id_start_element_namespace = rb_intern("start_element_namespace");
   id_end_element_namespace = rb_intern("end_element_namespace");
+  id_owner          = rb_intern("owner");
+  id_events         = rb_intern("events");
 }
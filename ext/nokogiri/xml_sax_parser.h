@@ -10,6 +10,27 @@ extern VALUE cNokogiriXmlSaxParser ;
 typedef struct _nokogiriSAXTuple {
   xmlParserCtxtPtr  ctxt;
   VALUE             self;
+  VALUE             doc;    /* self's @document, looked up once */
+  VALUE             lean;   /* self's @lean */
+  unsigned int      events; /* the callbacks doc handles */
+  st_table          *names; /* frozen names interned in lean mode */
+  VALUE             batch_size;   /* self's @batch_size */
+  long              batch_limit;  /* events per batch, 0 if not batched */
+  long              batch_length; /* events in batch */
+  VALUE             batch;
+  int               coalesce;        /* buffer characters in text */
+  int               drop_whitespace; /* drop whitespace only text */
+  char              *text;
+  long              text_length;
+  long              text_capacity;
+  int               parsing;       /* a chunk is parsed or replayed */
+  int               recording;     /* journal events, the GVL is released */
+  int               journal_failed;
+  char              *journal;
+  long              journal_length;
+  long              journal_capacity;
+  const xmlChar     **pointers;    /* argument arrays for replays */
+  long              pointers_capacity;
 } nokogiriSAXTuple;
 
 typedef nokogiriSAXTuple * nokogiriSAXTuplePtr;
@@ -20,20 +41,11 @@ typedef nokogiriSAXTuple * nokogiriSAXTuplePtr;
 #define NOKOGIRI_SAX_CTXT(_ctxt) \
   ((nokogiriSAXTuplePtr)(_ctxt))->ctxt
 
-#define NOKOGIRI_SAX_TUPLE_NEW(_ctxt, _self) \
-  nokogiri_sax_tuple_new(_ctxt, _self)
-
-static inline nokogiriSAXTuplePtr
-nokogiri_sax_tuple_new(xmlParserCtxtPtr ctxt, VALUE self)
-{
-  nokogiriSAXTuplePtr tuple = malloc(sizeof(nokogiriSAXTuple));
-  tuple->self = self;
-  tuple->ctxt = ctxt;
-  return tuple;
-}
-
-#define NOKOGIRI_SAX_TUPLE_DESTROY(_tuple) \
-  free(_tuple) \
+VALUE Nokogiri_sax_tuple_new(xmlParserCtxtPtr ctxt, VALUE self,
+                             nokogiriSAXTuplePtr *tuple);
+void Nokogiri_sax_tuple_update(nokogiriSAXTuplePtr tuple);
+void Nokogiri_sax_tuple_flush(nokogiriSAXTuplePtr tuple);
+int Nokogiri_sax_parse_chunk(nokogiriSAXTuplePtr tuple, const char *chunk,
+                             int size, int terminate);
 
 #endif
-
@@ -2,6 +2,8 @@
 
 VALUE cNokogiriXmlSaxParserContext ;
 
+static ID id_io_reader;
+
 static void deallocate(xmlParserCtxtPtr ctxt)
 {
   NOKOGIRI_DEBUG_START(handler);
@@ -24,17 +26,24 @@ parse_io(VALUE klass, VALUE io, VALUE encoding)
 {
     xmlParserCtxtPtr ctxt;
     xmlCharEncoding enc = (xmlCharEncoding)NUM2INT(encoding);
+    nokogiriIOReader *reader;
+    VALUE rb_reader, context;
+
+    rb_reader = Nokogiri_io_reader(io, &reader);
 
     ctxt = xmlCreateIOParserCtxt(NULL, NULL,
-				 (xmlInputReadCallback)io_read_callback,
+				 (xmlInputReadCallback)io_reader_read_callback,
 				 (xmlInputCloseCallback)io_close_callback,
-				 (void *)io, enc);
+				 (void *)reader, enc);
     if (ctxt->sax) {
 	xmlFree(ctxt->sax);
 	ctxt->sax = NULL;
     }
 
-    return Data_Wrap_Struct(klass, NULL, deallocate, ctxt);
+    context = Data_Wrap_Struct(klass, NULL, deallocate, ctxt);
+    /* Hidden from Ruby; keeps the buffered input alive until parse_with */
+    rb_ivar_set(context, id_io_reader, rb_reader);
+    return context;
 }
 
 /*
@@ -80,6 +89,7 @@ parse_doc(VALUE ctxt_val)
 {
     xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctxt_val;
     xmlParseDocument(ctxt);
+    Nokogiri_sax_tuple_flush((nokogiriSAXTuplePtr)ctxt->userData);
     return Qnil;
 }
 
@@ -91,7 +101,7 @@ parse_doc_finalize(VALUE ctxt_val)
     if (NULL != ctxt->myDoc)
 	xmlFreeDoc(ctxt->myDoc);
 
-    NOKOGIRI_SAX_TUPLE_DESTROY(ctxt->userData);
+    ctxt->userData = NULL;
     return Qnil;
 }
 
@@ -106,6 +116,9 @@ parse_with(VALUE self, VALUE sax_handler)
 {
     xmlParserCtxtPtr ctxt;
     xmlSAXHandlerPtr sax;
+    nokogiriSAXTuplePtr tuple;
+    nokogiriIOReader *reader;
+    VALUE rb_tuple, rb_reader;
 
     if (!rb_obj_is_kind_of(sax_handler, cNokogiriXmlSaxParser))
 	rb_raise(rb_eArgError, "argument must be a Nokogiri::XML::SAX::Parser");
@@ -118,9 +131,18 @@ parse_with(VALUE self, VALUE sax_handler)
 	xmlFree(ctxt->sax);
 
     ctxt->sax = sax;
-    ctxt->userData = (void *)NOKOGIRI_SAX_TUPLE_NEW(ctxt, sax_handler);
+    rb_tuple = Nokogiri_sax_tuple_new(ctxt, sax_handler, &tuple);
+    ctxt->userData = (void *)tuple;
 
     rb_ensure(parse_doc, (VALUE)ctxt, parse_doc_finalize, (VALUE)ctxt);
+    RB_GC_GUARD(rb_tuple);
+
+    /* Raise an exception that ended the input of a context from parse_io */
+    rb_reader = rb_attr_get(self, id_io_reader);
+    if (!NIL_P(rb_reader)) {
+	Data_Get_Struct(rb_reader, nokogiriIOReader, reader);
+	Nokogiri_io_reader_check(reader);
+    }
 
     return Qnil;
 }
@@ -219,4 +241,6 @@ void init_xml_sax_parser_context()
   rb_define_method(klass, "replace_entities", get_replace_entities, 0);
   rb_define_method(klass, "line", line, 0);
   rb_define_method(klass, "column", column, 0);
+
+  id_io_reader = rb_intern("io_reader");
 }
@@ -1,10 +1,11 @@
 #include <xml_sax_push_parser.h>
 
+static ID id_sax_tuple;
+
 static void deallocate(xmlParserCtxtPtr ctx)
 {
   NOKOGIRI_DEBUG_START(ctx);
   if(ctx != NULL) {
-    NOKOGIRI_SAX_TUPLE_DESTROY(ctx->userData);
     xmlFreeParserCtxt(ctx);
   }
   NOKOGIRI_DEBUG_END(ctx);
@@ -19,23 +20,33 @@ static VALUE allocate(VALUE klass)
  * call-seq:
  *  native_write(chunk, last_chunk)
  *
- * Write +chunk+ to PushParser. +last_chunk+ triggers the end_document handle
+ * Write +chunk+ to PushParser. +last_chunk+ triggers the end_document handle.
+ * The chunk is parsed with the GVL released, and the SAX callbacks for it
+ * are called afterwards.
  */
 static VALUE native_write(VALUE self, VALUE _chunk, VALUE _last_chunk)
 {
   xmlParserCtxtPtr ctx;
   const char * chunk  = NULL;
   int size            = 0;
-
+  int status;
 
   Data_Get_Struct(self, xmlParserCtxt, ctx);
+  Nokogiri_sax_tuple_update((nokogiriSAXTuplePtr)ctx->userData);
 
   if(Qnil != _chunk) {
-    chunk = StringValuePtr(_chunk);
+    /* A frozen copy keeps the bytes stable while the GVL is released */
+    _chunk = rb_str_new_frozen(StringValue(_chunk));
+    chunk = RSTRING_PTR(_chunk);
     size = (int)RSTRING_LEN(_chunk);
   }
 
-  if(xmlParseChunk(ctx, chunk, size, Qtrue == _last_chunk ? 1 : 0)) {
+  status = Nokogiri_sax_parse_chunk((nokogiriSAXTuplePtr)ctx->userData,
+      chunk, size, Qtrue == _last_chunk ? 1 : 0);
+  RB_GC_GUARD(_chunk);
+  Nokogiri_sax_tuple_flush((nokogiriSAXTuplePtr)ctx->userData);
+
+  if(status) {
     if (!(ctx->options & XML_PARSE_RECOVER)) {
       xmlErrorPtr e = xmlCtxtGetLastError(ctx);
       Nokogiri_error_raise(NULL, e);
@@ -56,6 +67,7 @@ static VALUE initialize_native(VALUE self, VALUE _xml_sax, VALUE _filename)
   xmlSAXHandlerPtr sax;
   const char * filename = NULL;
   xmlParserCtxtPtr ctx;
+  nokogiriSAXTuplePtr tuple;
 
   Data_Get_Struct(_xml_sax, xmlSAXHandler, sax);
 
@@ -71,7 +83,9 @@ static VALUE initialize_native(VALUE self, VALUE _xml_sax, VALUE _filename)
   if(ctx == NULL)
     rb_raise(rb_eRuntimeError, "Could not create a parser context");
 
-  ctx->userData = NOKOGIRI_SAX_TUPLE_NEW(ctx, self);
+  /* The tuple lives as long as self */
+  rb_ivar_set(self, id_sax_tuple, Nokogiri_sax_tuple_new(ctx, self, &tuple));
+  ctx->userData = tuple;
 
   ctx->sax2 = 1;
   DATA_PTR(self) = ctx;
@@ -112,4 +126,6 @@ void init_xml_sax_push_parser()
   rb_define_private_method(klass, "native_write", native_write, 2);
   rb_define_method(klass, "options", get_options, 0);
   rb_define_method(klass, "options=", set_options, 1);
+
+  id_sax_tuple = rb_intern("sax_tuple");
 }
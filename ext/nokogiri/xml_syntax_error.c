@@ -11,6 +11,57 @@ void Nokogiri_error_raise(void * ctx, xmlErrorPtr error)
   rb_exc_raise(Nokogiri_wrap_xml_syntax_error((VALUE)NULL, error));
 }
 
+/*
+ * Structured error handler that copies +error+ onto the nokogiriErrorList
+ * in +ctx+.  It does not call into Ruby, so it is safe to install while
+ * the GVL is released.
+ */
+void Nokogiri_error_list_pusher(void * ctx, xmlErrorPtr error)
+{
+  nokogiriErrorList * list = (nokogiriErrorList *)ctx;
+
+  if (list->length == list->capacity) {
+    int capacity = list->capacity ? list->capacity * 2 : 8;
+    xmlErrorPtr errors = realloc(list->errors, sizeof(xmlError) * (size_t)capacity);
+    if (!errors) return;
+
+    memset(errors + list->capacity, 0,
+        sizeof(xmlError) * (size_t)(capacity - list->capacity));
+    list->errors = errors;
+    list->capacity = capacity;
+  }
+
+  xmlCopyError(error, &list->errors[list->length++]);
+}
+
+/*
+ * Convert +list+ into an Array of Nokogiri::XML::SyntaxError and release
+ * the copied errors.
+ */
+VALUE Nokogiri_error_list_to_ary(nokogiriErrorList * list)
+{
+  VALUE ary = rb_ary_new2((long)list->length);
+  int i;
+
+  for (i = 0 ; i < list->length ; i++)
+    rb_ary_push(ary, Nokogiri_wrap_xml_syntax_error((VALUE)NULL, &list->errors[i]));
+
+  Nokogiri_error_list_free(list);
+  return ary;
+}
+
+void Nokogiri_error_list_free(nokogiriErrorList * list)
+{
+  int i;
+
+  for (i = 0 ; i < list->length ; i++)
+    xmlResetError(&list->errors[i]);
+
+  free(list->errors);
+  list->errors = NULL;
+  list->length = list->capacity = 0;
+}
+
 VALUE Nokogiri_wrap_xml_syntax_error(VALUE klass, xmlErrorPtr error)
 {
   VALUE msg, e;
@@ -1,9 +1,24 @@
 #ifndef NOKOGIRI_XML_SYNTAX_ERROR
 #define NOKOGIRI_XML_SYNTAX_ERROR
 
+#include <libxml/xmlerror.h>
+
+/*
+ * A list of copied libxml2 errors, collected while the GVL is released and
+ * turned into Nokogiri::XML::SyntaxError objects afterwards.
+ */
+typedef struct _nokogiriErrorList {
+  xmlErrorPtr errors;
+  int length;
+  int capacity;
+} nokogiriErrorList;
+
 #include <nokogiri.h>
 
 void init_xml_syntax_error();
+void Nokogiri_error_list_pusher(void * ctx, xmlErrorPtr error);
+VALUE Nokogiri_error_list_to_ary(nokogiriErrorList * list);
+void Nokogiri_error_list_free(nokogiriErrorList * list);
 VALUE Nokogiri_wrap_xml_syntax_error(VALUE klass, xmlErrorPtr error);
 void Nokogiri_error_array_pusher(void * ctx, xmlErrorPtr error);
 NORETURN(void Nokogiri_error_raise(void * ctx, xmlErrorPtr error));
@@ -49,6 +49,58 @@ static VALUE register_variable(VALUE self, VALUE name, VALUE value)
    return self;
 }
 
+/*
+ * call-seq:
+ *  node=(node)
+ *
+ * Retarget this context so that queries are evaluated relative to +node+.
+ */
+static VALUE set_node(VALUE self, VALUE nodeobj)
+{
+  xmlXPathContextPtr ctx;
+  xmlNodePtr node;
+
+  Data_Get_Struct(self, xmlXPathContext, ctx);
+  Data_Get_Struct(nodeobj, xmlNode, node);
+
+  ctx->doc = node->doc;
+  ctx->node = node;
+  ctx->contextSize = -1;
+  ctx->proximityPosition = -1;
+
+  return nodeobj;
+}
+
+/*
+ * call-seq:
+ *  clear_namespaces
+ *
+ * Remove every namespace registered with register_ns.
+ */
+static VALUE clear_namespaces(VALUE self)
+{
+  xmlXPathContextPtr ctx;
+  Data_Get_Struct(self, xmlXPathContext, ctx);
+
+  xmlXPathRegisteredNsCleanup(ctx);
+  return self;
+}
+
+/*
+ * call-seq:
+ *  clear_variables
+ *
+ * Remove every variable registered with register_variable.
+ */
+static VALUE clear_variables(VALUE self)
+{
+  xmlXPathContextPtr ctx;
+  Data_Get_Struct(self, xmlXPathContext, ctx);
+
+  xmlXPathRegisteredVariablesCleanup(ctx);
+  return self;
+}
+
 static void ruby_funcall(xmlXPathParserContextPtr ctx, int nargs)
 {
   VALUE xpath_handler = Qnil;
@@ -63,11 +115,19 @@ static void ruby_funcall(xmlXPathParserContextPtr ctx, int nargs)
 
   assert(ctx);
   assert(ctx->context);
-  assert(ctx->context->userData);
   assert(ctx->context->doc);
   assert(DOC_RUBY_OBJECT_TEST(ctx->context->doc));
 
-  xpath_handler = (VALUE)(ctx->context->userData);
+  /* Only reachable through lookup, which needs a handler; report it the
+   * way libxml2 reports a missing function just in case. */
+  if(NULL == ctx->context->funcLookupData) {
+    xmlGenericError(xmlGenericErrorContext,
+        "xmlXPathCompOpEval: function %s not found\n", ctx->context->function);
+    xmlXPathErr(ctx, XPATH_UNKNOWN_FUNC_ERROR);
+    return;
+  }
+
+  xpath_handler = (VALUE)(ctx->context->funcLookupData);
 
   argv = (VALUE *)calloc((size_t)nargs, sizeof(VALUE));
   for (i = 0 ; i < nargs ; ++i) {
@@ -165,33 +225,227 @@ static xmlXPathFunction lookup( void *ctx,
   return NULL;
 }
 
-NORETURN(static void xpath_exception_handler(void * ctx, xmlErrorPtr error));
-static void xpath_exception_handler(void * ctx, xmlErrorPtr error)
+/*
+ * The first error of a query.  XPath errors arrive through the context's
+ * own error callback; the few that libxml2 only reports as generic
+ * errors go through the generic handler, which libxml2 keeps per thread.
+ * Nothing is raised until the query has returned, so a query can run
+ * without the GVL.
+ */
+typedef struct {
+  int      kind;      /* XPATH_ERROR_NONE, _STRUCTURED or _GENERIC */
+  xmlError error;
+  char     *message;
+} nokogiriXPathErrors;
+
+enum {
+  XPATH_ERROR_NONE,
+  XPATH_ERROR_STRUCTURED,
+  XPATH_ERROR_GENERIC
+};
+
+static void xpath_error_pusher(void * ctx, xmlErrorPtr error)
 {
-  VALUE xpath = rb_const_get(mNokogiriXml, rb_intern("XPath"));
-  VALUE klass = rb_const_get(xpath, rb_intern("SyntaxError"));
+  nokogiriXPathErrors * errors = (nokogiriXPathErrors *)ctx;
 
-  rb_exc_raise(Nokogiri_wrap_xml_syntax_error(klass, error));
+  if(errors->kind != XPATH_ERROR_NONE) return;
+  if(xmlCopyError(error, &errors->error) == 0)
+    errors->kind = XPATH_ERROR_STRUCTURED;
 }
 
-NORETURN(static void xpath_generic_exception_handler(void * ctx, const char *msg, ...));
-static void xpath_generic_exception_handler(void * ctx, const char *msg, ...)
+static void xpath_generic_error_pusher(void * ctx, const char *msg, ...)
 {
-  char * message;
-
+  nokogiriXPathErrors * errors = (nokogiriXPathErrors *)ctx;
   va_list args;
+
+  if(errors->kind != XPATH_ERROR_NONE) return;
+
   va_start(args, msg);
-  vasprintf(&message, msg, args);
+  if(vasprintf(&errors->message, msg, args) >= 0)
+    errors->kind = XPATH_ERROR_GENERIC;
+  else
+    errors->message = NULL;
   va_end(args);
+}
+
+/*
+ * Install +xpath_handler+ and +errors+ on +ctx+ before a query is
+ * evaluated.  Contexts are reused, so any handler left by a previous
+ * query is dropped.
+ */
+static void begin_evaluation(xmlXPathContextPtr ctx, VALUE xpath_handler,
+    nokogiriXPathErrors *errors)
+{
+  if(Qnil != xpath_handler) {
+    xmlXPathRegisterFuncLookup(ctx, lookup, (void *)xpath_handler);
+  } else {
+    xmlXPathRegisterFuncLookup(ctx, NULL, NULL);
+  }
+
+  memset(errors, 0, sizeof(*errors));
+  xmlResetError(&ctx->lastError);
+  ctx->userData = (void *)errors;
+  ctx->error = xpath_error_pusher;
+
+  /* For some reason, xmlXPathEvalExpression will blow up with a generic error */
+  /* when there is a non existent function. */
+  xmlSetGenericErrorFunc((void *)errors, xpath_generic_error_pusher);
+}
+
+static void end_evaluation(xmlXPathContextPtr ctx, nokogiriXPathErrors *errors)
+{
+  xmlSetGenericErrorFunc(NULL, NULL);
+  ctx->userData = NULL;
+  ctx->error = NULL;
+
+  if(errors->kind == XPATH_ERROR_STRUCTURED) xmlResetError(&errors->error);
+  free(errors->message);
+  memset(errors, 0, sizeof(*errors));
+}
 
-  rb_raise(rb_eRuntimeError, message);
+/*
+ * Raise the first error of a query that failed, then clean up as
+ * end_evaluation does.
+ */
+NORETURN(static void raise_errors(xmlXPathContextPtr ctx, nokogiriXPathErrors *errors));
+static void raise_errors(xmlXPathContextPtr ctx, nokogiriXPathErrors *errors)
+{
+  VALUE xpath = rb_const_get(mNokogiriXml, rb_intern("XPath"));
+  VALUE klass = rb_const_get(xpath, rb_intern("SyntaxError"));
+  VALUE exception;
+
+  switch(errors->kind) {
+    case XPATH_ERROR_GENERIC:
+      exception = rb_exc_new2(rb_eRuntimeError, errors->message);
+      break;
+    case XPATH_ERROR_STRUCTURED:
+      exception = Nokogiri_wrap_xml_syntax_error(klass, &errors->error);
+      break;
+    default:
+      exception = Nokogiri_wrap_xml_syntax_error(klass,
+          ctx->lastError.code == XML_ERR_OK ? NULL : &ctx->lastError);
+  }
+
+  end_evaluation(ctx, errors);
+  rb_exc_raise(exception);
+}
+
+typedef struct {
+  xmlXPathContextPtr  ctx;
+  xmlXPathCompExprPtr comp;
+  const xmlChar       *query;
+  xmlXPathObjectPtr   result;
+} nokogiriXPathQuery;
+
+static void *run_query(void *data)
+{
+  nokogiriXPathQuery *query = (nokogiriXPathQuery *)data;
+
+  if(query->comp)
+    query->result = xmlXPathCompiledEval(query->comp, query->ctx);
+  else
+    query->result = xmlXPathEvalExpression(query->query, query->ctx);
+  return NULL;
+}
+
+/*
+ * Point +query+ at +search_path+, a String or an XML::XPath::Expression.
+ * libxml2 remembers the function each call in a compiled expression
+ * resolved to the first time it runs, so a function found through
+ * +xpath_handler+ would stay bound to an Expression that other queries
+ * share.  With a handler the source is compiled afresh instead.  Returns
+ * the object +query+ points into.
+ */
+static VALUE prepare_query(nokogiriXPathQuery *query, VALUE search_path,
+    VALUE xpath_handler)
+{
+  query->comp = NULL;
+  query->query = NULL;
+
+  if(rb_obj_is_kind_of(search_path, cNokogiriXmlXpathExpression)) {
+    if(NIL_P(xpath_handler)) {
+      Data_Get_Struct(search_path, xmlXPathCompExpr, query->comp);
+      return search_path;
+    }
+    search_path = rb_iv_get(search_path, "@source");
+  }
+
+  /* A frozen copy stays put while the GVL is released */
+  search_path = rb_str_new_frozen(StringValue(search_path));
+  query->query = (const xmlChar *)StringValueCStr(search_path);
+  return search_path;
+}
+
+static VALUE check_ints(VALUE unused)
+{
+  rb_thread_check_ints();
+  return Qnil;
+}
+
+/*
+ * Evaluate +query+ on +ctx+.  Without a Ruby handler nothing in the query
+ * can call back into Ruby, so it runs with the GVL released and queries
+ * on other threads may run alongside it.  An interrupt that arrives
+ * meanwhile is raised after the result has been freed.  Raises the first
+ * error.
+ */
+static xmlXPathObjectPtr evaluate_query(nokogiriXPathQuery *query,
+    VALUE xpath_handler, nokogiriXPathErrors *errors)
+{
+  int state = 0;
+
+  query->result = NULL;
+
+  if(NIL_P(xpath_handler))
+    NOKOGIRI_WITHOUT_GVL_DEFER_INTS(run_query, query);
+  else
+    run_query(query);
+
+  if(query->result == NULL || errors->kind != XPATH_ERROR_NONE) {
+    xmlXPathFreeObject(query->result);
+    query->result = NULL;
+    raise_errors(query->ctx, errors);
+  }
+
+  rb_protect(check_ints, Qnil, &state);
+  if(state) {
+    xmlXPathFreeObject(query->result);
+    query->result = NULL;
+    rb_jump_tag(state);
+  }
+
+  return query->result;
+}
+
+typedef struct {
+  nokogiriXPathQuery  *query;
+  VALUE               xpath_handler;
+  nokogiriXPathErrors *errors;
+} nokogiriEvaluateArgs;
+
+static VALUE evaluate_body(VALUE data)
+{
+  nokogiriEvaluateArgs *args = (nokogiriEvaluateArgs *)data;
+
+  evaluate_query(args->query, args->xpath_handler, args->errors);
+  return Qnil;
+}
+
+/* A handler may raise in the middle of a query */
+static VALUE evaluate_cleanup(VALUE data)
+{
+  nokogiriEvaluateArgs *args = (nokogiriEvaluateArgs *)data;
+
+  end_evaluation(args->query->ctx, args->errors);
+  return Qnil;
 }
 
 /*
  * call-seq:
  *  evaluate(search_path, handler = nil)
  *
- * Evaluate the +search_path+ returning an XML::XPath object.
+ * Evaluate the +search_path+ returning an XML::XPath object.  +search_path+
+ * may be a String or a precompiled XML::XPath::Expression.
  */
 static VALUE evaluate(int argc, VALUE *argv, VALUE self)
 {
@@ -199,39 +453,25 @@ static VALUE evaluate(int argc, VALUE *argv, VALUE self)
   VALUE thing = Qnil;
   xmlXPathContextPtr ctx;
   xmlXPathObjectPtr xpath;
-  xmlChar *query;
+  nokogiriXPathQuery query;
+  nokogiriXPathErrors errors;
+  nokogiriEvaluateArgs args;
 
   Data_Get_Struct(self, xmlXPathContext, ctx);
 
   if(rb_scan_args(argc, argv, "11", &search_path, &xpath_handler) == 1)
     xpath_handler = Qnil;
 
-  query = (xmlChar *)StringValuePtr(search_path);
+  query.ctx = ctx;
+  search_path = prepare_query(&query, search_path, xpath_handler);
 
-  if(Qnil != xpath_handler) {
-    /* FIXME: not sure if this is the correct place to shove private data. */
-    ctx->userData = (void *)xpath_handler;
-    xmlXPathRegisterFuncLookup(ctx, lookup, (void *)xpath_handler);
-  }
-
-  xmlResetLastError();
-  xmlSetStructuredErrorFunc(NULL, xpath_exception_handler);
-
-  /* For some reason, xmlXPathEvalExpression will blow up with a generic error */
-  /* when there is a non existent function. */
-  xmlSetGenericErrorFunc(NULL, xpath_generic_exception_handler);
-
-  xpath = xmlXPathEvalExpression(query, ctx);
-  xmlSetStructuredErrorFunc(NULL, NULL);
-  xmlSetGenericErrorFunc(NULL, NULL);
-
-  if(xpath == NULL) {
-    VALUE xpath = rb_const_get(mNokogiriXml, rb_intern("XPath"));
-    VALUE klass = rb_const_get(xpath, rb_intern("SyntaxError"));
-
-    xmlErrorPtr error = xmlGetLastError();
-    rb_exc_raise(Nokogiri_wrap_xml_syntax_error(klass, error));
-  }
+  args.query = &query;
+  args.xpath_handler = xpath_handler;
+  args.errors = &errors;
+  begin_evaluation(ctx, xpath_handler, &errors);
+  rb_ensure(evaluate_body, (VALUE)&args, evaluate_cleanup, (VALUE)&args);
+  xpath = query.result;
+  RB_GC_GUARD(search_path);
 
   assert(ctx->doc);
   assert(DOC_RUBY_OBJECT_TEST(ctx->doc));
@@ -265,6 +505,151 @@ static VALUE evaluate(int argc, VALUE *argv, VALUE self)
   return thing;
 }
 
+typedef struct {
+  xmlXPathContextPtr ctx;
+  xmlNodeSetPtr      contexts;
+  VALUE              search_paths;
+  VALUE              xpath_handler;
+  VALUE              document;
+  xmlNodeSetPtr      result;
+  st_table          *seen;
+  nokogiriXPathErrors errors;
+} nokogiriEvaluateSetArgs;
+
+/*
+ * Namespace nodes in an XPath result are copies, so they are compared by
+ * the element they belong to and their prefix rather than by address.
+ */
+static int contains_namespace(xmlNodeSetPtr set, xmlNsPtr ns)
+{
+  int i;
+  xmlNsPtr other;
+
+  for(i = 0; i < set->nodeNr; i++) {
+    if(XML_NAMESPACE_DECL != set->nodeTab[i]->type) continue;
+    other = (xmlNsPtr)set->nodeTab[i];
+    if(other->next == ns->next && xmlStrEqual(other->prefix, ns->prefix))
+      return 1;
+  }
+  return 0;
+}
+
+static VALUE evaluate_set_body(VALUE data)
+{
+  nokogiriEvaluateSetArgs *args = (nokogiriEvaluateSetArgs *)data;
+  xmlXPathContextPtr ctx = args->ctx;
+  nokogiriXPathQuery query;
+  xmlXPathObjectPtr xpath;
+  xmlNodeSetPtr found;
+  xmlNodePtr node;
+  VALUE search_path;
+  long i;
+  int j, k;
+
+  begin_evaluation(ctx, args->xpath_handler, &args->errors);
+  query.ctx = ctx;
+
+  for(i = 0; i < RARRAY_LEN(args->search_paths); i++) {
+    search_path = rb_ary_entry(args->search_paths, i);
+    if(NIL_P(args->xpath_handler))
+      search_path = rb_funcall(cNokogiriXmlXpathExpression, rb_intern("[]"), 1,
+          search_path);
+    search_path = prepare_query(&query, search_path, args->xpath_handler);
+
+    for(j = 0; j < args->contexts->nodeNr; j++) {
+      node = args->contexts->nodeTab[j];
+      if(XML_NAMESPACE_DECL == node->type) continue;
+
+      ctx->doc = node->doc;
+      ctx->node = node;
+      ctx->contextSize = -1;
+      ctx->proximityPosition = -1;
+
+      xpath = evaluate_query(&query, args->xpath_handler, &args->errors);
+
+      if(XPATH_NODESET != xpath->type) {
+        xmlXPathFreeObject(xpath);
+        rb_raise(rb_eArgError, "XPath expression does not return a node set");
+      }
+
+      found = xpath->nodesetval;
+      for(k = 0; found && k < found->nodeNr; k++) {
+        node = found->nodeTab[k];
+        if(XML_NAMESPACE_DECL == node->type) {
+          if(contains_namespace(args->result, (xmlNsPtr)node)) continue;
+        } else {
+          if(st_lookup(args->seen, (st_data_t)node, NULL)) continue;
+          st_insert(args->seen, (st_data_t)node, (st_data_t)0);
+        }
+        /* Namespace nodes are copied, the originals go with +xpath+ */
+        xmlXPathNodeSetAddUnique(args->result, node);
+      }
+      xmlXPathFreeObject(xpath);
+    }
+    RB_GC_GUARD(search_path);
+  }
+
+  end_evaluation(ctx, &args->errors);
+
+  if(args->contexts->nodeNr > 1 || RARRAY_LEN(args->search_paths) > 1)
+    xmlXPathNodeSetSort(args->result);
+
+  found = args->result;
+  args->result = NULL;
+  return Nokogiri_wrap_xml_node_set(found, args->document);
+}
+
+static VALUE evaluate_set_cleanup(VALUE data)
+{
+  nokogiriEvaluateSetArgs *args = (nokogiriEvaluateSetArgs *)data;
+
+  end_evaluation(args->ctx, &args->errors);
+  st_free_table(args->seen);
+  if(args->result) xmlXPathFreeNodeSet(args->result);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *  evaluate_set(node_set, search_paths, handler = nil)
+ *
+ * Evaluate each of +search_paths+ with every node in +node_set+ as the
+ * context node.  Returns one XML::NodeSet holding every node found, in
+ * document order and without duplicates.  Each of +search_paths+ must
+ * return a node set.
+ */
+static VALUE evaluate_set(int argc, VALUE *argv, VALUE self)
+{
+  VALUE node_set, search_paths, xpath_handler;
+  nokogiriNodeSetTuple *tuple;
+  nokogiriEvaluateSetArgs args;
+
+  if(rb_scan_args(argc, argv, "21", &node_set, &search_paths, &xpath_handler) == 2)
+    xpath_handler = Qnil;
+
+  if(!rb_obj_is_kind_of(node_set, cNokogiriXmlNodeSet))
+    rb_raise(rb_eArgError, "node_set must be a Nokogiri::XML::NodeSet");
+  Check_Type(search_paths, T_ARRAY);
+
+  Data_Get_Struct(self, xmlXPathContext, args.ctx);
+  Data_Get_Struct(node_set, nokogiriNodeSetTuple, tuple);
+
+  if(!tuple->node_set)
+    return Nokogiri_wrap_xml_node_set(xmlXPathNodeSetCreate(NULL),
+        rb_iv_get(node_set, "@document"));
+
+  args.contexts      = tuple->node_set;
+  args.search_paths  = search_paths;
+  args.xpath_handler = xpath_handler;
+  args.document      = rb_iv_get(node_set, "@document");
+  args.result        = xmlXPathNodeSetCreate(NULL);
+  args.seen          = st_init_numtable();
+  memset(&args.errors, 0, sizeof(args.errors));
+
+  return rb_ensure(evaluate_set_body, (VALUE)&args,
+      evaluate_set_cleanup, (VALUE)&args);
+}
+
 /*
  * call-seq:
  *  new(node)
@@ -307,6 +692,10 @@ void init_xml_xpath_context(void)
 
   rb_define_singleton_method(klass, "new", new, 1);
   rb_define_method(klass, "evaluate", evaluate, -1);
+  rb_define_method(klass, "evaluate_set", evaluate_set, -1);
   rb_define_method(klass, "register_variable", register_variable, 2);
   rb_define_method(klass, "register_ns", register_ns, 2);
+  rb_define_method(klass, "node=", set_node, 1);
+  rb_define_method(klass, "clear_namespaces", clear_namespaces, 0);
+  rb_define_method(klass, "clear_variables", clear_variables, 0);
 }
@@ -0,0 +1,70 @@
+#include <xml_xpath_expression.h>
+
+VALUE cNokogiriXmlXpathExpression;
+
+static void
+deallocate(xmlXPathCompExprPtr comp)
+{
+    NOKOGIRI_DEBUG_START(comp);
+    xmlXPathFreeCompExpr(comp);
+    NOKOGIRI_DEBUG_END(comp);
+}
+
+static void
+swallow_error(void *ctx, xmlErrorPtr error)
+{
+}
+
+/*
+ * call-seq:
+ *  new(string)
+ *
+ * Compile the XPath +string+ into an Expression.  Raises
+ * Nokogiri::XML::XPath::SyntaxError if +string+ is not valid XPath.
+ */
+static VALUE
+new(VALUE klass, VALUE string)
+{
+    xmlXPathCompExprPtr comp;
+    VALUE self;
+
+    xmlXPathInit();
+
+    xmlResetLastError();
+    xmlSetStructuredErrorFunc(NULL, swallow_error);
+    comp = xmlXPathCompile((const xmlChar *)StringValueCStr(string));
+    xmlSetStructuredErrorFunc(NULL, NULL);
+
+    if (NULL == comp) {
+	VALUE xpath = rb_const_get(mNokogiriXml, rb_intern("XPath"));
+	VALUE error_klass = rb_const_get(xpath, rb_intern("SyntaxError"));
+
+	rb_exc_raise(Nokogiri_wrap_xml_syntax_error(error_klass,
+						    xmlGetLastError()));
+    }
+
+    self = Data_Wrap_Struct(klass, 0, deallocate, comp);
+    rb_iv_set(self, "@source", rb_obj_freeze(rb_str_dup(string)));
+
+    return self;
+}
+
+void
+init_xml_xpath_expression(void)
+{
+    VALUE nokogiri = rb_define_module("Nokogiri");
+    VALUE xml = rb_define_module_under(nokogiri, "XML");
+    VALUE xpath = rb_define_class_under(xml, "XPath", rb_cObject);
+
+    /*
+     * An XPath query compiled once by libxml2 and reusable against any
+     * Document.  Namespace prefixes, variables and functions are resolved
+     * when the expression is evaluated, so a single Expression may be
+     * shared between documents and threads.
+     */
+    VALUE klass = rb_define_class_under(xpath, "Expression", rb_cObject);
+
+    cNokogiriXmlXpathExpression = klass;
+
+    rb_define_singleton_method(klass, "new", new, 1);
+}
@@ -0,0 +1,9 @@
+#ifndef NOKOGIRI_XML_XPATH_EXPRESSION
+#define NOKOGIRI_XML_XPATH_EXPRESSION
+
+#include <nokogiri.h>
+
+void init_xml_xpath_expression();
+
+extern VALUE cNokogiriXmlXpathExpression;
+#endif
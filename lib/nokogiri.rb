@@ -27,6 +27,7 @@ end
 require 'nokogiri/nokogiri'
 require 'nokogiri/version'
 require 'nokogiri/syntax_error'
+require 'nokogiri/clock_cache'
 require 'nokogiri/xml'
 require 'nokogiri/xslt'
 require 'nokogiri/html'
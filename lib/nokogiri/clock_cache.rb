@@ -0,0 +1,118 @@
+require 'thread'
+
+module Nokogiri
+  ###
+  # A bounded, thread safe cache.  Once the cache holds +max_size+
+  # entries, adding another replaces the first entry the clock hand finds
+  # that has not been looked up since the hand last passed it.
+  #
+  # Lookups take no lock.  An entry is never changed once another key has
+  # taken its slot, so a lookup racing an eviction still returns the value
+  # stored under its key.  The reference bit and the hit and miss counts
+  # are updated without the lock too, so the statistics are approximate
+  # under contention.
+  class ClockCache # :nodoc:
+    Entry = Struct.new(:key, :value, :referenced)
+
+    # The maximum number of entries kept in the cache
+    attr_reader :max_size
+
+    def initialize max_size
+      @max_size = max_size
+      @mutex    = Mutex.new
+      clear
+    end
+
+    # Set the maximum number of entries kept in the cache to +size+
+    def max_size= size
+      raise ArgumentError, "cache size must be positive" unless size > 0
+      @mutex.synchronize do
+        if @slots.length > size
+          @slots = @slots.first(size)
+          index  = {}
+          @slots.each { |entry| index[entry.key] = entry }
+          @index = index
+          @hand  = 0
+        end
+        @max_size = size
+      end
+    end
+
+    # Get the value stored under +key+, or nil
+    def [] key
+      if entry = @index[key]
+        entry.referenced = true
+        @hits += 1
+        entry.value
+      else
+        @misses += 1
+        nil
+      end
+    end
+
+    # Store +value+ under +key+, evicting an entry if the cache is full
+    def []= key, value
+      @mutex.synchronize do
+        if entry = @index[key]
+          entry.value = value
+        elsif @slots.length < @max_size
+          @slots << (@index[key] = Entry.new(key, value, false))
+        else
+          evict
+          @slots[@hand] = @index[key] = Entry.new(key, value, false)
+          advance
+        end
+      end
+      value
+    end
+
+    # Remove every entry and reset the statistics
+    def clear
+      @mutex.synchronize do
+        @index = {}
+        @slots = []
+        @hand  = 0
+        @hits = @misses = @evictions = 0
+      end
+    end
+
+    # The number of entries in the cache
+    def length
+      @mutex.synchronize { @slots.length }
+    end
+
+    ###
+    # Get a Hash of the number of :hits, :misses and :evictions since the
+    # cache was last cleared, and its current :size and :max_size.
+    def stats
+      @mutex.synchronize do
+        {
+          :hits      => @hits,
+          :misses    => @misses,
+          :evictions => @evictions,
+          :size      => @slots.length,
+          :max_size  => @max_size
+        }
+      end
+    end
+
+    private
+
+    # Move the hand to the first slot holding an entry that was not
+    # referenced since the last sweep, clearing the entries it passes, and
+    # forget that entry.  The caller reuses the slot.
+    def evict
+      while (entry = @slots[@hand]).referenced
+        entry.referenced = false
+        advance
+      end
+      @index.delete entry.key
+      @evictions += 1
+    end
+
+    def advance
+      @hand += 1
+      @hand = 0 if @hand >= @slots.length
+    end
+  end
+end
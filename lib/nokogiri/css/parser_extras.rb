@@ -1,11 +1,8 @@
-require 'thread'
-
 module Nokogiri
   module CSS
     class Parser < Racc::Parser
       @cache_on = true
-      @cache    = {}
-      @mutex    = Mutex.new
+      @cache    = ClockCache.new(1024)
 
       class << self
         # Turn on CSS parse caching
@@ -13,21 +10,41 @@ module Nokogiri
         alias :cache_on? :cache_on
         alias :set_cache :cache_on=
 
+        # The maximum number of selectors kept in the cache
+        def cache_size
+          @cache.max_size
+        end
+
+        # Set the maximum number of selectors kept in the cache to +size+
+        def cache_size= size
+          @cache.max_size = size
+        end
+
         # Get the css selector in +string+ from the cache
         def [] string
           return unless @cache_on
-          @mutex.synchronize { @cache[string] }
+          @cache[string]
         end
 
-        # Set the css selector in +string+ in the cache to +value+
+        # Set the css selector in +string+ in the cache to +value+.  Once
+        # the cache is full, selectors that have not been looked up since
+        # the clock hand last passed them are evicted.
         def []= string, value
           return value unless @cache_on
-          @mutex.synchronize { @cache[string] = value }
+          @cache[string] = value
         end
 
-        # Clear the cache
+        # Clear the cache and its statistics
         def clear_cache
-          @mutex.synchronize { @cache = {} }
+          @cache.clear
+        end
+
+        ###
+        # Get a Hash of cache statistics: the number of :hits, :misses and
+        # :evictions since the cache was last cleared, and its current
+        # :size and :max_size.
+        def cache_stats
+          @cache.stats
         end
 
         # Execute +block+ without cache
@@ -68,16 +85,31 @@ module Nokogiri
 
       # Get the xpath for +string+ using +options+
       def xpath_for string, options={}
-        key = "#{string}#{options[:ns]}#{options[:prefix]}"
+        prefix  = options[:prefix] || '//'
+        visitor = options[:visitor]
+
+        if visitor
+          return parse(string).map { |ast| ast.to_xpath(prefix, visitor) }
+        end
+
+        # The default namespace is the only part of +namespaces+ that
+        # changes the generated XPath.
+        xmlns = @namespaces.key?('xmlns')
+        key   = [string, prefix, xmlns]
         v = self.class[key]
         return v if v
 
-        args = [
-          options[:prefix] || '//',
-          options[:visitor] || XPathVisitor.new
-        ]
+        # Store a copy of the key that the caller can not modify
+        key = [string.dup.freeze, prefix.dup.freeze, xmlns]
+
+        if XPathVisitor.native?
+          v = CSS.native_xpath_for(string, prefix, xmlns)
+          return self.class[key] = v if v
+        end
+
+        visitor = XPathVisitor.new
         self.class[key] = parse(string).map { |ast|
-          ast.to_xpath(*args)
+          ast.to_xpath(prefix, visitor)
         }
       end
 
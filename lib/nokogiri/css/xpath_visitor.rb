@@ -166,6 +166,21 @@ module Nokogiri
         end
       end
 
+      class << self
+        ###
+        # Can CSS::Parser#xpath_for use the compiler in the C extension,
+        # which mirrors this class?  Not once this class has been reopened
+        # to add or change visit methods.
+        def native?
+          !@modified && CSS.respond_to?(:native_xpath_for)
+        end
+
+        def method_added name # :nodoc:
+          @modified = true
+          super
+        end
+      end
+
     end
   end
 end
@@ -102,15 +102,11 @@ module Nokogiri
               # garbled.
               #
               # EncodingReader aims to perform advanced encoding
-              # detection beyond what Libxml2 does, and to emulate
-              # rewinding of a stream and make Libxml2 redo parsing
-              # from the start when an encoding hint is found.
+              # detection beyond what Libxml2 does.  It looks ahead at
+              # the first chunk of the stream before Libxml2 sees any
+              # of it, and replays that chunk to the parser afterwards.
               string_or_io = EncodingReader.new(string_or_io)
-              begin
-                return read_io(string_or_io, url, encoding, options.to_i)
-              rescue EncodingFound => e
-                encoding = e.found_encoding
-              end
+              encoding = string_or_io.detect_encoding
             end
             return read_io(string_or_io, url, encoding, options.to_i)
           end
@@ -122,118 +118,88 @@ module Nokogiri
 
           read_memory(string_or_io, url, encoding, options.to_i)
         end
-      end
-
-      class EncodingFound < StandardError # :nodoc:
-        attr_reader :found_encoding
-
-        def initialize(encoding)
-          @found_encoding = encoding
-          super("encoding found: %s" % encoding)
-        end
-      end
 
-      class EncodingReader # :nodoc:
-        class SAXHandler < Nokogiri::XML::SAX::Document # :nodoc:
-          def initialize(jumptag)
-            @jumptag = jumptag
-            super()
-          end
-
-          def found(encoding)
-            throw @jumptag, encoding
-          end
-
-          def not_found
-            found nil
-          end
-
-          def start_element(name, attrs = [])
-            case name
-            when /\A(?:div|h1|img|p|br)\z/
-              not_found
-            when 'meta'
-              attr = Hash[attrs]
-              charset = attr['charset'] and
-                found charset
-              http_equiv = attr['http-equiv'] and
-                http_equiv.match(/\AContent-Type\z/i) and
-                content = attr['content'] and
-                m = content.match(/;\s*charset\s*=\s*([\w-]+)/) and
-                found m[1]
+        ###
+        # Parse each of +sources+ into an HTML Document, several at a time.
+        # Takes the same sources and +opts+ as XML::Document.parse_many.
+        # Without an :encoding, the encoding of each source is detected as
+        # Document.parse does.
+        def parse_many sources, opts = {}
+          options = opts[:options] || XML::ParseOptions::DEFAULT_HTML
+          options = Nokogiri::XML::ParseOptions.new(options) if Fixnum === options
+          strings = sources.map { |source| source_string(source) }
+          encodings = strings.map do |string|
+            next opts[:encoding] if opts[:encoding]
+            next nil if string.nil? or string.empty?
+            if string.respond_to?(:encoding) && string.encoding.name != "ASCII-8BIT"
+              next string.encoding.name
             end
+            EncodingReader.detect_encoding(string)
           end
+          read_many(strings, encodings, options, opts[:threads] || 4)
         end
 
-        def self.detect_encoding(chunk)
-          if Nokogiri.jruby? && EncodingReader.is_jruby_without_fix?
-            return EncodingReader.detect_encoding_for_jruby_without_fix(chunk)
-          end
-          m = chunk.match(/\A(<\?xml[ \t\r\n]+[^>]*>)/) and
-            return Nokogiri.XML(m[1]).encoding
+        ###
+        # Parse the HTML file at +filename+.  +encoding+ and +options+ are as
+        # for Document.parse, and the url of the document is +filename+.  The
+        # file is memory mapped and parsed straight from the mapping, without
+        # reading it into a String first.
+        def parse_file filename, encoding = nil, options = XML::ParseOptions::DEFAULT_HTML
+          options = Nokogiri::XML::ParseOptions.new(options) if Fixnum === options
+          # Give the options to the user
+          yield options if block_given?
 
-          if Nokogiri.jruby?
-            m = chunk.match(/(<meta\s)(.*)(charset\s*=\s*([\w-]+))(.*)/i) and
-              return m[4]
+          filename = filename.to_path if filename.respond_to?(:to_path)
+          unless respond_to?(:read_file)
+            return File.open(filename, 'rb') { |io|
+              parse(io, filename, encoding, options)
+            }
           end
-
-          catch(*if RUBY_VERSION < '1.9' then :encoding_found end) { |tag|
-            Nokogiri::HTML::SAX::Parser.new(SAXHandler.new(tag)).parse(chunk)
-            nil
-          }
-        rescue Nokogiri::SyntaxError, RuntimeError
-          # Ignore parser errors that nokogiri may raise
-          nil
+          read_file(filename, filename, encoding, options.to_i)
         end
+      end
 
-        def self.is_jruby_without_fix?
-          JRUBY_VERSION.split('.').join.to_i < 165
-        end
+      class EncodingReader # :nodoc:
+        ###
+        # Detect the encoding declared in the first CHUNK_SIZE bytes of
+        # +chunk+, or return nil.  With libxml2 this is the HTML5 prescan,
+        # implemented natively.
+        def self.detect_encoding(chunk)
+          chunk = chunk[0, CHUNK_SIZE] if chunk.length > CHUNK_SIZE
+          return prescan(chunk) if respond_to?(:prescan)
 
-        def self.detect_encoding_for_jruby_without_fix(chunk)
           m = chunk.match(/\A(<\?xml[ \t\r\n]+[^>]*>)/) and
             return Nokogiri.XML(m[1]).encoding
 
           m = chunk.match(/(<meta\s)(.*)(charset\s*=\s*([\w-]+))(.*)/i) and
             return m[4]
 
-          catch(:encoding_found) {
-            Nokogiri::HTML::SAX::Parser.new(SAXHandler.new(:encoding_found.to_s)).parse(chunk)
-            nil
-          }
+          nil
         rescue Nokogiri::SyntaxError, RuntimeError
           # Ignore parser errors that nokogiri may raise
           nil
         end
 
+        # The number of bytes examined by #detect_encoding
+        CHUNK_SIZE = 4096
+
         def initialize(io)
           @io = io
           @firstchunk = nil
-          @encoding_found = nil
         end
 
-        # This method is used by the C extension so that
-        # Nokogiri::HTML::Document#read_io() does not leak memory when
-        # EncodingFound is raised.
-        attr_reader :encoding_found
+        ###
+        # Read the first chunk of the stream and detect the encoding it
+        # declares, or return nil.  The chunk is handed back by #read.
+        def detect_encoding
+          @firstchunk ||= @io.read(CHUNK_SIZE) || ''
+          EncodingReader.detect_encoding(@firstchunk)
+        end
 
         def read(len)
           # no support for a call without len
 
-          if !@firstchunk
-            @firstchunk = @io.read(len) or return nil
-
-            # This implementation expects that the first call from
-            # htmlReadIO() is made with a length long enough (~1KB) to
-            # achieve advanced encoding detection.
-            if encoding = EncodingReader.detect_encoding(@firstchunk)
-              # The first chunk is stored for the next read in retry.
-              raise @encoding_found = EncodingFound.new(encoding)
-            end
-          end
-          @encoding_found = nil
-
-          ret = @firstchunk.slice!(0, len)
+          ret = @firstchunk ? @firstchunk.slice!(0, len) : ''
           if (len -= ret.length) > 0
             rest = @io.read(len) and ret << rest
           end
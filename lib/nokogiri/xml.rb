@@ -63,6 +63,13 @@ module Nokogiri
         Document.parse(thing, url, encoding, options, &block)
       end
 
+      ###
+      # Parse many XML documents at once.  Convenience method for
+      # Nokogiri::XML::Document.parse_many
+      def parse_many sources, opts = {}
+        Document.parse_many(sources, opts)
+      end
+
       ####
       # Parse a fragment from +string+ in to a NodeSet.
       def fragment string
@@ -11,7 +11,7 @@ module Nokogiri
       undef_method :line if method_defined?(:line)
 
       def inspect
-        "#<#{self.class.name}:#{sprintf("0x%x", object_id)} #{to_s.inspect}>"
+        "#<#{self.class.name}:#{sprintf("0x%x", inspect_id)} #{to_s.inspect}>"
       end
     end
   end
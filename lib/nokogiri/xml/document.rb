@@ -36,6 +36,84 @@ module Nokogiri
         return doc
       end
 
+      ##
+      # Parse the XML file at +filename+.  +encoding+ and +options+ are as
+      # for Document.parse, and the url of the document is +filename+.  The
+      # file is memory mapped and parsed straight from the mapping, without
+      # reading it into a String first.
+      def self.parse_file filename, encoding = nil, options = ParseOptions::DEFAULT_XML
+        options = Nokogiri::XML::ParseOptions.new(options) if Fixnum === options
+        # Give the options to the user
+        yield options if block_given?
+
+        filename = filename.to_path if filename.respond_to?(:to_path)
+        doc = if respond_to?(:read_file)
+          read_file(filename, filename, encoding, options.to_i)
+        else
+          File.open(filename, 'rb') { |io|
+            read_io(io, filename, encoding, options.to_i)
+          }
+        end
+
+        # do xinclude processing
+        doc.do_xinclude(options) if options.xinclude?
+
+        return doc
+      end
+
+      ##
+      # Parse each of +sources+ into a Document, several at a time.  A
+      # source is a String of XML, an object that responds to _read_, or a
+      # Pathname or File whose file is read.  Returns the Documents, each
+      # with its own errors, in the order of +sources+, and raises the
+      # first error that stopped a source from being parsed at all.
+      #
+      # +opts+ may contain :threads, the number of threads parsing at once
+      # with the GVL released (default 4), :encoding, and :options, the
+      # ParseOptions for every source.
+      def self.parse_many sources, opts = {}
+        options = opts[:options] || ParseOptions::DEFAULT_XML
+        options = Nokogiri::XML::ParseOptions.new(options) if Fixnum === options
+        strings = sources.map { |source| source_string(source) }
+        read_many(strings, strings.map { opts[:encoding] }, options, opts[:threads] || 4)
+      end
+
+      def self.source_string source # :nodoc:
+        return source.read if source.respond_to?(:read)
+        return File.open(source.to_path, 'rb') { |f| f.read } if source.respond_to?(:to_path)
+        source
+      end
+
+      def self.read_many strings, encodings, options, threads # :nodoc:
+        docs = Array.new(strings.length)
+
+        # read_memory pukes on empty docs
+        todo = []
+        strings.each_with_index do |string, i|
+          if string.nil? or string.empty?
+            docs[i] = new
+          else
+            todo << i
+          end
+        end
+
+        parsed = if respond_to?(:read_memory_many)
+          read_memory_many(todo.map { |i| strings[i] },
+                           todo.map { |i| encodings[i] }, options.to_i, threads)
+        else
+          todo.map { |i| read_memory(strings[i], nil, encodings[i], options.to_i) }
+        end
+        todo.zip(parsed) do |i, doc|
+          raise doc if Exception === doc
+          docs[i] = doc
+        end
+
+        # do xinclude processing
+        docs.each { |doc| doc.do_xinclude(options) } if options.xinclude?
+
+        docs
+      end
+
       # A list of Nokogiri::XML::SyntaxError found when parsing a document
       attr_accessor :errors
 
@@ -134,6 +212,32 @@ module Nokogiri
         ns
       end
 
+      ##
+      # Yield an XPathContext for +node+ with +namespaces+ and +variables+
+      # registered.  Each Document keeps a pool of native contexts: the
+      # context is only retargeted at +node+, namespace registrations are
+      # kept between queries, and variables are bound for this call only.
+      def with_xpath_context node, namespaces, variables = nil # :nodoc:
+        unless Nokogiri.uses_libxml?
+          ctx = XPathContext.new(node)
+          ctx.register_namespaces(namespaces)
+          variables.each { |k,v| ctx.register_variable k.to_s, v } if variables
+          return yield(ctx)
+        end
+
+        @xpath_contexts ||= []
+        ctx = @xpath_contexts.pop || XPathContext.new(node)
+        begin
+          ctx.node       = node
+          ctx.namespaces = namespaces
+          variables.each { |k,v| ctx.register_variable k.to_s, v } if variables
+          yield ctx
+        ensure
+          ctx.clear_variables if variables
+          @xpath_contexts.push ctx
+        end
+      end
+
       # Get the list of decorators given +key+
       def decorators key
         @decorators ||= Hash.new
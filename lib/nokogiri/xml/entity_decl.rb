@@ -12,7 +12,7 @@ module Nokogiri
       end
 
       def inspect
-        "#<#{self.class.name}:#{sprintf("0x%x", object_id)} #{to_s.inspect}>"
+        "#<#{self.class.name}:#{sprintf("0x%x", inspect_id)} #{to_s.inspect}>"
       end
     end
   end
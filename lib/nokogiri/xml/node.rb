@@ -102,6 +102,7 @@ module Nokogiri
         prefix = "#{implied_xpath_context}/"
 
         xpath(*(paths.map { |path|
+          next path if XPath::Expression === path
           path = path.to_s
           path =~ /^(\.\/|\/|\.\.)/ ? path : CSS.xpath_for(
             path,
@@ -120,6 +121,12 @@ module Nokogiri
       #
       #   node.xpath('.//title')
       #
+      # Each query is compiled once and cached, see XPath::Expression.  A
+      # precompiled XPath::Expression may be passed in place of a String:
+      #
+      #   title = Nokogiri::XML::XPath::Expression.new('.//title')
+      #   node.xpath(title)
+      #
       # A hash of namespace bindings may be appended. For example:
       #
       #   node.xpath('.//foo:name', {'foo' => 'http://example.org/'})
@@ -142,21 +149,27 @@ module Nokogiri
       #     end
       #   }.new)
       #
+      # Queries without custom functions run with the GVL released, so
+      # searches on other threads run alongside them.  The Document must not
+      # be modified while another thread searches it: libxml2 walks the
+      # tree without Ruby's protection, so a node freed meanwhile, such as
+      # the children #content= replaces, would be read after it is freed.
+      #
       def xpath *paths
         return NodeSet.new(document) unless document
 
         paths, handler, ns, binds = extract_params(paths)
 
-        sets = paths.map { |path|
-          ctx = XPathContext.new(self)
-          ctx.register_namespaces(ns)
-          path = path.gsub(/\/xmlns:/,'/:') unless Nokogiri.uses_libxml?
-
-          binds.each do |key,value|
-            ctx.register_variable key.to_s, value
-          end if binds
+        sets = document.with_xpath_context(self, ns, binds) { |ctx|
+          paths.map { |path|
+            if Nokogiri.uses_libxml?
+              path = XPath::Expression[path] unless handler
+            else
+              path = path.to_s.gsub(/\/xmlns:/,'/:')
+            end
 
-          ctx.evaluate(path, handler)
+            ctx.evaluate(path, handler)
+          }
         }
         return sets.first if sets.length == 1
 
@@ -735,6 +748,12 @@ module Nokogiri
       #     config.format.as_xml
       #   end
       #
+      # A node of an XML document is formatted with the GVL released when
+      # neither +:encoding+ nor the document's encoding is set, including by
+      # #to_s and #to_xml.  The Document must not be modified meanwhile from
+      # another thread, since a node freed under the serializer would be
+      # read after it is freed.
+      #
       def serialize *args, &block
         options = args.first.is_a?(Hash) ? args.shift : {
           :encoding   => args[0],
@@ -748,6 +767,13 @@ module Nokogiri
         if encoding && outstring.respond_to?(:force_encoding)
           outstring.force_encoding(Encoding.find(encoding))
         end
+
+        if Nokogiri.uses_libxml?
+          # native_write_to appends straight to a String
+          write_to outstring, options, &block
+          return outstring
+        end
+
         io = StringIO.new(outstring)
         write_to io, options, &block
         io.string
@@ -801,7 +827,8 @@ module Nokogiri
       #
       # * +:encoding+ for changing the encoding
       # * +:indent_text+ the indentation text, defaults to one space
-      # * +:indent+ the number of +:indent_text+ to use, defaults to 2
+      # * +:indent+ the number of +:indent_text+ to use, defaults to 2.  An
+      #   indentation longer than 60 bytes is left out
       # * +:save_with+ a combination of SaveOptions constants.
       #
       # To save with UTF-8 indented twice:
@@ -901,7 +928,7 @@ module Nokogiri
       def extract_params params # :nodoc:
         # Pop off our custom function handler if it exists
         handler = params.find { |param|
-          ![Hash, String, Symbol].include?(param.class)
+          ![Hash, String, Symbol, XPath::Expression].include?(param.class)
         }
 
         params -= [handler] if handler
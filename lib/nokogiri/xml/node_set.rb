@@ -69,23 +69,14 @@ module Nokogiri
       # For more information see Nokogiri::XML::Node#css and
       # Nokogiri::XML::Node#xpath
       def search *paths
-        handler = ![
-          Hash, String, Symbol
-        ].include?(paths.last.class) ? paths.pop : nil
+        paths, handler, ns, binds = extract_params(paths)
 
-        ns = paths.last.is_a?(Hash) ? paths.pop : nil
+        paths = paths.map { |path|
+          next path if XPath::Expression === path
+          path =~ /^(\.\/|\/)/ ? path : css_xpaths([path], ns)
+        }.flatten
 
-        sub_set = NodeSet.new(document)
-
-        paths.each do |path|
-          sub_set += send(
-            path =~ /^(\.\/|\/)/ ? :xpath : :css,
-            *(paths + [ns, handler]).compact
-          )
-        end
-
-        document.decorate(sub_set)
-        sub_set
+        evaluate paths, ns, handler, binds
       end
       alias :/ :search
 
@@ -94,29 +85,9 @@ module Nokogiri
       #
       # For more information see Nokogiri::XML::Node#css
       def css *paths
-        handler = ![
-          Hash, String, Symbol
-        ].include?(paths.last.class) ? paths.pop : nil
-
-        ns = paths.last.is_a?(Hash) ? paths.pop : nil
-
-        sub_set = NodeSet.new(document)
+        paths, handler, ns, binds = extract_params(paths)
 
-        each do |node|
-          doc = node.document
-          search_ns = ns || (doc.root ? doc.root.namespaces : {})
-
-          xpaths = paths.map { |rule|
-            [
-              CSS.xpath_for(rule.to_s, :prefix => ".//", :ns => search_ns),
-              CSS.xpath_for(rule.to_s, :prefix => "self::", :ns => search_ns)
-            ].join(' | ')
-          }
-
-          sub_set += node.xpath(*(xpaths + [search_ns, handler].compact))
-        end
-        document.decorate(sub_set)
-        sub_set
+        evaluate css_xpaths(paths, ns), ns, handler, binds
       end
 
       ###
@@ -124,18 +95,9 @@ module Nokogiri
       #
       # For more information see Nokogiri::XML::Node#xpath
       def xpath *paths
-        handler = ![
-          Hash, String, Symbol
-        ].include?(paths.last.class) ? paths.pop : nil
-
-        ns = paths.last.is_a?(Hash) ? paths.pop : nil
+        paths, handler, ns, binds = extract_params(paths)
 
-        sub_set = NodeSet.new(document)
-        each do |node|
-          sub_set += node.xpath(*(paths + [ns, handler].compact))
-        end
-        document.decorate(sub_set)
-        sub_set
+        evaluate paths, ns, handler, binds
       end
 
       ###
@@ -232,11 +194,31 @@ module Nokogiri
         self
       end
 
-      ###
-      # Iterate over each node, yielding  to +block+
-      def each(&block)
-        0.upto(length - 1) do |x|
-          yield self[x]
+      unless Nokogiri.uses_libxml?
+        ###
+        # Iterate over each node, yielding  to +block+
+        def each(&block)
+          0.upto(length - 1) do |x|
+            yield self[x]
+          end
+        end
+
+        ###
+        # Get the value of attribute +name+ on each node
+        def pluck name
+          map { |node| node[name] }
+        end
+
+        ###
+        # Get the text content of each node
+        def texts
+          map { |node| node.text }
+        end
+
+        ###
+        # Get the name of each node
+        def names
+          map { |node| node.name }
         end
       end
 
@@ -352,6 +334,69 @@ module Nokogiri
       end
 
       alias :+ :|
+      alias :union :|
+      alias :difference :-
+      alias :intersection :&
+
+      private
+
+      ###
+      # Translate CSS +rules+ into XPath queries that match each node in
+      # this NodeSet and its descendants.
+      def css_xpaths rules, ns
+        ns ||= document.root ? document.root.namespaces : {}
+        rules.map { |rule|
+          [
+            CSS.xpath_for(rule.to_s, :prefix => ".//", :ns => ns),
+            CSS.xpath_for(rule.to_s, :prefix => "self::", :ns => ns)
+          ].join(' | ')
+        }
+      end
+
+      ###
+      # Split search arguments into paths, a custom function handler,
+      # namespace bindings and variable bindings, as Node#xpath does.
+      def extract_params params
+        handler = params.find { |param|
+          ![Hash, String, Symbol, XPath::Expression].include?(param.class)
+        }
+        params -= [handler] if handler
+
+        hashes = []
+        while Hash === params.last || params.last.nil?
+          hashes << params.pop
+          break if params.empty?
+        end
+
+        ns, binds = hashes.reverse
+        [params, handler, ns, binds]
+      end
+
+      ###
+      # Evaluate XPath +paths+ against every node in this NodeSet, returning
+      # a single NodeSet.  With libxml2 each query is evaluated natively,
+      # compiled once unless +handler+ is given; the result is in document
+      # order.
+      def evaluate paths, ns, handler, binds
+        ns ||= document.root ? document.root.namespaces : {}
+
+        unless Nokogiri.uses_libxml?
+          sub_set = NodeSet.new(document)
+          each do |node|
+            sub_set += node.xpath(*(paths + [ns, binds, handler].compact))
+          end
+          document.decorate(sub_set)
+          return sub_set
+        end
+
+        context = find { |node| Node === node }
+        return NodeSet.new(document) unless context
+
+        paths = paths.map { |path| XPath::Expression[path] } unless handler
+        document.with_xpath_context(context, ns, binds) { |ctx|
+          ctx.evaluate_set(self, paths, handler)
+        }
+      end
     end
   end
 end
@@ -13,12 +13,12 @@ module Nokogiri
           }.map { |attribute|
             "#{attribute.to_s.sub(/_\w+/, 's')}=#{send(attribute).inspect}"
           }.join ' '
-          "#<#{self.class.name}:#{sprintf("0x%x", object_id)} #{attributes}>"
+          "#<#{self.class.name}:#{sprintf("0x%x", inspect_id)} #{attributes}>"
         end
 
         def pretty_print pp # :nodoc:
           nice_name = self.class.name.split('::').last
-          pp.group(2, "#(#{nice_name}:#{sprintf("0x%x", object_id)} {", '})') do
+          pp.group(2, "#(#{nice_name}:#{sprintf("0x%x", inspect_id)} {", '})') do
 
             pp.breakable
             attrs = inspect_attributes.map { |t|
@@ -50,6 +50,16 @@ module Nokogiri
 
           end
         end
+
+        private
+
+        ###
+        # The id shown by inspect.  A node that is not referenced from Ruby
+        # may get a new wrapper later, so nodes are identified by the
+        # underlying node rather than by the wrapper.
+        def inspect_id
+          respond_to?(:pointer_id) ? pointer_id : object_id
+        end
       end
     end
   end
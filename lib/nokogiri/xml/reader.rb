@@ -84,14 +84,6 @@ module Nokogiri
       end
       private :initialize
 
-      ###
-      # Get a list of attributes for the current node.
-      def attributes
-        Hash[attribute_nodes.map { |node|
-          [node.name, node.to_s]
-        }].merge(namespaces || {})
-      end
-
       ###
       # Get a list of attributes for the current node
       def attribute_nodes
@@ -107,6 +99,54 @@ module Nokogiri
           yield cursor
         end
       end
+
+      unless Nokogiri.uses_libxml?
+        ###
+        # Get a list of attributes for the current node.
+        def attributes
+          Hash[attribute_nodes.map { |node|
+            [node.name, node.to_s]
+          }].merge(namespaces || {})
+        end
+
+        ###
+        # Create a new reader that parses the file at +path+.  +url+
+        # defaults to +path+.
+        def self.from_file path, url = nil, encoding = nil, options = 0
+          path = path.to_path if path.respond_to?(:to_path)
+          from_io(File.open(path, 'rb'), url || path, encoding, options)
+        end
+
+        ###
+        # Move forward and return the node as a frozen Array of
+        # [node_type, name, depth, value, attributes?, empty_element?]
+        def read_record
+          return nil unless read
+          [node_type, name, depth, value, attributes?, empty_element?].freeze
+        end
+
+        ###
+        # Yield #read_record for each remaining node
+        def each_record
+          return enum_for(:each_record) unless block_given?
+          while record = read_record
+            yield record
+          end
+          self
+        end
+
+        ###
+        # Yield each element named +name+ as an Element in a Document of
+        # its own.
+        def each_subtree name
+          return enum_for(:each_subtree, name) unless block_given?
+          each do |node|
+            next unless node.node_type == TYPE_ELEMENT
+            next unless node.name == name || node.local_name == name
+            yield Nokogiri::XML(node.outer_xml).root
+          end
+        end
+      end
     end
   end
 end
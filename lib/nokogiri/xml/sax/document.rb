@@ -68,6 +68,23 @@ module Nokogiri
       # You can use this event handler for any SAX style parser included with
       # Nokogiri.  See Nokogiri::XML::SAX, and Nokogiri::HTML::SAX.
       class Document
+        # The number of arguments each event takes in a batch passed to
+        # #events
+        EVENT_ARITY = {
+          :xmldecl                  => 3,
+          :start_document           => 0,
+          :end_document             => 0,
+          :start_element            => 2,
+          :end_element              => 1,
+          :start_element_namespace  => 5,
+          :end_element_namespace    => 3,
+          :characters               => 1,
+          :comment                  => 1,
+          :warning                  => 1,
+          :error                    => 1,
+          :cdata_block              => 1,
+        }
+
         ###
         # Called when an XML declaration is parsed
         def xmldecl version, encoding, standalone
@@ -158,6 +175,24 @@ module Nokogiri
         # +string+ contains the cdata content
         def cdata_block string
         end
+
+        ###
+        # Called with a batch of events when the parser's +batch_size+ is
+        # set.  +batch+ is a flat Array: each event's name as a Symbol,
+        # followed by its arguments (see EVENT_ARITY), e.g.:
+        #
+        #   [:start_element, "p", [], :characters, "hi", :end_element, "p"]
+        #
+        # The default implementation calls the method for each event.
+        def events batch
+          i = 0
+          while i < batch.length
+            event = batch[i]
+            arity = EVENT_ARITY[event]
+            send event, *batch[i + 1, arity]
+            i += arity + 1
+          end
+        end
       end
     end
   end
@@ -66,10 +66,51 @@ module Nokogiri
         # The encoding beings used for this document.
         attr_accessor :encoding
 
+        ###
+        # Send events to #document in lean mode.  In lean mode:
+        #
+        # * Callbacks that a Nokogiri::XML::SAX::Document subclass does not
+        #   override are not called at all.  A document that only overrides
+        #   start_element and end_element gets them without going through
+        #   start_element_namespace and end_element_namespace.
+        # * Element, attribute and namespace names are frozen Strings,
+        #   shared for the whole parse.
+        # * Attributes are a flat list rather than a list of pairs or of
+        #   Attribute objects.  start_element gets
+        #   <tt>[name, value, name, value, ...]</tt>;
+        #   start_element_namespace gets
+        #   <tt>[localname, prefix, uri, value, ...]</tt> and its namespaces
+        #   as <tt>[prefix, uri, ...]</tt>, so its default implementation
+        #   must not be called with super.
+        attr_accessor :lean
+
+        ###
+        # Deliver events to #document in batches of up to +batch_size+
+        # events through Nokogiri::XML::SAX::Document#events, which is
+        # called once per batch instead of once per event.  Any remaining
+        # events are delivered when the document ends.  nil, the default,
+        # sends each event as it happens.
+        attr_accessor :batch_size
+
+        ###
+        # Collect the text that libxml2 reports in fragments and call
+        # Nokogiri::XML::SAX::Document#characters once per contiguous run
+        # of text, just before the next element, comment or CDATA event.
+        attr_accessor :coalesce_characters
+
+        ###
+        # Coalesce characters, and drop runs of text that are only
+        # whitespace.
+        attr_accessor :drop_whitespace
+
         # Create a new Parser with +doc+ and +encoding+
         def initialize doc = Nokogiri::XML::SAX::Document.new, encoding = 'UTF-8'
           @encoding = encoding
           @document = doc
+          @lean     = false
+          @batch_size = nil
+          @coalesce_characters = false
+          @drop_whitespace = false
           @warned   = false
         end
 
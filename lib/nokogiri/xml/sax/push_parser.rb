@@ -23,17 +23,46 @@ module Nokogiri
       #   parser << "/div>"
       #   parser.finish
       class PushParser
+        # Raised by read_nonblock when it would block, including
+        # OpenSSL::SSL::SSLErrorWaitReadable and friends where they exist
+        if defined?(IO::WaitReadable)
+          WAIT_READABLE = [IO::WaitReadable, Errno::EINTR] # :nodoc:
+          WAIT_WRITABLE = [IO::WaitWritable]               # :nodoc:
+        else
+          WAIT_READABLE = [Errno::EAGAIN, Errno::EWOULDBLOCK, Errno::EINTR] # :nodoc:
+          WAIT_WRITABLE = [] # :nodoc:
+        end
 
         # The Nokogiri::XML::SAX::Document on which the PushParser will be
         # operating
         attr_accessor :document
 
+        # Send events to #document in lean mode.  See
+        # Nokogiri::XML::SAX::Parser#lean.
+        attr_accessor :lean
+
+        # Send events to #document in batches.  Events are also delivered
+        # at the end of each #write.  See
+        # Nokogiri::XML::SAX::Parser#batch_size.
+        attr_accessor :batch_size
+
+        # Deliver each run of text with a single characters call.  See
+        # Nokogiri::XML::SAX::Parser#coalesce_characters.
+        attr_accessor :coalesce_characters
+
+        # Coalesce characters, and drop whitespace only text.
+        attr_accessor :drop_whitespace
+
         ###
         # Create a new PushParser with +doc+ as the SAX Document, providing
         # an optional +file_name+ and +encoding+
         def initialize(doc = XML::SAX::Document.new, file_name = nil, encoding = 'UTF-8')
           @document = doc
           @encoding = encoding
+          @lean = false
+          @batch_size = nil
+          @coalesce_characters = false
+          @drop_whitespace = false
           @sax_parser = XML::SAX::Parser.new(doc)
 
           ## Create our push parser context
@@ -42,7 +71,9 @@ module Nokogiri
 
         ###
         # Write a +chunk+ of XML to the PushParser.  Any callback methods
-        # that can be called will be called immediately.
+        # that can be called will be called immediately.  The GVL is
+        # released while the chunk is parsed, and the callbacks for the
+        # chunk are called once it has been parsed.
         def write chunk, last_chunk = false
           native_write(chunk, last_chunk)
         end
@@ -54,6 +85,45 @@ module Nokogiri
         def finish
           write '', true
         end
+
+        ###
+        # Read XML from +io+ as it arrives and parse it, until the end of
+        # +io+, then #finish.  While +io+ has nothing to read the parser
+        # waits in IO.select, so other threads, or other fibers under a
+        # fiber scheduler, keep running.
+        def feed_from io
+          until (status = feed_from_nonblock(io)) == true
+            if status == :wait_writable
+              IO.select(nil, [io])
+            else
+              IO.select([io])
+            end
+          end
+          self
+        end
+
+        ###
+        # Parse whatever can be read from +io+ without blocking.  Returns
+        # :wait_readable when +io+ has nothing more to read for now, or
+        # true when the end of +io+ has been reached and the parser has
+        # been finished.  An SSL socket may return :wait_writable while it
+        # renegotiates.  Use this to multiplex many streams with IO.select.
+        def feed_from_nonblock io
+          size = Nokogiri.uses_libxml? ? Nokogiri.io_buffer_size : 64 * 1024
+          loop do
+            begin
+              chunk = io.read_nonblock(size)
+            rescue EOFError
+              finish
+              return true
+            rescue *WAIT_WRITABLE
+              return :wait_writable
+            rescue *WAIT_READABLE
+              return :wait_readable
+            end
+            write chunk
+          end
+        end
       end
     end
   end
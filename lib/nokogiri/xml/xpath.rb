@@ -1,4 +1,5 @@
 require 'nokogiri/xml/xpath/syntax_error'
+require 'nokogiri/xml/xpath/expression'
 
 module Nokogiri
   module XML
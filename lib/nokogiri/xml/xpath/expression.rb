@@ -0,0 +1,83 @@
+module Nokogiri
+  module XML
+    class XPath
+      ###
+      # An Expression is an XPath query that has been compiled once and may
+      # be evaluated many times, against any Document.  Anywhere Node#xpath,
+      # NodeSet#xpath or Node#at_xpath accept a String, an Expression may be
+      # used instead:
+      #
+      #   titles = Nokogiri::XML::XPath::Expression.new('.//title')
+      #   docs.each { |doc| doc.xpath(titles) }
+      #
+      # Namespace prefixes, variables and custom functions are bound when
+      # the Expression is evaluated, not when it is compiled.  When a custom
+      # function handler is given, the source is compiled again for that
+      # evaluation so that the handler's functions never stay bound to an
+      # Expression other queries share.
+      class Expression
+        @cache_on = true
+        @cache    = ClockCache.new(1024)
+
+        class << self
+          # Turn on compiled expression caching
+          attr_accessor :cache_on
+          alias :cache_on? :cache_on
+          alias :set_cache :cache_on=
+
+          # The maximum number of expressions kept in the cache
+          def cache_size
+            @cache.max_size
+          end
+
+          # Set the maximum number of expressions kept in the cache to +size+
+          def cache_size= size
+            @cache.max_size = size
+          end
+
+          ###
+          # Get the compiled Expression for +string+, compiling it and
+          # storing it in the process wide cache if it isn't there yet.
+          # Once the cache is full, expressions that have not been looked
+          # up since the clock hand last passed them are evicted.
+          def [] string
+            return string if Expression === string
+            return new(string) unless @cache_on
+
+            @cache[string] || (@cache[string.dup.freeze] = new(string))
+          end
+
+          # Clear the cache and its statistics
+          def clear_cache
+            @cache.clear
+          end
+
+          ###
+          # Get a Hash of cache statistics: the number of :hits, :misses and
+          # :evictions since the cache was last cleared, and its current
+          # :size and :max_size.
+          def cache_stats
+            @cache.stats
+          end
+
+          # Execute +block+ without cache
+          def without_cache &block
+            tmp = @cache_on
+            @cache_on = false
+            block.call
+            @cache_on = tmp
+          end
+        end
+
+        # The XPath source this Expression was compiled from
+        attr_reader :source
+        alias :to_s :source
+        alias :to_str :source
+
+        def inspect # :nodoc:
+          "#<#{self.class.name} #{source.inspect}>"
+        end
+      end
+    end
+  end
+end
@@ -11,6 +11,17 @@ module Nokogiri
         end
       end
 
+      ###
+      # Replace the registered namespaces with +namespaces+.  Nothing is
+      # done if +namespaces+ are the ones already registered, so a pooled
+      # context only pays for registration when the bindings change.
+      def namespaces= namespaces
+        return if @namespaces == namespaces
+        clear_namespaces if @namespaces
+        register_namespaces(namespaces)
+        @namespaces = namespaces.dup
+      end
+
     end
   end
 end
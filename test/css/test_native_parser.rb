@@ -0,0 +1,75 @@
+require "helper"
+
+module Nokogiri
+  module CSS
+    class TestNativeParser < Nokogiri::TestCase
+      SELECTORS = [
+        'x', '*', '|a', 'aaron|a', 'x y', 'x > y', 'x/y', 'x//y', 'E + F G',
+        'E ~ F G', 'x > y, y > z', 'x > y,y > z', '#foo', '.a.b', '*.pastoral',
+        'foo .awesome', ':link', 'a:active.foo', 'a:first', 'a:last()',
+        'a:parent', 'a:empty', 'a:only-child', 'a:only-of-type', 'a:eq(99)',
+        'a:nth(99)', 'a:first-child', 'a:last-child', 'a:nth-child(99)',
+        'a:nth-last-child(1)', 'a:nth-last-child(99)', 'a:nth-of-type(2n)',
+        'a:nth-of-type(2n+1)', 'a:nth-of-type(even)', 'a:nth-of-type(odd)',
+        'a:nth-of-type(-n+3)', 'a:nth-of-type(-1n+3)', 'a:nth-last-of-type(n+3)',
+        'a:nth-last-of-type(4n+3)', 'a:nth-last-of-type(99)', 'a:nth-child(2n+1)',
+        'a[2]', 'a:has(b)', 'a:has(b > c)', "a[@class|='bar']",
+        "a[@class ~= 'bar']", "a[id^='Boing']", "a[id $= 'Boing']",
+        "a[text()*='Boing']", "a[text() != 'Boing']", 'a[text()]', 'text()',
+        'script comment()', 'text():nth-of-type(99)', "h1[a='Tender Lovemaking']",
+        "a[@id='Boing'] div", '#p:not(.a)', 'p.a:not(.b)', "p[a='foo']:not(.b)",
+        'ol > *:not(li)', 'ol > *:not(:last-child)', 'a:foo(@href)',
+        'a:foo(@a, b)', 'a:foo(a, 10)', 'a:aaron', 'a:aaron(12, 1)',
+        "a[href=foo]", 'tr:nth-child(odd) td:first-child', 'div p:last-of-type',
+        'a [b]', 'ns|a.b:not(c)', 'a:contains("x")', 'a:gt(2)', '::not(b)',
+      ]
+
+      def setup
+        super
+        skip 'no native CSS compiler' unless CSS.respond_to?(:native_xpath_for)
+      end
+
+      def ruby_xpath selector, ns = {}
+        Parser.new(ns).parse(selector).map { |ast| ast.to_xpath('//') }
+      end
+
+      def test_matches_ruby_implementation
+        SELECTORS.each do |selector|
+          assert_equal ruby_xpath(selector),
+                       CSS.native_xpath_for(selector, '//', false),
+                       selector
+        end
+      end
+
+      def test_default_namespace
+        ns = { 'xmlns' => 'http://example.com/' }
+        ['a', 'a b.c', 'x|a', '*'].each do |selector|
+          assert_equal ruby_xpath(selector, ns),
+                       CSS.native_xpath_for(selector, '//', true),
+                       selector
+        end
+      end
+
+      def test_prefix
+        assert_equal ['.//a/b'], CSS.native_xpath_for('a > b', './/', false)
+      end
+
+      def test_syntax_errors_are_left_to_ruby
+        ["'", 'a[x=]', 'a ', ':nth-child(2m+1)'].each do |selector|
+          assert_nil CSS.native_xpath_for(selector, '//', false)
+        end
+        assert_raises(CSS::SyntaxError) { CSS.xpath_for('a[x=]') }
+      end
+
+      def test_custom_visitor_is_used
+        visitor = Class.new(XPathVisitor) do
+          def visit_pseudo_class_aaron node
+            'aaron() = 1'
+          end
+        end.new
+        assert_equal ['//a[aaron() = 1]'],
+                     Parser.new.xpath_for('a:aaron', :visitor => visitor)
+      end
+    end
+  end
+end
@@ -130,6 +130,29 @@ module Nokogiri
               ]]
           ], @parser.document.start_elements
         end
+
+        if Nokogiri.uses_libxml?
+          def test_lean_flat_attributes
+            doc = Class.new(XML::SAX::Document) {
+              attr_reader :starts
+              def start_element name, attrs = []
+                (@starts ||= []) << [name, attrs]
+              end
+            }.new
+            parser = HTML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.parse("<html><body><p class='a' id=b>x</p><p class='c'></p></body></html>")
+
+            assert_equal [
+              ['html', []],
+              ['body', []],
+              ['p', ['class', 'a', 'id', 'b']],
+              ['p', ['class', 'c']],
+            ], doc.starts
+            assert doc.starts[2][0].frozen?
+            assert_equal doc.starts[2][1][0].object_id, doc.starts[3][1][0].object_id
+          end
+        end
       end
     end
   end
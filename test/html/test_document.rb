@@ -258,6 +258,23 @@ eohtml
         }
       end
 
+      def test_parse_file
+        html = Document.parse_file(HTML_FILE)
+        assert html.html?
+        assert_equal HTML_FILE, html.url
+        assert_equal Nokogiri::HTML(File.read(HTML_FILE)).xpath('//div/a').length,
+          html.xpath('//div/a').length
+      end
+
+      def test_parse_many
+        sources = ['<p>one', '', "<meta charset='iso-8859-1'><p>caf\xe9".force_encoding('BINARY')]
+        docs = Nokogiri::HTML.parse_many(sources, :threads => 2)
+        assert_equal ['one', "caf\u00e9"], [docs[0], docs[2]].map { |d| d.at('p').text }
+        assert_equal 'iso-8859-1', docs[2].encoding
+        assert_nil docs[1].root
+        assert docs.all? { |d| d.html? }
+      end
+
       def test_parse_temp_file
         temp_html_file = Tempfile.new("TEMP_HTML_FILE")
         File.open(HTML_FILE, 'rb') { |f| temp_html_file.write f.read }
@@ -296,6 +313,17 @@ eohtml
         assert html.errors.length > 0
       end
 
+      def test_parse_in_threads
+        docs = (1..4).map { |i|
+          Thread.new { Nokogiri::HTML("<p>" * i + "<div foo=\"bar>") }
+        }.map { |t| t.value }
+
+        docs.each_with_index do |doc, i|
+          assert doc.errors.length > 0
+          assert_equal i + 1, doc.css('p').length
+        end
+      end
+
       def test_relative_css
         html = Nokogiri::HTML(<<-eohtml)
         <html>
@@ -102,6 +102,12 @@ module Nokogiri
         assert_equal 'たこ焼き仮面', html.title
       end
 
+      def test_document_html_charset_from_file
+        html = Nokogiri::HTML::Document.parse_file(METACHARSET_FILE)
+        assert_equal 'iso-2022-jp', html.encoding
+        assert_equal 'たこ焼き仮面', html.title
+      end
+
       def test_document_xhtml_enc
         [ENCODING_XHTML_FILE, ENCODING_HTML_FILE].each { |file|
           doc_from_string_enc = Nokogiri::HTML(binread(file), nil, 'Shift_JIS')
@@ -133,6 +139,82 @@ module Nokogiri
           assert_equal(evil, ary_from_file)
         }
       end
+
+      def test_document_html_charset_from_io
+        io = StringIO.new('<html><head><meta charset="EUC-JP"></head>' +
+                          '<body><p>x</p></body></html>')
+        assert_equal 'EUC-JP', Nokogiri::HTML(io).encoding
+      end
+
+      def test_detect_encoding_stops_after_first_chunk
+        reader = Nokogiri::HTML::Document::EncodingReader
+        body = '<p>x</p>' * 2000
+        assert_nil reader.detect_encoding(body + '<meta charset="iso-8859-1">')
+        assert_equal 'iso-8859-1',
+          reader.detect_encoding('<meta charset="iso-8859-1">' + body)
+      end
+
+      def test_parse_honours_byte_order_mark
+        html = "\xEF\xBB\xBF<html><head><meta charset=\"ISO-8859-1\"></head>" +
+               "<body><p>caf\xC3\xA9</p></body></html>"
+        html.force_encoding('ASCII-8BIT') if html.respond_to?(:force_encoding)
+        text = "caf\xC3\xA9"
+        text.force_encoding('UTF-8') if text.respond_to?(:force_encoding)
+
+        [html, StringIO.new(html)].each do |source|
+          doc = Nokogiri::HTML::Document.parse(source)
+          assert_equal 'UTF-8', doc.encoding
+          assert_equal text, doc.at('p').text
+        end
+      end
+
+      if Nokogiri.uses_libxml?
+        def prescan(chunk)
+          Nokogiri::HTML::Document::EncodingReader.prescan(chunk)
+        end
+
+        def test_prescan_byte_order_mark
+          assert_equal 'UTF-8', prescan("\xEF\xBB\xBF<html>")
+          assert_equal 'UTF-16LE', prescan("\xFF\xFE<\0h\0")
+        end
+
+        def test_prescan_meta_charset
+          assert_equal 'Shift_JIS', prescan('<head><meta charset=Shift_JIS>')
+          assert_equal 'euc-jp', prescan('<meta   charset = "euc-jp" />')
+        end
+
+        def test_prescan_http_equiv
+          assert_equal 'EUC-JP', prescan(
+            %q{<meta http-equiv="Content-Type" content="text/html; charset='EUC-JP'">})
+          assert_nil prescan('<meta content="text/html; charset=EUC-JP">')
+        end
+
+        def test_prescan_skips_comments_and_attributes
+          assert_nil prescan('<!-- <meta charset=euc-jp> -->')
+          assert_equal 'koi8-r',
+            prescan('<div title="<meta charset=euc-jp>"><meta charset=koi8-r>')
+        end
+
+        def test_prescan_ignores_unknown_labels
+          assert_equal 'iso-8859-2',
+            prescan('<meta charset=bogus><meta charset=iso-8859-2>')
+        end
+
+        def test_prescan_ignores_labels_with_nul
+          assert_nil prescan(%Q{<meta charset="ut\0f-8">})
+          assert_instance_of Nokogiri::HTML::Document,
+            Nokogiri::HTML(%Q{<meta charset="ut\0f-8"><p>x</p>})
+        end
+
+        def test_prescan_utf16_meta_means_utf8
+          assert_equal 'UTF-8', prescan('<meta charset=utf-16>')
+        end
+
+        def test_prescan_xml_declaration
+          assert_equal 'ISO-8859-1',
+            prescan(%q{<?xml version="1.0" encoding="ISO-8859-1"?><html>})
+        end
+      end
     end
   end
 end
@@ -7,28 +7,23 @@ class TestCssCache < Nokogiri::TestCase
     @css = "a1 > b2 > c3"
     @parse_result = Nokogiri::CSS.parse(@css)
     @to_xpath_result = @parse_result.map {|ast| ast.to_xpath}
-    Nokogiri::CSS::Parser.class_eval do
-      class << @cache
-        alias :old_bracket :[]
-        attr_reader :count
-        def [](key)
-          @count ||= 0
-          @count += 1
-          old_bracket(key)
-        end
-      end
-    end
+    Nokogiri::CSS::Parser.clear_cache
     assert Nokogiri::CSS::Parser.cache_on?
   end
 
   def teardown
+    Nokogiri::CSS::Parser.cache_size = 1024
     Nokogiri::CSS::Parser.clear_cache
     Nokogiri::CSS::Parser.set_cache true
   end
 
+  def stats
+    Nokogiri::CSS::Parser.cache_stats
+  end
+
   [ false, true ].each do |cache_setting|
     define_method "test_css_cache_#{cache_setting ? "true" : "false"}" do
-      times = cache_setting ? 4 : nil
+      times = cache_setting ? 4 : 0
 
       Nokogiri::CSS::Parser.set_cache cache_setting
 
@@ -37,9 +32,77 @@ class TestCssCache < Nokogiri::TestCase
       Nokogiri::CSS::Parser.new.xpath_for(@css)
       Nokogiri::CSS::Parser.new.xpath_for(@css)
 
-      assert_equal(times, Nokogiri::CSS::Parser.class_eval { @cache.count })
+      assert_equal(times, stats[:hits] + stats[:misses])
     end
   end
 
+  def test_stats
+    3.times { Nokogiri::CSS.xpath_for(@css) }
+    Nokogiri::CSS.xpath_for(@css, :prefix => './/')
+    assert_equal 2, stats[:hits]
+    assert_equal 2, stats[:misses]
+    assert_equal 0, stats[:evictions]
+    assert_equal 2, stats[:size]
+    assert_equal 1024, stats[:max_size]
+  end
+
+  def test_cache_is_bounded
+    Nokogiri::CSS::Parser.cache_size = 4
+    10.times { |i| Nokogiri::CSS.xpath_for("a#{i}") }
+    assert_equal 4, stats[:size]
+    assert_equal 6, stats[:evictions]
+  end
+
+  def test_shrinking_the_cache_drops_entries
+    10.times { |i| Nokogiri::CSS.xpath_for("a#{i}") }
+    Nokogiri::CSS::Parser.cache_size = 4
+    assert_equal 4, stats[:size]
+    10.times { |i| Nokogiri::CSS.xpath_for("b#{i}") }
+    assert_equal 4, stats[:size]
+  end
+
+  def test_concurrent_eviction
+    Nokogiri::CSS::Parser.cache_size = 8
+    4.times.map {
+      Thread.new {
+        200.times { |i|
+          assert_equal ["//a#{i % 16}"], Nokogiri::CSS.xpath_for("a#{i % 16}")
+        }
+      }
+    }.each { |thread| thread.join }
+    assert_equal 8, stats[:size]
+  end
 
+  def test_referenced_selectors_survive_eviction
+    Nokogiri::CSS::Parser.cache_size = 4
+    Nokogiri::CSS.xpath_for(@css)
+    10.times { |i|
+      Nokogiri::CSS.xpath_for("a#{i}")
+      Nokogiri::CSS.xpath_for(@css)
+    }
+    assert_equal 1, stats[:misses] - 10
+  end
+
+  def test_key_includes_default_namespace
+    assert_equal ['//a'], Nokogiri::CSS.xpath_for('a')
+    assert_equal ['//xmlns:a'],
+      Nokogiri::CSS.xpath_for('a', :ns => { 'xmlns' => 'http://example.com/' })
+  end
+
+  def test_custom_visitor_is_not_cached
+    Nokogiri::CSS.xpath_for('a', :visitor => Nokogiri::CSS::XPathVisitor.new)
+    assert_equal 0, stats[:size]
+  end
+
+  def test_key_is_not_shared_with_caller
+    css = 'a'
+    Nokogiri::CSS.xpath_for(css)
+    css << 'b'
+    assert_equal ['//a'], Nokogiri::CSS.xpath_for('a')
+    assert_equal 1, stats[:hits]
+  end
+
+  def test_cache_size_must_be_positive
+    assert_raises(ArgumentError) { Nokogiri::CSS::Parser.cache_size = 0 }
+  end
 end
@@ -35,6 +35,18 @@ class TestNokogiri < Nokogiri::TestCase
     assert_instance_of Nokogiri::HTML::Document, doc
   end
 
+  if Nokogiri.uses_libxml?
+    def test_io_buffer_size
+      size = Nokogiri.io_buffer_size
+      Nokogiri.io_buffer_size = 16
+      doc = Nokogiri::XML(File.open(XML_FILE, 'rb'))
+      assert_equal 5, doc.search('//employee').length
+      assert_raises(ArgumentError) { Nokogiri.io_buffer_size = 0 }
+    ensure
+      Nokogiri.io_buffer_size = size
+    end
+  end
+
   def test_xml?
     doc = Nokogiri.parse(File.read(XML_FILE))
     assert doc.xml?
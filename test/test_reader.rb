@@ -62,6 +62,35 @@ class TestReader < Nokogiri::TestCase
       reader.map { |x| x.default? }
   end
 
+  def test_from_file
+    reader = Nokogiri::XML::Reader.from_file SNUGGLES_FILE
+    assert_equal SNUGGLES_FILE, reader.source
+    assert_equal Nokogiri::XML::Reader.from_memory(File.read(SNUGGLES_FILE)).map { |x| x.name },
+      reader.map { |x| x.name }
+  end
+
+  def test_from_file_missing
+    assert_raises(Errno::ENOENT) {
+      Nokogiri::XML::Reader.from_file(SNUGGLES_FILE + '.missing')
+    }
+  end
+
+  if File.directory?('/dev/fd')
+    def test_from_file_from_pipe
+      r, w = IO.pipe
+      writer = Thread.new {
+        w.write File.read(SNUGGLES_FILE)
+        w.close
+      }
+      reader = Nokogiri::XML::Reader.from_file("/dev/fd/#{r.fileno}")
+      assert_equal Nokogiri::XML::Reader.from_memory(File.read(SNUGGLES_FILE)).map { |x| x.name },
+        reader.map { |x| x.name }
+      writer.join
+    ensure
+      r.close
+    end
+  end
+
   def test_io
     io = File.open SNUGGLES_FILE
     reader = Nokogiri::XML::Reader(io)
@@ -104,6 +133,27 @@ class TestReader < Nokogiri::TestCase
     end
   end
 
+  class OneArgumentReadpartialIO
+    def initialize string
+      @string = string
+    end
+
+    def read size
+      readpartial(size) rescue nil
+    end
+
+    def readpartial size
+      raise EOFError if @string.empty?
+      @string.slice!(0, 4)
+    end
+  end
+
+  def test_io_with_one_argument_readpartial
+    io = OneArgumentReadpartialIO.new(File.read(SNUGGLES_FILE))
+    assert_equal Nokogiri::XML::Reader.from_memory(File.read(SNUGGLES_FILE)).map { |x| x.name },
+      Nokogiri::XML::Reader(io).map { |x| x.name }
+  end
+
   def test_in_memory
     assert Nokogiri::XML::Reader(<<-eoxml)
     <x xmlns:tenderlove='http://tenderlovemaking.com/'>
@@ -185,6 +235,16 @@ class TestReader < Nokogiri::TestCase
       reader.map { |x| x.attributes }
   end
 
+  def test_attributes_values
+    reader = Nokogiri::XML::Reader.from_memory(<<-eoxml)
+    <!DOCTYPE x [<!ENTITY e "entity">]>
+    <x a="&amp;&#233;" b="" c="&e;!"/>
+    eoxml
+    reader.read until reader.node_type == Nokogiri::XML::Reader::TYPE_ELEMENT
+    assert_equal({ 'a' => "&\u00e9", 'b' => '', 'c' => 'entity!' },
+                 reader.attributes)
+  end
+
   def test_attribute_roundtrip
     reader = Nokogiri::XML::Reader.from_memory(<<-eoxml)
     <x xmlns:tenderlove='http://tenderlovemaking.com/'
@@ -409,6 +469,115 @@ class TestReader < Nokogiri::TestCase
     assert called
   end
 
+  def test_each_subtree
+    reader = Nokogiri::XML::Reader(<<-eoxml)
+      <feed xmlns:p="http://p">
+        <entry id="1"><title>one</title><p:link href="a"/></entry>
+        <other><entry id="2"><title>two</title></entry></other>
+        <p:entry id="3"><title>three</title></p:entry>
+      </feed>
+    eoxml
+
+    entries = []
+    reader.each_subtree('entry') do |entry|
+      entries << entry
+    end
+
+    assert_equal %w{ 1 2 3 }, entries.map { |e| e['id'] }
+    assert_equal %w{ one two three }, entries.map { |e| e.at('title').text }
+    assert_equal 'a', entries.first.at_xpath('p:link', 'p' => 'http://p')['href']
+    assert_equal 1, entries.first.css('title').length
+    assert_equal 'p', entries.last.namespace.prefix
+    assert_equal entries.first, entries.first.document.root
+  end
+
+  def test_each_subtree_skips_the_subtree
+    reader = Nokogiri::XML::Reader('<r><a><a/></a><b/><a/></r>')
+    names = []
+    reader.each_subtree('a') { |a| names << a.children.length }
+    assert_equal [1, 0], names
+  end if Nokogiri.uses_libxml?
+
+  def test_each_subtree_enumerator
+    reader = Nokogiri::XML::Reader('<r><a>1</a><a>2</a></r>')
+    assert_equal %w{ 1 2 }, reader.each_subtree('a').map { |a| a.text }
+  end
+
+  if Nokogiri.uses_libxml?
+    def test_match
+      reader = Nokogiri::XML::Reader(<<-eoxml).match('/feed/entry/link')
+        <feed>
+          <link href="feed"/>
+          <entry><link href="a"/><title>one</title></entry>
+          <entry><link href="b"/><p><link href="nested"/></p></entry>
+        </feed>
+      eoxml
+      assert_equal %w{ a b }, reader.map { |node| node.attribute('href') }
+    end
+
+    def test_match_with_namespaces
+      reader = Nokogiri::XML::Reader(<<-eoxml)
+        <feed xmlns:x="http://x"><x:a>1</x:a><a>2</a><x:b>3</x:b></feed>
+      eoxml
+      reader.match('y:a | y:b', 'y' => 'http://x')
+      assert_equal %w{ a b }, reader.map { |node| node.local_name }
+    end
+
+    def test_match_invalid_pattern
+      reader = Nokogiri::XML::Reader('<r/>')
+      assert_raises(ArgumentError) { reader.match('//[') }
+    end
+
+    def test_each_subtree_with_match
+      reader = Nokogiri::XML::Reader(<<-eoxml).match('feed/entry')
+        <feed><entry id="1"/><other><entry id="x"/></other><entry id="2"/></feed>
+      eoxml
+      assert_equal %w{ 1 2 }, reader.each_subtree.map { |entry| entry['id'] }
+    end
+
+    def test_each_subtree_without_a_pattern
+      reader = Nokogiri::XML::Reader('<r/>')
+      assert_raises(ArgumentError) { reader.each_subtree { } }
+    end
+
+    def test_preserve
+      reader = Nokogiri::XML::Reader(<<-eoxml).preserve('/feed/entry')
+        <feed><entry id="1"/><junk/><entry id="2"><b/></entry></feed>
+      eoxml
+      reader.each { }
+      doc = reader.document
+      assert_equal %w{ 1 2 }, doc.xpath('//entry').map { |e| e['id'] }
+      assert_equal 1, doc.xpath('//b').length
+      assert_equal doc, reader.document
+    end
+  end
+
+  def test_read_record
+    reader = Nokogiri::XML::Reader('<r><a x="1">t</a><a/></r>')
+    records = []
+    while record = reader.read_record
+      records << record
+    end
+
+    assert_equal [
+      [1, 'r', 0, nil, false, false],
+      [1, 'a', 1, nil, true, false],
+      [3, '#text', 2, 't', false, false],
+      [15, 'a', 1, nil, true, false],
+      [1, 'a', 1, nil, false, true],
+      [15, 'r', 0, nil, false, false],
+    ], records
+    assert records.all? { |r| r.frozen? }
+  end
+
+  def test_each_record_shares_names
+    reader = Nokogiri::XML::Reader('<r><a/><a/></r>')
+    names = reader.each_record.map { |record| record[1] }
+    assert_equal %w{ r a a r }, names
+    assert names.all? { |name| name.frozen? }
+    assert_same names[1], names[2]
+  end if Nokogiri.uses_libxml?
+
   def test_large_document_smoke_test
     #  simply run on a large document to verify that there no GC issues
     xml = []
@@ -332,6 +332,194 @@ module Nokogiri
 
           assert_equal [['root', []], ['foo', [['a', '&b'], ['c', '>d']]]], @parser.document.start_elements
         end
+
+        if Nokogiri.uses_libxml?
+          class LeanDoc < XML::SAX::Document
+            attr_reader :events
+
+            def initialize
+              @events = []
+            end
+
+            def start_element_namespace name, attrs = [], prefix = nil, uri = nil, ns = []
+              @events << [:start, name, attrs, prefix, uri, ns]
+            end
+
+            def end_element_namespace name, prefix = nil, uri = nil
+              @events << [:end, name, prefix, uri]
+            end
+          end
+
+          def test_lean_flat_attributes
+            doc = LeanDoc.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.parse(<<-eoxml)
+<root xmlns="http://a" xmlns:b="http://b"><b:x b:c="1" d="2"/></root>
+            eoxml
+
+            assert_equal [
+              [:start, 'root', [], nil, 'http://a', [nil, 'http://a', 'b', 'http://b']],
+              [:start, 'x', ['c', 'b', 'http://b', '1', 'd', nil, nil, '2'], 'b', 'http://b', []],
+              [:end, 'x', 'b', 'http://b'],
+              [:end, 'root', nil, 'http://a'],
+            ], doc.events
+          end
+
+          def test_lean_with_a_method_attribute
+            doc = Class.new(LeanDoc) { attr_accessor :method }.new
+            doc.method = 'GET'
+            parser = XML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.parse("<root/>")
+            assert_equal [:start, :end], doc.events.map { |event| event.first }
+          end
+
+          def test_lean_interns_names
+            doc = LeanDoc.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.parse("<root><a x='1'/><a x='2'/></root>")
+
+            starts = doc.events.select { |event| event.first == :start }
+            assert starts[1][1].frozen?
+            assert_equal starts[1][1].object_id, starts[2][1].object_id
+            assert_equal starts[1][2][0].object_id, starts[2][2][0].object_id
+            assert_equal starts[1][1].object_id, doc.events[-2][1].object_id
+            assert !starts[1][2][3].frozen?
+          end
+
+          def test_lean_calls_sax1_methods_directly
+            doc = Class.new(XML::SAX::Document) {
+              attr_reader :starts, :ends
+              def start_element name, attrs = []
+                (@starts ||= []) << [name, attrs]
+              end
+              def end_element name
+                (@ends ||= []) << name
+              end
+            }.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.parse("<a:root xmlns:a='http://a' a:x='1' y='2'><b/></a:root>")
+
+            assert_equal [
+              ['a:root', ['xmlns:a', 'http://a', 'a:x', '1', 'y', '2']],
+              ['b', []]
+            ], doc.starts
+            assert_equal ['b', 'a:root'], doc.ends
+          end
+
+          def test_lean_skips_inherited_callbacks
+            called = []
+            doc = Class.new(XML::SAX::Document) {
+              define_method(:end_element) { |*args| called << :end_element }
+            }.new
+
+            parser = XML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.parse("<root><a>text<!-- c --></a></root>")
+            assert_equal [:end_element, :end_element], called
+          end
+
+          def test_lean_sends_everything_to_duck_typed_documents
+            doc = Object.new
+            def doc.method_missing name, *args
+              (@called ||= []) << name
+            end
+            def doc.called; @called; end
+
+            parser = XML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.parse("<root>text</root>")
+            assert_equal [:start_document, :start_element_namespace,
+                          :characters, :end_element_namespace, :end_document],
+                         doc.called
+          end
+
+          def test_batched_events_reach_each_callback
+            doc = Doc.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.batch_size = 2
+            parser.parse("<root a='1'>text<!-- c --><b/></root>")
+
+            assert_equal [['root', [['a', '1']]], ['b', []]], doc.start_elements
+            assert_equal [['b'], ['root']], doc.end_elements
+            assert_equal ['text'], doc.data
+            assert_equal [' c '], doc.comments
+            assert doc.end_document_called
+          end
+
+          def test_batched_events
+            batches = []
+            doc = Class.new(XML::SAX::Document) {
+              define_method(:events) { |batch| batches << batch }
+            }.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.batch_size = 3
+            parser.parse("<root><a>x</a></root>")
+
+            assert_equal [
+              [:start_document,
+               :start_element_namespace, 'root', [], nil, nil, [],
+               :start_element_namespace, 'a', [], nil, nil, []],
+              [:characters, 'x',
+               :end_element_namespace, 'a', nil, nil,
+               :end_element_namespace, 'root', nil, nil],
+              [:end_document],
+            ], batches
+          end
+
+          def test_batched_lean_events
+            batches = []
+            doc = Class.new(XML::SAX::Document) {
+              define_method(:events) { |batch| batches << batch }
+            }.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.lean = true
+            parser.batch_size = 100
+            parser.parse("<root a='1'/>")
+
+            assert_equal [[
+              :start_document,
+              :start_element_namespace, 'root', ['a', nil, nil, '1'], nil, nil, [],
+              :end_element_namespace, 'root', nil, nil,
+              :end_document
+            ]], batches
+          end
+
+          def test_coalesce_characters
+            doc = Doc.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.coalesce_characters = true
+            parser.parse("<root>a &amp; b<x/>  <!-- c -->c&#100;</root>")
+            assert_equal ['a & b', '  ', 'cd'], doc.data
+          end
+
+          def test_coalesced_characters_come_before_errors
+            doc = Class.new(XML::SAX::Document) {
+              attr_reader :events
+              def characters string
+                (@events ||= []) << string
+              end
+              def error message
+                (@events ||= []) << :error
+              end
+            }.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.coalesce_characters = true
+            parser.parse("<root>abc&bogus;def</root>")
+            assert_equal ['abc', :error, 'def'], doc.events
+          end
+
+          def test_drop_whitespace
+            doc = Doc.new
+            parser = XML::SAX::Parser.new(doc)
+            parser.drop_whitespace = true
+            parser.parse("<root>\n  <a> x </a>\n  <b>\t</b>\n</root>")
+            assert_equal [' x '], doc.data
+          end
+        end
       end
     end
   end
@@ -150,6 +150,149 @@ module Nokogiri
           assert_equal "Gau\337", @parser.document.data.join
           assert_equal [["r"]], @parser.document.end_elements
         end
+
+        if Nokogiri.uses_libxml?
+          def test_lean
+            doc = Class.new(XML::SAX::Document) {
+              attr_reader :starts
+              def start_element name, attrs = []
+                (@starts ||= []) << [name, attrs]
+              end
+            }.new
+            first = @parser.document
+            @parser << "<root a='1'>"
+            @parser.document = doc
+            @parser.lean = true
+            @parser << "<b c='2'/></root>"
+            @parser.finish
+            assert_equal [['root', [['a', '1']]]], first.start_elements
+            assert_equal [['b', ['c', '2']]], doc.starts
+          end
+
+          def test_batched_events_are_delivered_after_each_write
+            @parser.batch_size = 100
+            @parser << "<root><a/>"
+            assert_equal [['root', []], ['a', []]], @parser.document.start_elements
+            @parser << "<b/></root>"
+            assert_equal [['a'], ['b'], ['root']], @parser.document.end_elements
+            @parser.finish
+            assert @parser.document.end_document_called
+          end
+
+          def test_coalesce_characters_across_writes
+            @parser.coalesce_characters = true
+            @parser << "<root>hel"
+            @parser << "lo wor"
+            assert_nil @parser.document.data
+            @parser << "ld</root>"
+            @parser.finish
+            assert_equal ['hello world'], @parser.document.data
+          end
+
+          def test_feed_from
+            rd, wr = IO.pipe
+            writer = Thread.new do
+              wr.write "<root><a>he"
+              sleep 0.05
+              wr.write "llo</a><b/></root>"
+              wr.close
+            end
+            assert_equal @parser, @parser.feed_from(rd)
+            writer.join
+            rd.close
+
+            assert_equal [['root', []], ['a', []], ['b', []]], @parser.document.start_elements
+            assert_equal 'hello', @parser.document.data.join
+            assert @parser.document.end_document_called
+          end
+
+          def test_feed_from_nonblock
+            rd, wr = IO.pipe
+            wr.write "<root><a>"
+            assert_equal :wait_readable, @parser.feed_from_nonblock(rd)
+            assert_equal [['root', []], ['a', []]], @parser.document.start_elements
+
+            wr.write "</a></root>"
+            wr.close
+            assert_equal true, @parser.feed_from_nonblock(rd)
+            assert @parser.document.end_document_called
+            rd.close
+          end
+
+          if defined?(IO::WaitReadable)
+            def test_feed_from_nonblock_waits_on_ssl_style_errors
+              wait_readable = Class.new(StandardError) { include IO::WaitReadable }
+              io = Object.new
+              io.instance_variable_set(:@chunks, ["<root>", wait_readable, "</root>"])
+              def io.read_nonblock size
+                chunk = @chunks.shift
+                raise EOFError unless chunk
+                raise chunk.new if Class === chunk
+                chunk
+              end
+
+              assert_equal :wait_readable, @parser.feed_from_nonblock(io)
+              assert_equal [['root', []]], @parser.document.start_elements
+              assert_equal true, @parser.feed_from_nonblock(io)
+              assert @parser.document.end_document_called
+            end
+          end
+
+          def test_thread_raise_during_write
+            interrupt = Class.new(StandardError)
+            chunk     = '<a>b</a>' * 50_000
+            writes    = Queue.new
+            @parser << '<root>'
+
+            writer = Thread.new do
+              begin
+                loop { @parser << chunk; writes << true }
+              rescue interrupt
+              end
+            end
+            2.times { writes.pop }
+            writer.raise interrupt
+            writer.join
+
+            @parser << '<a>b</a></root>'
+            @parser.finish
+            assert @parser.document.end_document_called
+          end
+
+          def test_writes_are_parsed_while_interrupts_are_pending
+            ticker = Thread.new { loop { sleep 0.001 } }
+            2000.times do
+              Array.new(100) { 'x' * 10 }
+              parser = XML::SAX::PushParser.new(Doc.new)
+              %w{ <r> <a/> <b/> </r> }.each { |chunk| parser << chunk }
+              parser.finish
+              assert_equal [['r', []], ['a', []], ['b', []]],
+                parser.document.start_elements
+            end
+          ensure
+            ticker.kill
+          end
+
+          def test_write_while_events_are_replayed
+            parser = @parser
+            doc = Class.new(XML::SAX::Document) {
+              attr_reader :error
+              define_method(:start_element) do |name, attrs|
+                return unless name == 'a'
+                begin
+                  parser << '<b/>'
+                rescue RuntimeError => e
+                  @error = e
+                end
+              end
+            }.new
+            @parser.document = doc
+            @parser << '<root><a/>'
+            @parser << '</root>'
+            @parser.finish
+            assert_match(/already parsing/, doc.error.message)
+          end
+        end
       end
     end
   end
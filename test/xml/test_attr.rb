@@ -28,6 +28,17 @@ module Nokogiri
         assert_equal "Y&ent1;", street.value
       end
 
+      def test_value_keeps_referenced_children
+        xml = Nokogiri::XML.parse(File.read(XML_FILE), XML_FILE)
+        street = xml.xpath('//address')[3].attributes['street']
+        text = street.children.first
+        old = text.content
+        street.value = "bar"
+        GC.start
+        assert_equal "bar", street.value
+        assert_equal old, text.content
+      end
+
       def test_unlink
         xml = Nokogiri::XML.parse(File.read(XML_FILE), XML_FILE)
         address = xml.xpath('/staff/employee/address').first
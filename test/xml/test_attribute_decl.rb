@@ -20,7 +20,7 @@ module Nokogiri
 
       def test_inspect
         assert_equal(
-          "#<#{@attr_decl.class.name}:#{sprintf("0x%x", @attr_decl.object_id)} #{@attr_decl.to_s.inspect}>",
+          "#<#{@attr_decl.class.name}:#{sprintf("0x%x", @attr_decl.pointer_id)} #{@attr_decl.to_s.inspect}>",
           @attr_decl.inspect
         )
       end
@@ -1,6 +1,7 @@
 require "helper"
 
 require 'uri'
+require 'pathname'
 
 module Nokogiri
   module XML
@@ -465,6 +466,47 @@ module Nokogiri
         end
       end
 
+      def test_errors_are_kept_per_document_when_parsing_in_threads
+        docs = (1..4).map { |i|
+          Thread.new { Nokogiri::XML("<foo>" + "<bar>" * i + "</foo>") }
+        }.map { |t| t.value }
+
+        docs.each_with_index do |doc, i|
+          assert doc.errors.length > 0
+          assert_equal i + 1, doc.xpath('//bar').length
+        end
+      end
+
+      def test_thread_raise_during_parse
+        interrupt = Class.new(StandardError)
+        xml       = '<root>' + '<a>b</a>' * 200_000 + '</root>'
+        parses    = Queue.new
+
+        parser = Thread.new do
+          begin
+            loop { Nokogiri::XML(xml); parses << true }
+          rescue interrupt
+            :interrupted
+          end
+        end
+        parses.pop
+        parser.raise interrupt
+
+        assert_equal :interrupted, parser.value
+        assert_equal 200_000, Nokogiri::XML(xml).root.children.length
+      end
+
+      def test_parse_while_interrupts_are_pending
+        ticker = Thread.new { loop { sleep 0.001 } }
+        2000.times do
+          Array.new(100) { 'x' * 10 }
+          doc = Nokogiri::XML::Document.read_memory('<r><a/></r>', nil, nil, 0)
+          assert_equal 'a', doc.root.children.first.name
+        end
+      ensure
+        ticker.kill
+      end
+
       def test_strict_document_throws_syntax_error
         assert_raises(Nokogiri::XML::SyntaxError) {
           Nokogiri::XML('<foo><bar></foo>', nil, nil, 0)
@@ -515,6 +557,169 @@ module Nokogiri
         assert set.length > 0
       end
 
+      def test_parse_can_take_partially_read_io
+        File.open(XML_FILE, 'rb') { |f|
+          f.ungetc(f.getc)
+          assert_equal 5, Nokogiri::XML(f).search('//employee').length
+        }
+      end
+
+      def test_parse_can_take_pipe
+        r, w = IO.pipe
+        writer = Thread.new {
+          File.open(XML_FILE, 'rb') { |f| w.write f.read }
+          w.close
+        }
+        assert_equal 5, Nokogiri::XML(r).search('//employee').length
+        writer.join
+      ensure
+        r.close
+      end
+
+      def test_parse_can_take_io_that_reads_too_much
+        io = Object.new
+        def io.read(size)
+          @data ||= File.read(XML_FILE)
+          @data.slice!(0, @data.length)
+        end
+        assert_equal 5, Nokogiri::XML(io).search('//employee').length
+      end
+
+      def test_parse_can_take_io_with_one_argument_readpartial
+        io = Object.new
+        def io.readpartial(size)
+          @data ||= File.read(XML_FILE)
+          raise EOFError if @data.empty?
+          @data.slice!(0, 16)
+        end
+        def io.read(size)
+          readpartial(size) rescue nil
+        end
+        assert_equal 5, Nokogiri::XML(io).search('//employee').length
+      end
+
+      def test_parse_raises_errors_from_io
+        io = Object.new
+        def io.read(size)
+          raise IOError, 'lost connection'
+        end
+        e = assert_raises(IOError) { Nokogiri::XML(io) }
+        assert_equal 'lost connection', e.message
+      end
+
+      def test_parse_file
+        xml = Nokogiri::XML::Document.parse_file(XML_FILE)
+        assert xml.xml?
+        assert_equal XML_FILE, xml.url
+        assert_equal Nokogiri::XML(File.read(XML_FILE)).search('//employee').length,
+          xml.search('//employee').length
+      end
+
+      def test_parse_file_yields_parse_options
+        Nokogiri::XML::Document.parse_file(XML_FILE) { |options|
+          assert_instance_of Nokogiri::XML::ParseOptions, options
+          options.noblanks
+        }
+      end
+
+      def test_parse_file_empty
+        file = Tempfile.new('empty')
+        file.close
+        doc = Nokogiri::XML::Document.parse_file(file.path)
+        assert_nil doc.root
+      ensure
+        file.close!
+      end
+
+      if File.directory?('/dev/fd')
+        def test_parse_file_from_pipe
+          r, w = IO.pipe
+          writer = Thread.new {
+            File.open(XML_FILE, 'rb') { |f| w.write f.read }
+            w.close
+          }
+          doc = Nokogiri::XML::Document.parse_file("/dev/fd/#{r.fileno}")
+          assert_equal 5, doc.search('//employee').length
+          writer.join
+        ensure
+          r.close
+        end
+      end
+
+      def test_parse_file_missing
+        assert_raises(Errno::ENOENT) {
+          Nokogiri::XML::Document.parse_file(XML_FILE + '.missing')
+        }
+      end
+
+      def test_parse_many
+        sources = (1..20).map { |i| "<r id='#{i}'>#{'<a/>' * i}</r>" }
+        sources << '' << StringIO.new('<io/>') << Pathname.new(XML_FILE)
+        docs = Nokogiri::XML.parse_many(sources, :threads => 3)
+
+        assert_equal sources.length, docs.length
+        docs.first(20).each_with_index do |doc, i|
+          assert_equal((i + 1).to_s, doc.root['id'])
+          assert_equal i + 1, doc.root.children.length
+        end
+        assert_nil docs[20].root
+        assert_equal 'io', docs[21].root.name
+        assert_equal Nokogiri::XML(File.read(XML_FILE)).search('//employee').length,
+          docs[22].search('//employee').length
+      end
+
+      def test_parse_many_errors
+        docs = Nokogiri::XML.parse_many(['<r/>', '<r><a></r>'])
+        assert_equal [], docs.first.errors
+        assert docs.last.errors.length > 0
+
+        assert_raises(Nokogiri::XML::SyntaxError) {
+          Nokogiri::XML.parse_many(['<r/>', '<r>'],
+            :options => Nokogiri::XML::ParseOptions::STRICT)
+        }
+      end
+
+      def test_parse_many_checks_sources_first
+        assert_raises(ArgumentError) {
+          Nokogiri::XML.parse_many(['<r/>', '<r/>'], :encoding => "UTF\0-8")
+        }
+        assert_raises(TypeError) {
+          Nokogiri::XML::Document.read_memory_many(['<r/>', 1], nil, 0, 2)
+        }
+      end
+
+      def test_thread_raise_during_parse_many
+        interrupt = Class.new(StandardError)
+        sources   = ['<root>' + '<a>b</a>' * 50_000 + '</root>'] * 4
+        parses    = Queue.new
+
+        parser = Thread.new do
+          begin
+            loop { Nokogiri::XML.parse_many(sources, :threads => 2); parses << true }
+          rescue interrupt
+            :interrupted
+          end
+        end
+        parses.pop
+        parser.raise interrupt
+
+        assert_equal :interrupted, parser.value
+        assert_equal [50_000] * 4, Nokogiri::XML.parse_many(sources).map { |doc|
+          doc.root.children.length
+        }
+      end
+
+      def test_parse_many_while_interrupts_are_pending
+        ticker = Thread.new { loop { sleep 0.001 } }
+        200.times do
+          Array.new(100) { 'x' * 10 }
+          docs = Nokogiri::XML.parse_many(['<r><a/></r>'] * 8, :threads => 2)
+          assert_equal ['a'] * 8, docs.map { |doc| doc.root.children.first.name }
+        end
+      ensure
+        ticker.kill
+      end
+
       def test_search_on_empty_documents
         doc = Nokogiri::XML::Document.new
         ns = doc.search('//foo')
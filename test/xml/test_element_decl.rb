@@ -24,7 +24,7 @@ module Nokogiri
       def test_inspect
         e = @elements.first
         assert_equal(
-          "#<#{e.class.name}:#{sprintf("0x%x", e.object_id)} #{e.to_s.inspect}>",
+          "#<#{e.class.name}:#{sprintf("0x%x", e.pointer_id)} #{e.to_s.inspect}>",
           e.inspect
         )
       end
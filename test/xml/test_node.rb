@@ -27,6 +27,65 @@ module Nokogiri
         assert_equal nodes.last, @xml.root.element_children.last
       end
 
+      if Nokogiri.uses_libxml?
+        def test_wrappers_are_not_held_by_the_document
+          @xml.root.traverse { |node| node.name }
+          assert_equal [], @xml.instance_variable_get(:@node_cache)
+        end
+
+        def test_wrapper_identity_is_stable_while_referenced
+          node = @xml.at('employee')
+          @xml.root.traverse { |n| n.name }
+          GC.start
+          GC.compact if GC.respond_to?(:compact)
+          assert_same node, @xml.at('employee')
+        end
+
+        def test_subclass_wrappers_are_held_by_the_document
+          klass = Class.new(Nokogiri::XML::Element)
+          node  = klass.new('foo', @xml)
+          node.instance_variable_set(:@state, 10)
+          @xml.root.add_child node
+          node = nil
+          GC.start
+          assert_instance_of klass, @xml.root.children.last
+          assert_equal 10, @xml.root.children.last.instance_variable_get(:@state)
+        end
+
+        def test_merged_text_node_keeps_the_reparented_wrapper
+          doc  = Nokogiri::XML('<root><a>foo</a></root>')
+          a    = doc.at('a')
+          a.children.first.content
+          text = Nokogiri::XML::Text.new('bar', doc)
+          a.add_child text
+          GC.start
+          assert_equal 'foobar', text.content
+          assert a.children.last.equal?(text)
+        end
+
+        def test_both_wrappers_of_a_merged_text_node_survive
+          doc  = Nokogiri::XML('<root><a>foo</a></root>')
+          a    = doc.at('a')
+          old  = a.children.first
+          text = Nokogiri::XML::Text.new('bar', doc)
+          a.add_child text
+          text = nil
+          GC.start
+          assert_equal 'foobar', old.content
+          assert_equal 'foobar', a.children.last.content
+          old = nil
+          GC.start
+          assert_equal 'foobar', a.children.last.content
+        end
+
+        def test_node_outlives_unreferenced_document
+          node = Nokogiri::XML('<root><child>hello</child></root>').at('child')
+          GC.start
+          assert_equal 'root', node.document.root.name
+          assert_equal 'hello', node.text
+        end
+      end
+
       def test_bad_xpath
         bad_xpath = '//foo['
 
@@ -489,6 +548,135 @@ module Nokogiri
         assert_equal @xml.to_xml, io.read
       end
 
+      def test_serialize_keeps_encoding
+        xml = @xml.serialize(:encoding => 'Shift_JIS')
+        assert_match(/encoding="Shift_JIS"/, xml)
+        if xml.respond_to?(:encoding)
+          assert_equal Encoding::Shift_JIS, xml.encoding
+        end
+      end
+
+      if Nokogiri.uses_libxml?
+        def test_write_to_string
+          string = 'x'
+          @xml.write_to string
+          assert_equal 'x' + @xml.to_xml, string
+        end
+
+        def test_write_to_frozen_string
+          assert_raises(RuntimeError) { @xml.write_to 'x'.freeze }
+        end
+      end
+
+      def test_concurrent_indentation
+        doc = Nokogiri::XML('<r><a><b/></a></r>')
+        expected = (1..4).map { |i| doc.to_xml(:indent => i, :indent_text => '-') }
+        threads = (1..4).map do |i|
+          Thread.new { (1..20).map { doc.to_xml(:indent => i, :indent_text => '-') }.uniq }
+        end
+        assert_equal expected.map { |xml| [xml] }, threads.map { |t| t.value }
+        assert_match(/^---<a>/, expected[2])
+        assert_equal doc.to_xml(:indent => 2), doc.to_xml
+      end
+
+      def test_thread_raise_during_serialization
+        interrupt = Class.new(StandardError)
+        root      = Nokogiri::XML('<r>' + '<a>b</a>' * 100_000 + '</r>').root
+        writes    = Queue.new
+
+        writer = Thread.new do
+          begin
+            loop { root.to_xml; writes << true }
+          rescue interrupt
+            :interrupted
+          end
+        end
+        writes.pop
+        writer.raise interrupt
+
+        assert_equal :interrupted, writer.value
+        assert_match(/\A<r>/, root.to_xml)
+      end
+
+      def test_serialize_while_interrupts_are_pending
+        ticker = Thread.new { loop { sleep 0.001 } }
+        root = Nokogiri::XML('<r><a/></r>').root
+        expected = root.to_xml
+        2000.times do
+          Array.new(100) { 'x' * 10 }
+          assert_equal expected, root.to_xml
+        end
+      ensure
+        ticker.kill
+      end
+
+      def test_indentation_too_long
+        doc = Nokogiri::XML('<r><a/></r>')
+        assert_match(/^#{'-' * 60}<a/, doc.to_xml(:indent => 60, :indent_text => '-'))
+        assert_match(/^<a/, doc.to_xml(:indent => 61, :indent_text => '-'))
+        assert_match(/^<a/, doc.root.to_xml(:indent => 100, :indent_text => '-'))
+      end
+
+      def test_concurrent_serialization_with_encoding
+        doc = Nokogiri::XML('<?xml version="1.0" encoding="UTF-8"?><r>' +
+                            '<a>caf&#233;</a>' * 2000 + '</r>')
+        encodings = %w{ UTF-8 ISO-8859-1 UTF-8 ISO-8859-1 }
+        threads = encodings.map do |encoding|
+          Thread.new { (1..20).map { doc.to_xml(:encoding => encoding) }.uniq.length }
+        end
+        assert_equal [1, 1, 1, 1], threads.map { |t| t.value }
+        assert_equal 'UTF-8', doc.encoding
+
+        html = Nokogiri::HTML('<html><head><meta charset="UTF-8"></head><body>' +
+                              '<p>x</p>' * 2000 + '</body></html>')
+        threads = encodings.map do |encoding|
+          Thread.new { (1..20).map { html.at('body').to_html(:encoding => encoding) }.uniq.length }
+        end
+        assert_equal [1, 1, 1, 1], threads.map { |t| t.value }
+        assert_equal 'UTF-8', html.encoding
+      end
+
+      def test_write_to_file
+        file = Tempfile.new('write_to')
+        file.write 'x'
+        @xml.write_to file
+        file.close
+        assert_equal 'x' + @xml.to_xml, File.read(file.path)
+      ensure
+        file.close!
+      end
+
+      def test_write_to_file_that_converts
+        file = Tempfile.new('write_to')
+        file.close
+        doc = Nokogiri::XML('<r>x</r>')
+        File.open(file.path, 'w:UTF-16LE') { |io| doc.root.write_to io }
+        expected = doc.root.to_xml
+        assert_equal expected.encode('UTF-16LE').force_encoding('BINARY'),
+          File.open(file.path, 'rb') { |io| io.read }
+        File.open(file.path, 'w', :newline => :crlf) { |io| doc.write_to io }
+        assert_equal doc.to_xml.gsub("\n", "\r\n"),
+          File.open(file.path, 'rb') { |io| io.read }
+      ensure
+        file.close!
+      end if ''.respond_to?(:encode)
+
+      def test_write_to_pipe
+        r, w = IO.pipe
+        reader = Thread.new { r.read }
+        @xml.write_to w
+        w.close
+        assert_equal @xml.to_xml, reader.value
+      end
+
+      def test_write_to_raises_errors_from_io
+        io = Object.new
+        def io.write(string)
+          raise IOError, 'full'
+        end
+        assert_raises(IOError) { @xml.write_to io }
+      end
+
       def test_attribute_with_symbol
         assert_equal 'Yes', @xml.css('address').first[:domestic]
       end
@@ -162,7 +162,45 @@ module Nokogiri
         set = html.xpath("/html/body/div")
         assert_equal set.first, set.search(".a").first
       end
-      
+
+      def test_css_removes_duplicates_in_document_order
+        html = Nokogiri::HTML(<<-eohtml)
+          <div id='outer'><p id='a'></p><div id='inner'><p id='b'></p></div></div>
+          <p id='c'></p>
+        eohtml
+        set = html.css('#inner, #outer, body')
+        assert_equal %w{ a b c }, set.css('p').map { |p| p['id'] }
+        assert_equal %w{ a b c }, set.xpath('.//p').map { |p| p['id'] }
+        assert_equal %w{ a b c }, set.search('p', './/p').map { |p| p['id'] }
+      end
+
+      def test_xpath_with_variable_binding
+        set = @xml.xpath('//staff')
+        assert_equal 4,
+          set.xpath('.//address[@domestic=$value]', nil, :value => 'Yes').length
+        assert_equal 4,
+          set.xpath('.//address[@domestic=$value]', {}, :value => 'Yes').length
+        assert_equal 4,
+          set.search('.//address[@domestic=$value]', nil, :value => 'Yes').length
+      end
+
+      def test_xpath_with_multiple_paths_on_node_set
+        set = @xml.xpath('//employee')
+        found = set.xpath('./name', './position', './name')
+        assert_equal @xml.xpath('//employee/name | //employee/position'), found
+      end
+
+      def test_xpath_on_node_set_returning_namespaces
+        xml = Nokogiri.XML('<foo xmlns:n0="http://example.com"><bar/><baz/></foo>')
+        found = xml.xpath('//bar | //baz').xpath('../namespace::n0')
+        assert_equal 1, found.length
+        assert_equal 'http://example.com', found.first.href
+      end
+
+      def test_xpath_on_node_set_must_return_nodes
+        assert_raises(ArgumentError) { @list.xpath('count(.)') }
+      end
+
       def test_css_search_with_namespace
         fragment = Nokogiri::XML.fragment(<<-eoxml)
           <html xmlns="http://www.w3.org/1999/xhtml">
@@ -615,6 +653,111 @@ module Nokogiri
         assert ! empty_set.include?(employee)
       end
 
+      def test_to_a_keeps_nodes_alive
+        skip("JRuby doesn't do GC.") if Nokogiri.jruby?
+        set = Nokogiri::XML("<root>#{'<a/>' * 10}</root>").root.children
+        begin
+          GC.stress = true
+          list = set.to_a
+        ensure
+          GC.stress = false
+        end
+        assert list.all? { |node| node.name == 'a' }
+      end
+
+      def test_each
+        nodes = []
+        assert_equal @list, @list.each { |node| nodes << node }
+        assert_equal @list.to_a, nodes
+        assert_equal @list.to_a, @list.each.to_a
+      end
+
+      def test_each_while_deleting
+        seen = 0
+        @list.each { |node| seen += 1; @list.delete(node) }
+        assert_equal 3, seen
+        assert_equal 2, @list.length
+      end
+
+      def test_map
+        assert_equal @list.to_a.map { |node| node.path },
+                     @list.map { |node| node.path }
+        assert_equal @list.map { |node| node.path },
+                     @list.collect { |node| node.path }
+      end
+
+      def test_pluck
+        addresses = @xml.xpath('//address')
+        assert_equal addresses.to_a.map { |node| node['domestic'] },
+                     addresses.pluck('domestic')
+        assert_equal [nil] * addresses.length, addresses.pluck(:missing)
+        assert_equal [nil], @xml.xpath('//address/text()')[0, 1].pluck('x')
+      end
+
+      def test_texts
+        names = @xml.xpath('//name')
+        assert_equal names.to_a.map { |node| node.text }, names.texts
+      end
+
+      def test_names
+        nodes = @xml.xpath('//employee/node()')
+        assert_equal nodes.to_a.map { |node| node.name }, nodes.names
+      end
+
+      def test_names_of_documents_and_cdata
+        xml = Nokogiri::XML('<r><![CDATA[x]]><a/></r>')
+        nodes = xml.xpath('/ | //node()')
+        assert_equal %w{ document r #cdata-section a }, nodes.names
+        assert_equal nodes.to_a.map { |node| node.name }, nodes.names
+
+        html = Nokogiri::HTML('<p>x</p>')
+        assert_equal ['document'], html.xpath('/').names
+      end
+
+      def test_bulk_values_of_namespaces
+        list = Nokogiri.XML('<foo xmlns:n0="http://example.com" />').xpath('//namespace::n0')
+        assert_equal [nil], list.names
+        assert_equal [nil], list.texts
+        assert_equal [nil], list.pluck('x')
+      end
+
+      def test_set_operations_on_large_sets
+        doc   = Nokogiri::XML("<root>#{'<a/><b/>' * 200}</root>")
+        all   = doc.root.children
+        as    = doc.xpath('//a')
+        evens = NodeSet.new(doc, all.to_a.values_at(*(0...400).step(2)))
+
+        assert_equal 200, (all - as).length
+        assert_equal as.to_a, (all & as).to_a
+        assert_equal as.to_a, (all & evens).to_a
+        assert_equal all.length, (as | all).length
+        assert((all - as).all? { |node| node.name == 'b' })
+
+        assert all.include?(as.last)
+        assert_equal as.last, all.delete(as.last)
+        assert ! all.include?(as.last)
+        assert_nil all.delete(as.last)
+        all.push as.last
+        all.push as.last
+        assert_equal 400, all.length
+        assert all.include?(as.last)
+      end
+
+      def test_set_operations_in_document_order
+        doc  = Nokogiri::XML("<root>#{'<a/><b/>' * 100}</root>")
+        as   = doc.xpath('//a')
+        bs   = doc.xpath('//b')
+        all  = doc.root.children
+        back = NodeSet.new(doc, all.to_a.reverse)
+
+        assert_equal all.to_a, bs.union(as, true).to_a
+        assert_equal bs.to_a + as.to_a, bs.union(as).to_a
+        assert_equal as.to_a, back.difference(bs, true).to_a
+        assert_equal as.to_a.reverse, back.difference(bs).to_a
+        assert_equal bs.to_a, back.intersection(bs, true).to_a
+        assert_equal bs.to_a.reverse, back.intersection(bs).to_a
+      end
+
       def test_children
         employees = @xml.search("//employee")
         count = 0
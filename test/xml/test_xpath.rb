@@ -61,10 +61,157 @@ module Nokogiri
         }.new
       end
 
+      def test_compiled_expression
+        expr = Nokogiri::XML::XPath::Expression.new('//employee')
+        assert_equal '//employee', expr.to_s
+        assert_equal @xml.xpath('//employee'), @xml.xpath(expr)
+        assert_equal @xml.xpath('//employee').first, @xml.at_xpath(expr)
+      end
+
+      def test_compiled_expression_is_shared_across_documents
+        expr  = Nokogiri::XML::XPath::Expression.new('.//foo:name')
+        other = Nokogiri::XML('<root xmlns:foo="bar"><foo:name/><foo:name/></root>')
+        assert_equal 2, other.xpath(expr, 'foo' => 'bar').length
+        assert_equal 0, @xml.xpath(expr, 'foo' => 'bar').length
+      end
+
+      def test_compiled_expression_with_variables_and_handler
+        expr = Nokogiri::XML::XPath::Expression.new('//address[@domestic=$value]')
+        assert_equal 4, @xml.xpath(expr, nil, :value => 'Yes').length
+
+        expr = Nokogiri::XML::XPath::Expression.new('//employee[thing(.)]')
+        set  = @xml.xpath(expr, @handler)
+        assert_equal @xml.xpath('//employee').length, set.length
+      end
+
+      def test_compiled_expression_on_node_set
+        expr = Nokogiri::XML::XPath::Expression.new('.//name')
+        set  = @xml.xpath('//employee')
+        assert_equal set.xpath('.//name'), set.xpath(expr)
+        assert_equal set.search('.//name'), set.search(expr)
+      end
+
+      def test_compiled_expression_syntax_error
+        assert_raises(Nokogiri::XML::XPath::SyntaxError) do
+          Nokogiri::XML::XPath::Expression.new('//employee[')
+        end
+      end
+
+      def test_concurrent_queries
+        expected = @xml.xpath('//employee[name]').length
+        threads = (1..4).map do
+          Thread.new { (1..10).map { @xml.xpath('//employee[name]').length }.uniq }
+        end
+        threads.each { |t| assert_equal [expected], t.value }
+      end
+
+      def test_thread_raise_during_query
+        interrupt = Class.new(StandardError)
+        doc       = Nokogiri::XML('<root>' + '<a>b</a>' * 100_000 + '</root>')
+        queries   = Queue.new
+
+        searcher = Thread.new do
+          begin
+            loop { doc.xpath('//a[. = "b"]'); queries << true }
+          rescue interrupt
+            :interrupted
+          end
+        end
+        queries.pop
+        searcher.raise interrupt
+
+        assert_equal :interrupted, searcher.value
+        assert_equal 100_000, doc.xpath('//a[. = "b"]').length
+      end
+
+      def test_query_while_interrupts_are_pending
+        ticker = Thread.new { loop { sleep 0.001 } }
+        doc = Nokogiri::XML('<r><a/></r>')
+        2000.times do
+          Array.new(100) { 'x' * 10 }
+          assert_equal 1, doc.xpath('//a').length
+        end
+      ensure
+        ticker.kill
+      end
+
+      def test_handler_functions_are_not_bound_to_shared_expressions
+        assert_equal @xml.xpath('//employee').length,
+          @xml.xpath('//employee[thing(.)]', @handler).length
+        e = assert_raises(RuntimeError) { @xml.xpath('//employee[thing(.)]') }
+        assert_match(/function thing not found/, e.message)
+      end
+
+      def test_handler_functions_are_not_bound_to_expressions
+        expr = Nokogiri::XML::XPath::Expression.new('//employee[thing(.)]')
+        assert_equal @xml.xpath('//employee').length, @xml.xpath(expr, @handler).length
+        assert_raises(RuntimeError) { @xml.xpath(expr) }
+        assert_raises(RuntimeError) { @xml.xpath(expr, Object.new) }
+      end
+
+      def test_error_in_handler_does_not_outlive_the_query
+        handler = Class.new { def boom(nodes); raise ArgumentError; end }.new
+        assert_raises(ArgumentError) { @xml.xpath('//employee[boom(.)]', handler) }
+        assert_raises(Nokogiri::XML::XPath::SyntaxError) { @xml.xpath('//employee[') }
+        assert_equal 5, @xml.xpath('//employee').length
+      end
+
+      def test_expression_cache
+        Nokogiri::XML::XPath::Expression.clear_cache
+        expr = Nokogiri::XML::XPath::Expression['//employee']
+        assert_same expr, Nokogiri::XML::XPath::Expression['//employee']
+        assert_same expr, Nokogiri::XML::XPath::Expression[expr]
+
+        Nokogiri::XML::XPath::Expression.without_cache do
+          refute_same expr, Nokogiri::XML::XPath::Expression['//employee']
+        end
+      end
+
+      def test_expression_cache_is_bounded
+        klass = Nokogiri::XML::XPath::Expression
+        klass.clear_cache
+        klass.cache_size = 4
+        10.times { |i| klass["//a#{i}"] }
+        assert_equal 4, klass.cache_stats[:size]
+        assert_equal 6, klass.cache_stats[:evictions]
+      ensure
+        klass.cache_size = 1024
+        klass.clear_cache
+      end
+
+      def test_handler_queries_are_not_cached
+        Nokogiri::XML::XPath::Expression.clear_cache
+        @xml.xpath('//employee[thing(.)]', @handler)
+        assert_equal 0, Nokogiri::XML::XPath::Expression.cache_stats[:size]
+      end
+
       def test_variable_binding
         assert_equal 4, @xml.xpath('//address[@domestic=$value]', nil, :value => 'Yes').length
       end
 
+      def test_variable_binding_does_not_outlive_the_query
+        assert_equal 4, @xml.xpath('//address[@domestic=$value]', nil, :value => 'Yes').length
+        assert_raises(Nokogiri::XML::XPath::SyntaxError) do
+          @xml.xpath('//address[@domestic=$value]')
+        end
+      end
+
+      def test_namespace_bindings_change_between_queries
+        doc = Nokogiri::XML('<root xmlns:a="foo" xmlns:b="bar"><a:x/><b:x/><b:x/></root>')
+        assert_equal 1, doc.xpath('//n:x', 'n' => 'foo').length
+        assert_equal 2, doc.xpath('//n:x', 'n' => 'bar').length
+        assert_equal 1, doc.xpath('//n:x', 'n' => 'foo').length
+      end
+
+      def test_custom_xpath_handler_may_search_the_same_document
+        doc = @xml
+        handler = Class.new {
+          define_method(:names) { |set| doc.xpath('//name').length }
+        }.new
+        assert_equal doc.xpath('//name').length, doc.xpath('names(.)', handler)
+        assert_equal doc.xpath('//employee').length, doc.root.xpath('./employee').length
+      end
+
       def test_unknown_attribute
         assert_equal 0, @xml.xpath('//employee[@id="asdfasdf"]/@fooo').length
         assert_nil @xml.xpath('//employee[@id="asdfasdf"]/@fooo')[0]